@@ -1,8 +1,16 @@
 
 #include "ansi.h"
 
+#include <cstring>
+
 #include "TANSI_log.h"
 #include "TANSI_platform.h"
+#include "crc.h"
+#include "latency.h"
+#include "rotation.h"
+#include "schedule.h"
+#include "sector_format.h"
+#include "trace.h"
 
 // strings for state names
 static const char* state_names[] = {"DISCONNECTED",
@@ -12,83 +20,221 @@ static const char* state_names[] = {"DISCONNECTED",
                                     "AWAITING_PARAM_OUT",
                                     "EXECUTE_COMMAND",
                                     "AWAITING_PARAM_IN",
-                                    "AWAITING_TIME_DEPENDENT_COMMAND",
                                     "READING",
                                     "WRITING"};
+static_assert(sizeof(state_names) / sizeof(state_names[0]) ==
+                  ANSI_DEV_STATE_COUNT,
+              "state_names out of sync with AnsiDevState");
+
+const char* ansi_state_name(int state) { return state_names[state]; }
+
+AnsiDev gAnsiDevs[ANSI_MAX_DEVICES];
+
+// bit n is set if ANSI id n is emulated
+static uint8_t g_configured_mask;
+// bit n is the attention condition of ANSI id n (see set_attention_state())
+static uint8_t g_attention_mask;
+
+// Upper bound on the number of state transitions carried out for a single
+// edge in interrupt-driven mode.  Nothing in the state machine chains more
+// than a handful of transitions without waiting on the host, so this only
+// exists to keep the ISR bounded if that ever changes.
+#define ANSI_MAX_STEPS_PER_EDGE 8
+
+static bool g_interrupt_driven;
+
+bool g_ansi_turbo_seek;
+bool g_ansi_sector_crc;
+
+// CRC of a sector read with a shortened data field, which the storage
+// doesn't keep
+static uint8_t g_read_crc[ANSI_MAX_DEVICES][ANSI_CRC_BYTES];
+// written sectors whose CRC didn't match
+static volatile uint32_t g_write_crc_errors;
+
+// see ansi_bus_idle()
+#define ANSI_BUS_IDLE_MS 20
+// millis() of the last read or write gate
+static volatile uint32_t g_last_transfer_ms;
+
+// cycle count at which the pin change currently being handled was seen (ISR
+// entry in interrupt-driven mode, the first sample with the new pins when
+// polling.)
+static uint32_t g_edge_cycles;
+// pins of the last edge when polling
+static uint16_t g_edge_pins = 0xffff;
+// handshake phases already timed for this edge.  A response that is repeated
+// while the host holds its lines (e.g. the attention byte for as long as the
+// strobe is active) is only timed the first time.
+static uint32_t g_edge_timed_phases;
+
+static void ansi_start_edge(uint32_t cycles) {
+    g_edge_cycles = cycles;
+    g_edge_timed_phases = 0;
+}
 
-AnsiDev gAnsiDev;
+// worst-case edge -> BUS_ACKNOWLEDGE response seen so far, in cycles
+static volatile uint32_t g_ack_response_max;
 
 static uint8_t control_bus_byte(AnsiOutPins& pins) {
-    uint8_t v = 0;
+    // the control bus is active low, CB0-CB7 are the low byte of the sample
+    return ~pins.raw & 0xff;
+}
+
+static void ansi_sample_out_pins(AnsiOutPins& pins) {
+    pins.raw = platform_sample_ansi_pins();
+}
 
-#define CB_PIN(number)                                                         \
-    if (ACTIVE(pins, CB##number)) {                                            \
-        v |= (1 << number);                                                    \
+// cycles since the pin change being handled
+static inline uint32_t ansi_edge_latency() {
+    return platform_cycle_count() - g_edge_cycles;
+}
+
+// record the latency of a handshake phase, the first time it responds to the
+// current edge.  Returns the latency, or 0 if it was already recorded.
+static uint32_t ansi_time_phase(AnsiLatencyPhase phase) {
+    if (g_edge_timed_phases & (1 << phase)) {
+        return 0;
     }
+    g_edge_timed_phases |= 1 << phase;
 
-    CB_PIN(0);
-    CB_PIN(1);
-    CB_PIN(2);
-    CB_PIN(3);
-    CB_PIN(4);
-    CB_PIN(5);
-    CB_PIN(6);
-    CB_PIN(7);
+    uint32_t cycles = ansi_edge_latency();
+    ansi_latency_record_phase(phase, cycles);
+    return cycles;
+}
 
-#undef CB_PIN
+static void ansi_acknowledge(AnsiLatencyPhase phase) {
+    SET_ACTIVE(BUS_ACKNOWLEDGE);
 
-    return v;
+    uint32_t cycles = ansi_time_phase(phase);
+    if (cycles > g_ack_response_max) {
+        g_ack_response_max = cycles;
+    }
 }
 
-static void ansi_sample_out_pins(AnsiOutPins& pins) {
-#define READ_PIN(pinName) pins.pin_##pinName = platform_read_pin(ANSI_##pinName)
+static uint16_t current_cylinder(AnsiDev* dev) {
+    return (dev->current_cylinder_high << 8) | dev->current_cylinder_low;
+}
 
-    READ_PIN(CB0);
-    READ_PIN(CB1);
-    READ_PIN(CB2);
-    READ_PIN(CB3);
-    READ_PIN(CB4);
-    READ_PIN(CB5);
-    READ_PIN(CB6);
-    READ_PIN(CB7);
+// the sector under the heads, or -1 if the shared spindle is still formatted
+// with more sectors than this device has (see
+// ansi_rotation_follow_selected())
+static int current_sector(AnsiDev* dev) {
+    uint8_t sector = ansi_rotation_sector();
+    return sector < dev->sectors ? sector : -1;
+}
 
-    READ_PIN(SELECT_OUT_ATTN_IN_STROBE);
-    READ_PIN(COMMAND_REQUEST);
-    READ_PIN(PARAMETER_REQUEST);
-    READ_PIN(BUS_DIRECTION_OUT);
-    READ_PIN(PORT_ENABLE);
-    READ_PIN(READ_GATE);
-    READ_PIN(WRITE_GATE);
+// bytes the host sends after the sync byte when writing a sector
+static uint32_t write_capture_bytes(AnsiDev* dev) {
+    return dev->sector_bytes + (g_ansi_sector_crc ? ANSI_CRC_BYTES : 0);
+}
+
+// Read gate went active, queue the sector under the heads for the read data
+// engine, framed by the compiled sector format.  The host reads it in sync
+// with the reference clock that has been running since the device was
+// selected.
+static void ansi_start_read(AnsiDev* dev) {
+    g_last_transfer_ms = millis();
+
+    uint16_t cylinder = current_cylinder(dev);
+    int sector = current_sector(dev);
+    const uint8_t* crc;
+    const uint8_t* data =
+        sector < 0 ? nullptr
+                   : ansi_storage_sector_data(dev->id, cylinder,
+                                              dev->selected_head, sector, &crc);
+    if (!data) {
+        dbgmsg("ANSI", dev->id, " no data for cylinder ", (int)cylinder,
+               " head ", dev->selected_head, " sector ", sector);
+        return;
+    }
 
-#undef READ_PIN
+    const AnsiSectorFormat* format = ansi_sector_format(dev);
+    if (format->header_bytes) {
+        platform_read_data_queue(format->header, format->header_bytes);
+    }
+    platform_read_data_queue(data, format->data_bytes);
+    if (g_ansi_sector_crc) {
+        if (format->data_bytes != dev->sector_bytes) {
+            crc = g_read_crc[dev->id];
+            ansi_crc16_store(
+                ansi_crc16(ANSI_CRC_INIT, data, format->data_bytes),
+                g_read_crc[dev->id]);
+        }
+        platform_read_data_queue(crc, ANSI_CRC_BYTES);
+    }
+    if (format->trailer_bytes) {
+        platform_read_data_queue(format->trailer, format->trailer_bytes);
+    }
 }
 
-void ansi_poll() {
-    static bool first_poll = true;
-    AnsiDevState cur_state;
-    AnsiDevState next_state;
-    AnsiOutPins pins;
+// Write gate went active, capture the sector under the heads into a storage
+// buffer.  With the write circuitry disabled nothing is recorded.
+static void ansi_start_write(AnsiDev* dev) {
+    g_last_transfer_ms = millis();
 
-    if (first_poll) {
-        first_poll = false;
-        logmsg("ANSI initial state ", state_names[gAnsiDev.state]);
+    if (!dev->write_enabled) {
+        return;
+    }
+
+    uint16_t cylinder = current_cylinder(dev);
+    int sector = current_sector(dev);
+    if (sector < 0) {
+        dbgmsg("ANSI", dev->id, " write outside the format");
+        return;
+    }
+    uint8_t* buffer = ansi_storage_write_buffer(dev->id, cylinder,
+                                                dev->selected_head, sector);
+    if (!buffer) {
+        set_sb1(dev, SB1_RW_FAULT);
+        return;
+    }
+
+    const AnsiSectorFormat* format = ansi_sector_format(dev);
+    platform_write_data_start(buffer, write_capture_bytes(dev),
+                              format->sync_pattern, format->sync_mask);
+    dev->capturing = true;
+    dev->write_buffer = buffer;
+}
+
+// Write gate dropped, a complete sector goes to the image.
+static void ansi_end_write(AnsiDev* dev) {
+    if (!dev->capturing) {
+        return;
+    }
+    dev->capturing = false;
+
+    uint32_t captured = platform_write_data_captured();
+    platform_write_data_stop();
+    uint32_t expected = write_capture_bytes(dev);
+    if (captured != expected) {
+        dbgmsg("ANSI", dev->id, " short write of ", captured, " bytes");
+        return;
+    }
+    // a bad CRC means the capture got it wrong (the drive doesn't judge the
+    // host's data), so it is counted but the sector is still written
+    if (g_ansi_sector_crc && ansi_crc16(ANSI_CRC_INIT, dev->write_buffer,
+                                        expected) != 0) {
+        g_write_crc_errors++;
     }
+    ansi_storage_commit_write(dev->id);
+}
+
+// Run a single transition of a device's state machine against a pin sample.
+// Returns true if the device state changed.
+static bool ansi_step(AnsiDev* dev, AnsiOutPins& pins) {
+    AnsiDevState cur_state;
+    AnsiDevState next_state;
 
-    ansi_sample_out_pins(pins);
 #if 0
     logmsg("ANSI pins: cb0=", pins.cb0, " cb1=", pins.cb1, " cb2=", pins.cb2, " cb3=", pins.cb3, " cb4=", pins.cb4, " cb5=", pins.cb5, " cb6=", pins.cb6, " cb7=", pins.cb7, " seai=", pins.select_out_attn_in_strobe, " pe=", pins.port_enable);
 #endif
 
-    cur_state = gAnsiDev.state;
+    cur_state = dev->state;
     // if nothing else changes it, the next state is the same as the current
     // state.
     next_state = cur_state;
 
-    // regardless of the state transitions, set the control bus direction based
-    // on the state of the bus_direction_out pin.
-    platform_set_control_bus_direction(
-        ACTIVE(pins, BUS_DIRECTION_OUT) ? CONTROL_BUS_OUT : CONTROL_BUS_IN);
-
     switch (cur_state) {
     case ANSI_DEV_STATE_DISCONNECTED: {
         // The only pin we watch for changing here is
@@ -104,7 +250,9 @@ void ansi_poll() {
         // if port enable is inactive, we are disconnected
         if (INACTIVE(pins, PORT_ENABLE)) {
             next_state = ANSI_DEV_STATE_DISCONNECTED;
-            ansi_initial_state();
+            ansi_initial_state(dev);
+            // the host may be about to power down
+            ansi_storage_flush(dev->id);
             break;
         }
 
@@ -117,10 +265,10 @@ void ansi_poll() {
         }
 
         uint8_t id = control_bus_byte(pins);
-        if (id & (1 << gAnsiDev.id)) {
+        if (id & (1 << dev->id)) {
             // we are selected
             next_state = ANSI_DEV_STATE_SELECTED;
-            SET_ACTIVE(BUS_ACKNOWLEDGE);
+            ansi_acknowledge(ANSI_LATENCY_SELECT_ACK);
         }
         break;
     }
@@ -135,12 +283,14 @@ void ansi_poll() {
         if (ACTIVE(pins, READ_GATE)) {
             // start reading!
             next_state = ANSI_DEV_STATE_READING;
+            ansi_start_read(dev);
             break;
         }
 
         if (ACTIVE(pins, WRITE_GATE)) {
             // start writing!
             next_state = ANSI_DEV_STATE_WRITING;
+            ansi_start_write(dev);
             break;
         }
 
@@ -150,34 +300,31 @@ void ansi_poll() {
         }
 
         // select_out/attn_in strobe is active, so depending on the state
-        // of bus_direction, selection is changing or we should gate our
-        // attention onto our radial line.
+        // of bus_direction, selection is changing or this is an attention
+        // poll (which ansi_gate_attention() answers for every device.)
         if (ACTIVE(pins, BUS_DIRECTION_OUT)) {
             uint8_t cb = control_bus_byte(pins);
-            if (cb & (1 << gAnsiDev.id)) {
+            if (cb & (1 << dev->id)) {
                 // we are still selected
                 next_state = ANSI_DEV_STATE_SELECTED;
-                SET_ACTIVE(BUS_ACKNOWLEDGE);
+                ansi_acknowledge(ANSI_LATENCY_SELECT_ACK);
             } else {
                 // we are no longer selected
                 next_state = ANSI_DEV_STATE_CONNECTED;
             }
             break;
         }
-
-        // bus_direction is in, so we should gate our attention onto the control
-        // bus.
-        platform_write_control_bus_byte(1 << gAnsiDev.id);
         break;
     }
 
     case ANSI_DEV_STATE_READ_COMMAND: {
         // the command comes from the control bus and is a byte
-        gAnsiDev.cmd = control_bus_byte(pins);
+        dev->cmd = control_bus_byte(pins);
+        ansi_trace_command(dev->id, dev->cmd);
 
-        SET_ACTIVE(BUS_ACKNOWLEDGE);
+        ansi_acknowledge(ANSI_LATENCY_COMMAND_ACK);
 
-        if (command_is_param_out(gAnsiDev.cmd)) {
+        if (command_is_param_out(dev->cmd)) {
             next_state = ANSI_DEV_STATE_AWAITING_PARAM_OUT;
             break;
         }
@@ -195,128 +342,448 @@ void ansi_poll() {
             break;
         }
 
-        gAnsiDev.param_out = control_bus_byte(pins);
-        SET_ACTIVE(BUS_ACKNOWLEDGE);
+        dev->param_out = control_bus_byte(pins);
+        ansi_trace(ANSI_TRACE_PARAM_OUT, dev->id, dev->param_out);
+        ansi_acknowledge(ANSI_LATENCY_PARAM_OUT_ACK);
         next_state = ANSI_DEV_STATE_EXECUTE_COMMAND;
         break;
     }
 
     case ANSI_DEV_STATE_EXECUTE_COMMAND: {
-        bool time_dependent = command_is_time_dependent(gAnsiDev.cmd);
-        if (time_dependent) {
-            // activate the busy signal
-            SET_ACTIVE(BUSY);
-        }
-        ansi_execute_command();
-        if (command_is_param_out(gAnsiDev.cmd)) {
-            next_state = time_dependent
-                             ? ANSI_DEV_STATE_AWAITING_TIME_DEPENDENT_COMMAND
-                             : ANSI_DEV_STATE_SELECTED;
+        // time dependent commands hand their completion to the scheduler,
+        // so the device goes straight back to SELECTED and the host is free
+        // to select another drive while this one is busy.
+        ansi_execute_command(dev, ACTIVE(pins, READ_GATE) ||
+                                      ACTIVE(pins, WRITE_GATE));
+        if (command_is_param_out(dev->cmd)) {
+            next_state = ANSI_DEV_STATE_SELECTED;
         } else {
             next_state = ANSI_DEV_STATE_AWAITING_PARAM_IN;
         }
         break;
     }
 
-    case ANSI_DEV_STATE_AWAITING_TIME_DEPENDENT_COMMAND: {
-        if (ansi_poll_time_dependent()) {
-            // we aren't done yet.
-            break;
-        }
-
-        // we're done with the time dependent command
-        // deactivate the busy signal
-        SET_INACTIVE(BUSY);
-        SET_ACTIVE(ATTENTION);
-        // XXX(toshok) clear the busy GS bit?
-        next_state = ANSI_DEV_STATE_SELECTED;
-        break;
-    }
-
     case ANSI_DEV_STATE_AWAITING_PARAM_IN: {
         if (ACTIVE(pins, BUS_DIRECTION_OUT) ||
             INACTIVE(pins, PARAMETER_REQUEST)) {
             break;
         }
 
-        bool time_dependent = command_is_time_dependent(gAnsiDev.cmd);
-        platform_write_control_bus_byte(gAnsiDev.param_in);
+        platform_write_control_bus_byte(dev->param_in);
+        ansi_time_phase(ANSI_LATENCY_PARAM_IN_BYTE);
+        ansi_trace(ANSI_TRACE_PARAM_IN, dev->id, dev->param_in);
         // what's the handshake part of this?  presumably the host needs to ack?
-        next_state = time_dependent
-                         ? ANSI_DEV_STATE_AWAITING_TIME_DEPENDENT_COMMAND
-                         : ANSI_DEV_STATE_SELECTED;
+        next_state = ANSI_DEV_STATE_SELECTED;
         break;
     }
     case ANSI_DEV_STATE_READING: {
-        // XXX(toshok) implement
+        if (ACTIVE(pins, READ_GATE)) {
+            // the data engine is shifting the sector out
+            break;
+        }
+
+        // whatever the host didn't read is dropped
+        platform_read_data_flush();
+        next_state = ANSI_DEV_STATE_SELECTED;
         break;
     }
     case ANSI_DEV_STATE_WRITING: {
-        // XXX(toshok) implement
+        if (ACTIVE(pins, WRITE_GATE)) {
+            break;
+        }
+
+        ansi_end_write(dev);
+        next_state = ANSI_DEV_STATE_SELECTED;
         break;
     }
     default: {
-        logmsg("ANSI unknown state ", cur_state);
+        logmsg("ANSI", dev->id, " unknown state ", cur_state);
         break;
     }
     }
 
-    if (cur_state != next_state) {
-        logmsg("ANSI state ", state_names[cur_state], " -> ",
-               state_names[next_state]);
-        gAnsiDev.state = next_state;
+    dev->state = next_state;
+    dev->previous_pins = pins;
+
+    if (cur_state == next_state) {
+        return false;
+    }
+    ansi_latency_record_state(cur_state, ansi_edge_latency());
+    ansi_trace(ANSI_TRACE_STATE, dev->id, next_state);
+    return true;
+}
+
+// During an attention poll (select out/attn in strobe with the bus direction
+// in) every device gates its attention condition onto its radial control bus
+// line.
+static void ansi_gate_attention(AnsiOutPins& pins) {
+    if (INACTIVE(pins, PORT_ENABLE) ||
+        INACTIVE(pins, SELECT_OUT_ATTN_IN_STROBE) ||
+        ACTIVE(pins, BUS_DIRECTION_OUT)) {
+        return;
+    }
+
+    platform_write_control_bus_byte(g_attention_mask);
+    ansi_time_phase(ANSI_LATENCY_ATTENTION_POLL);
+}
+
+// A selected device supplies READ_REF_CLOCK at its data rate (the host also
+// derives its write clock from it) and the INDEX and SECTOR_MARK pulses,
+// otherwise those lines are idle.
+static void ansi_update_selected_outputs() {
+    for (uint8_t mask = g_configured_mask; mask; mask &= mask - 1) {
+        AnsiDev* dev = &gAnsiDevs[__builtin_ctz(mask)];
+        if (dev->state >= ANSI_DEV_STATE_SELECTED) {
+            platform_read_data_start(dev->disk_type->data_rate);
+            ansi_rotation_gate(true);
+            return;
+        }
+    }
+    platform_read_data_stop();
+    ansi_rotation_gate(false);
+}
+
+// The spindle is shared, so its sector pulses follow the geometry of the
+// selected device.  Retiming restarts the rotation timer, which is left to
+// the main loop rather than done from the bus interrupt, so the first pulses
+// after selecting a device formatted differently are still the last one's.
+static void ansi_rotation_follow_selected() {
+    for (uint8_t mask = g_configured_mask; mask; mask &= mask - 1) {
+        AnsiDev* dev = &gAnsiDevs[__builtin_ctz(mask)];
+        if (dev->state >= ANSI_DEV_STATE_SELECTED) {
+            ansi_rotation_set_sectors(dev->sectors);
+            return;
+        }
+    }
+}
+
+// Run every emulated device's state machine once against the same pin
+// sample.  Returns true if any device changed state.
+static bool ansi_step_devices(AnsiOutPins& pins) {
+    bool changed = false;
+
+    ansi_trace_pins(pins.raw);
+
+    // regardless of the state transitions, set the control bus direction based
+    // on the state of the bus_direction_out pin.
+    platform_set_control_bus_direction(
+        ACTIVE(pins, BUS_DIRECTION_OUT) ? CONTROL_BUS_OUT : CONTROL_BUS_IN);
+
+    for (uint8_t mask = g_configured_mask; mask; mask &= mask - 1) {
+        AnsiDev* dev = &gAnsiDevs[__builtin_ctz(mask)];
+        changed |= ansi_step(dev, pins);
+    }
+
+    ansi_gate_attention(pins);
+    if (changed) {
+        ansi_update_busy();
+        ansi_update_selected_outputs();
+    }
+
+    return changed;
+}
+
+// Step the state machines until they settle.  Several transitions
+// (READ_COMMAND -> EXECUTE_COMMAND -> AWAITING_PARAM_IN) happen without any
+// further pin change from the host, so a single edge has to be carried through
+// all of them.
+static void ansi_run_until_settled() {
+    AnsiOutPins pins;
+
+    for (int i = 0; i < ANSI_MAX_STEPS_PER_EDGE; i++) {
+        ansi_sample_out_pins(pins);
+        if (!ansi_step_devices(pins)) {
+            break;
+        }
+    }
+}
+
+static void ansi_control_bus_isr() {
+    g_log_in_interrupt = true;
+    ansi_start_edge(platform_cycle_count());
+    ansi_run_until_settled();
+    g_log_in_interrupt = false;
+}
+
+void ansi_set_interrupt_driven(bool enable) {
+    if (enable == g_interrupt_driven) {
+        return;
+    }
+
+    if (enable) {
+        g_interrupt_driven = true;
+        platform_attach_control_bus_interrupt(ansi_control_bus_isr);
+        // catch up with anything that changed before the ISR was attached
+        noInterrupts();
+        ansi_control_bus_isr();
+        interrupts();
+    } else {
+        platform_detach_control_bus_interrupt();
+        g_interrupt_driven = false;
+    }
+}
+
+void ansi_reset_devices() {
+    noInterrupts();
+    g_configured_mask = 0;
+    g_attention_mask = 0;
+    ansi_schedule_reset();
+    platform_read_data_stop();
+    platform_write_data_stop();
+    ansi_rotation_stop();
+    SET_INACTIVE(ATTENTION);
+    SET_INACTIVE(BUSY);
+    interrupts();
+}
+
+void ansi_configure_device(uint8_t id, const AnsiDiskType* disk_type) {
+    AnsiDev* dev = &gAnsiDevs[id];
+
+    noInterrupts();
+    ansi_schedule_cancel(dev);
+    memset(dev, 0, sizeof(*dev));
+    dev->id = id;
+    dev->disk_type = disk_type;
+    dev->sectors = disk_type->sectors;
+    dev->sector_bytes = HARD_DISK_SECTOR_SIZE;
+    dev->load_sectors = dev->sectors;
+    dev->load_sector_bytes = dev->sector_bytes;
+    dev->state = ANSI_DEV_STATE_DISCONNECTED;
+    // Devices shall be initialized with the Attention circuitry enabled.
+    dev->attention_enabled = true;
+    ansi_initial_state(dev);
+
+    g_configured_mask |= 1 << id;
+    interrupts();
+
+    ansi_rotation_start(disk_type);
+    // the heads start out over cylinder 0
+    ansi_storage_stage_cylinder(id, 0);
+}
+
+bool ansi_geometry_valid(const AnsiDev* dev, uint32_t sectors,
+                         uint32_t sector_bytes) {
+    return sectors && sectors <= ANSI_MAX_SECTORS_PER_TRACK && sector_bytes &&
+           sector_bytes <= HARD_DISK_SECTOR_SIZE &&
+           sectors * sector_bytes <=
+               (uint32_t)dev->disk_type->sectors * HARD_DISK_SECTOR_SIZE;
+}
+
+bool ansi_set_geometry(AnsiDev* dev, uint16_t sectors, uint16_t sector_bytes) {
+    if (!ansi_geometry_valid(dev, sectors, sector_bytes)) {
+        return false;
+    }
+
+    uint32_t irq = platform_disable_interrupts();
+    dev->sectors = sectors;
+    dev->sector_bytes = sector_bytes;
+    dev->load_sectors = sectors;
+    dev->load_sector_bytes = sector_bytes;
+    platform_restore_interrupts(irq);
+
+    // the spindle catches up from ansi_poll() if the device is selected
+    ansi_sector_format_invalidate(dev);
+    ansi_storage_geometry_changed(dev->id);
+    // the heads are over a cylinder that now reads differently
+    ansi_storage_stage_cylinder(dev->id, current_cylinder(dev));
+    return true;
+}
+
+void ansi_poll() {
+    // The SD card's waits call back in here (see platform_set_sd_wait_hook()),
+    // and so does a log line written while the USB serial buffer is full.  A
+    // call from inside ansi_poll() itself would apply a reformat or run a
+    // completion twice, so it is left to the outer one.
+    static bool polling;
+    if (polling) {
+        return;
+    }
+    polling = true;
+
+    static bool first_poll = true;
+    static AnsiDevState logged_state[ANSI_MAX_DEVICES];
+    static uint32_t logged_ack_response_max;
+    static uint32_t logged_read_underruns;
+    static uint32_t logged_write_overruns;
+    static uint32_t logged_write_crc_errors;
+
+    if (first_poll) {
+        first_poll = false;
+        for (uint8_t mask = g_configured_mask; mask; mask &= mask - 1) {
+            AnsiDev* dev = &gAnsiDevs[__builtin_ctz(mask)];
+            logged_state[dev->id] = dev->state;
+            logmsg("ANSI", dev->id, " initial state ", state_names[dev->state]);
+        }
     }
 
-    gAnsiDev.previous_pins = pins;
+    if (!g_interrupt_driven) {
+        AnsiOutPins pins;
+
+        ansi_sample_out_pins(pins);
+        if (pins.raw != g_edge_pins) {
+            g_edge_pins = pins.raw;
+            ansi_start_edge(platform_cycle_count());
+        }
+        ansi_step_devices(pins);
+    }
+
+    // complete the time dependent commands whose deadline has passed, on
+    // every device whether or not it is still selected.  In interrupt-driven
+    // mode the completions update the same device state as the ISR.
+    noInterrupts();
+    ansi_schedule_run(micros());
+    interrupts();
+    ansi_poll_reformats();
+    ansi_rotation_follow_selected();
+
+    // In interrupt-driven mode several transitions can happen between two
+    // calls, so this reports the transition as seen from the main loop rather
+    // than logging from the ISR.  The trace has every transition, so this is
+    // only a debug summary.
+    for (uint8_t mask = g_configured_mask; mask; mask &= mask - 1) {
+        AnsiDev* dev = &gAnsiDevs[__builtin_ctz(mask)];
+        AnsiDevState state = dev->state;
+        if (state != logged_state[dev->id]) {
+            dbgmsg("ANSI", dev->id, " state ",
+                   state_names[logged_state[dev->id]], " -> ",
+                   state_names[state]);
+            logged_state[dev->id] = state;
+        }
+    }
+
+    uint32_t ack_response_max = g_ack_response_max;
+    if (ack_response_max != logged_ack_response_max) {
+        logmsg("ANSI worst-case BUS_ACKNOWLEDGE response ",
+               (int)platform_cycles_to_ns(ack_response_max), "ns");
+        logged_ack_response_max = ack_response_max;
+    }
+
+    uint32_t read_underruns = platform_read_data_underruns();
+    if (read_underruns != logged_read_underruns) {
+        logmsg("ANSI read data underruns: ", read_underruns);
+        logged_read_underruns = read_underruns;
+    }
+
+    uint32_t write_overruns = platform_write_data_overruns();
+    if (write_overruns != logged_write_overruns) {
+        logmsg("ANSI write data overruns: ", write_overruns);
+        logged_write_overruns = write_overruns;
+    }
+
+    uint32_t write_crc_errors = g_write_crc_errors;
+    if (write_crc_errors != logged_write_crc_errors) {
+        logmsg("ANSI write data CRC errors: ", write_crc_errors);
+        logged_write_crc_errors = write_crc_errors;
+    }
+
+    polling = false;
 }
 
-void ansi_initial_state() { gAnsiDev.attributes_initialized = false; }
+void ansi_initial_state(AnsiDev* dev) {
+    dev->attributes_initialized = false;
+    ansi_sector_format_invalidate(dev);
+}
 
-void set_general_status(uint8_t value) {}
+void set_general_status(AnsiDev* dev, uint8_t value) {
+    dev->general_status |= value;
+}
 
-void clear_general_status(uint8_t value) {}
+void clear_general_status(AnsiDev* dev, uint8_t value) {
+    dev->general_status &= ~value;
+}
 
-void set_sb1(uint8_t value) {
-    if ((gAnsiDev.sense_byte_1 & value) != value) {
-        gAnsiDev.sense_byte_1 |= value;
+void set_sb1(AnsiDev* dev, uint8_t value) {
+    if ((dev->sense_byte_1 & value) != value) {
+        dev->sense_byte_1 |= value;
         // all sb1 bits set attention on 0->1 transition
-        set_attention_state(true);
-        set_general_status(GS_SENSE_BYTE_1);
+        set_attention_state(dev, true);
+        set_general_status(dev, GS_SENSE_BYTE_1);
     }
 }
 
-void clear_sb1(uint8_t value) {
-    gAnsiDev.sense_byte_1 &= ~value;
-    if (gAnsiDev.sense_byte_1 == 0) {
-        clear_general_status(GS_SENSE_BYTE_1);
+void clear_sb1(AnsiDev* dev, uint8_t value) {
+    dev->sense_byte_1 &= ~value;
+    if (dev->sense_byte_1 == 0) {
+        clear_general_status(dev, GS_SENSE_BYTE_1);
     } else {
-        set_general_status(GS_SENSE_BYTE_1);
+        set_general_status(dev, GS_SENSE_BYTE_1);
     }
 }
 
-void set_sb2(uint8_t value) {
-    if ((gAnsiDev.sense_byte_2 & value) != value) {
-        gAnsiDev.sense_byte_2 |= value;
+void set_sb2(AnsiDev* dev, uint8_t value) {
+    if ((dev->sense_byte_2 & value) != value) {
+        dev->sense_byte_2 |= value;
         // only certain sb2 bits set attention on 0->1 transition
         if (value |
             (SB2_INITIAL_STATE | SB2_READY_TRANSITION | SB2_FORCED_RELEASE |
              SB2_DEVICE_ATTR_TABLE_MODIFIED | SB2_VENDOR_ATTNS)) {
-            set_attention_state(true);
-            set_general_status(GS_SENSE_BYTE_2);
+            set_attention_state(dev, true);
+            set_general_status(dev, GS_SENSE_BYTE_2);
+        }
+    }
+}
+
+void clear_sb2(AnsiDev* dev, uint8_t value) {
+    dev->sense_byte_2 &= ~value;
+    if (dev->sense_byte_2 == 0) {
+        clear_general_status(dev, GS_SENSE_BYTE_2);
+    } else {
+        set_general_status(dev, GS_SENSE_BYTE_2);
+    }
+}
+
+// Devices report their attention condition on their radial line when polled,
+// and those that have attention enabled (see ANSI_CMD_ATTENTION_CONTROL) also
+// drive the shared ATTENTION line.
+static void update_attention_line() {
+    uint8_t enabled_mask = 0;
+    for (uint8_t mask = g_attention_mask; mask; mask &= mask - 1) {
+        int id = __builtin_ctz(mask);
+        if (gAnsiDevs[id].attention_enabled) {
+            enabled_mask |= 1 << id;
         }
     }
+    SET_BOOL(ATTENTION, enabled_mask != 0);
 }
 
-void clear_sb2(uint8_t value) {
-    gAnsiDev.sense_byte_2 &= ~value;
-    if (gAnsiDev.sense_byte_2 == 0) {
-        clear_general_status(GS_SENSE_BYTE_2);
+void set_attention_state(AnsiDev* dev, bool state) {
+    dev->attention = state;
+    if (state) {
+        g_attention_mask |= 1 << dev->id;
     } else {
-        set_general_status(GS_SENSE_BYTE_2);
+        g_attention_mask &= ~(1 << dev->id);
     }
+    ansi_trace(ANSI_TRACE_ATTENTION, dev->id, g_attention_mask);
+    update_attention_line();
 }
 
-void set_attention_state(bool state) {
-    gAnsiDev.attention_enabled = state;
-    SET_BOOL(ATTENTION, state);
-}
\ No newline at end of file
+void set_attention_enabled(AnsiDev* dev, bool enabled) {
+    dev->attention_enabled = enabled;
+    update_attention_line();
+}
+
+bool ansi_bus_idle() {
+    bool seeking = false;
+    for (uint8_t mask = g_configured_mask; mask; mask &= mask - 1) {
+        AnsiDev* dev = &gAnsiDevs[__builtin_ctz(mask)];
+        if (dev->state == ANSI_DEV_STATE_READING ||
+            dev->state == ANSI_DEV_STATE_WRITING) {
+            return false;
+        }
+        seeking |= (dev->general_status & GS_BUSY_EXECUTING) != 0;
+    }
+    return seeking || millis() - g_last_transfer_ms >= ANSI_BUS_IDLE_MS;
+}
+
+void ansi_update_busy() {
+    bool busy = false;
+    for (uint8_t mask = g_configured_mask; mask; mask &= mask - 1) {
+        AnsiDev* dev = &gAnsiDevs[__builtin_ctz(mask)];
+        if (dev->state >= ANSI_DEV_STATE_SELECTED &&
+            (dev->general_status & GS_BUSY_EXECUTING)) {
+            busy = true;
+            break;
+        }
+    }
+    SET_BOOL(BUSY, busy);
+}
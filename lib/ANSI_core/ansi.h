@@ -14,45 +14,58 @@ enum AnsiDevState {
     ANSI_DEV_STATE_AWAITING_PARAM_OUT,
     ANSI_DEV_STATE_EXECUTE_COMMAND,
     ANSI_DEV_STATE_AWAITING_PARAM_IN,
-    ANSI_DEV_STATE_AWAITING_TIME_DEPENDENT_COMMAND,
-    // basically unimplemented
     ANSI_DEV_STATE_READING,
-    ANSI_DEV_STATE_WRITING
+    ANSI_DEV_STATE_WRITING,
+    ANSI_DEV_STATE_COUNT
 };
 
-struct AnsiOutPins {
-    // the control bus operates both as in and out, but
-    // the normal state is out.
-    uint8_t pin_CB0 : 1;
-    uint8_t pin_CB1 : 1;
-    uint8_t pin_CB2 : 1;
-    uint8_t pin_CB3 : 1;
-    uint8_t pin_CB4 : 1;
-    uint8_t pin_CB5 : 1;
-    uint8_t pin_CB6 : 1;
-    uint8_t pin_CB7 : 1;
-
-    uint8_t pin_SELECT_OUT_ATTN_IN_STROBE : 1;
-    uint8_t pin_COMMAND_REQUEST : 1;
-    uint8_t pin_PARAMETER_REQUEST : 1;
-    uint8_t pin_BUS_DIRECTION_OUT : 1;
-    uint8_t pin_PORT_ENABLE : 1;
-    uint8_t pin_READ_GATE : 1;
-    uint8_t pin_WRITE_GATE : 1;
-
-    // write clock/data handled elsewhere
+const char* ansi_state_name(int state);
+
+union AnsiOutPins {
+    struct {
+        // the control bus operates both as in and out, but
+        // the normal state is out.
+        uint8_t pin_CB0 : 1;
+        uint8_t pin_CB1 : 1;
+        uint8_t pin_CB2 : 1;
+        uint8_t pin_CB3 : 1;
+        uint8_t pin_CB4 : 1;
+        uint8_t pin_CB5 : 1;
+        uint8_t pin_CB6 : 1;
+        uint8_t pin_CB7 : 1;
+
+        uint8_t pin_SELECT_OUT_ATTN_IN_STROBE : 1;
+        uint8_t pin_COMMAND_REQUEST : 1;
+        uint8_t pin_PARAMETER_REQUEST : 1;
+        uint8_t pin_BUS_DIRECTION_OUT : 1;
+        uint8_t pin_PORT_ENABLE : 1;
+        uint8_t pin_READ_GATE : 1;
+        uint8_t pin_WRITE_GATE : 1;
+
+        // write clock/data handled elsewhere
+    };
+
+    // all of the above as one word, in the bit order returned by
+    // platform_sample_ansi_pins()
+    uint16_t raw;
 };
+static_assert(sizeof(AnsiOutPins) == sizeof(uint16_t),
+              "AnsiOutPins must overlay the platform pin sample");
+
 #define PIN(pins, pinName) pins.pin_##pinName
 
 // ANSI low voltage = logic high, high voltage = logic low
 #define ACTIVE(pins, pinName) (!pins.pin_##pinName)
 #define INACTIVE(pins, pinName) (pins.pin_##pinName)
 
+// ANSI ids are 0-7, one radial control bus line each
+#define ANSI_MAX_DEVICES 8
+
 struct AnsiDev {
     // values can be 0-7
     uint8_t id;
 
-    AnsiDiskType* disk_type;
+    const AnsiDiskType* disk_type;
 
     AnsiDevState state;
     AnsiOutPins previous_pins;
@@ -65,8 +78,14 @@ struct AnsiDev {
     uint8_t sense_byte_1;
     uint8_t sense_byte_2;
 
+    // the internal attention condition, reported on our radial line when
+    // polled, and on the ATTENTION line if attention_enabled.
+    bool attention;
     bool attention_enabled;
     bool write_enabled;
+    // a write gate is being captured into a storage buffer
+    bool capturing;
+    uint8_t* write_buffer;
 
     uint8_t selected_head;
     uint8_t current_cylinder_high;
@@ -77,16 +96,92 @@ struct AnsiDev {
 
     uint8_t test_byte;
 
+    // the geometry the device is formatted with, see ansi_set_geometry()
+    uint16_t sectors;
+    uint16_t sector_bytes;
+    // loaded by the Load Sector Pulses Per Track and Load Bytes Per Sector
+    // commands, applied by Reformat Track
+    uint32_t load_sectors;
+    uint32_t load_sector_bytes;
+
     uint8_t attribute_number;
     bool attributes_initialized;
     uint8_t attributes[0x48];
 };
 
+extern AnsiDev gAnsiDevs[ANSI_MAX_DEVICES];
+
+// Forget all emulated devices, called before the images are (re)scanned.
+void ansi_reset_devices();
+
+// Emulate a drive of the given type at ANSI id `id`.  Every configured device
+// runs its own state machine against the same bus.
+void ansi_configure_device(uint8_t id, const AnsiDiskType* disk_type);
+
 void ansi_poll();
 
+// the most sector pulses per track a reformat can ask for
+#define ANSI_MAX_SECTORS_PER_TRACK 32
+
+// Whether the device can be formatted with `sectors` per track of
+// `sector_bytes` bytes: at most ANSI_MAX_SECTORS_PER_TRACK sectors of at most
+// HARD_DISK_SECTOR_SIZE bytes, that fit on the disk type's unformatted track.
+bool ansi_geometry_valid(const AnsiDev* dev, uint32_t sectors,
+                         uint32_t sector_bytes);
+// Format the device with a new geometry, false if it isn't valid.  The
+// storage has to have been flushed, what it caches for the device is dropped.
+bool ansi_set_geometry(AnsiDev* dev, uint16_t sectors, uint16_t sector_bytes);
+
+// Finish seeks as soon as the target cylinder's data is staged instead of
+// after the disk type's modelled seek time.  Set from [ANSI] TurboSeek.
+extern bool g_ansi_turbo_seek;
+
+// Follow the data of every sector read with its CRC (see crc.h), and expect
+// one after the data of every sector written.  Set from [ANSI] SectorCRC.
+extern bool g_ansi_sector_crc;
+
+// Storage hooks implemented by the firmware.  Seeks ask for the target
+// cylinder of device `id` to be staged when they start, and only complete
+// once ansi_storage_cylinder_staged() returns true, so the host's reads of
+// the cylinder never wait on the storage.
+bool ansi_storage_stage_cylinder(uint8_t id, uint16_t cylinder);
+bool ansi_storage_cylinder_staged(uint8_t id, uint16_t cylinder);
+// The sector_bytes bytes of a sector, for the read data engine to shift out,
+// and in *crc the ANSI_CRC_BYTES of their CRC, kept along with them.  Returns
+// nullptr if the data isn't available.  The buffers have to stay valid until
+// the next call.
+const uint8_t* ansi_storage_sector_data(uint8_t id, uint16_t cylinder,
+                                        uint8_t head, uint8_t sector,
+                                        const uint8_t** crc);
+// Room for the sector_bytes bytes the host is about to write to a sector and
+// the ANSI_CRC_BYTES that may follow them, nullptr if every buffer is still
+// waiting for the SD card.
+// ansi_storage_commit_write() hands the filled buffer back to be written to
+// the image in the background; a buffer that isn't committed is reused.
+uint8_t* ansi_storage_write_buffer(uint8_t id, uint16_t cylinder, uint8_t head,
+                                   uint8_t sector);
+void ansi_storage_commit_write(uint8_t id);
+// Ask for everything written to device `id` to go to the storage now rather
+// than when the bus is idle, ansi_storage_flushed() is true once it has.
+void ansi_storage_flush(uint8_t id);
+bool ansi_storage_flushed(uint8_t id);
+// The geometry of device `id` changed, so its image is laid out differently.
+void ansi_storage_geometry_changed(uint8_t id);
+
+// True when the storage can take its time: no device is transferring data
+// or has for ANSI_BUS_IDLE_MS, or one is seeking (and so the host is waiting
+// on it anyway.)  The firmware writes the cached data back then.
+bool ansi_bus_idle();
+
+// Switch between polling the host control lines from ansi_poll() and driving
+// the state machine from a GPIO interrupt on every edge of them.  In
+// interrupt-driven mode ansi_poll() only finishes time dependent commands and
+// logs, so it no longer needs to be called at a high rate.
+void ansi_set_interrupt_driven(bool enable);
+
 // called when initializing, and when transitioning from connected to
 // disconnected states
-void ansi_initial_state();
+void ansi_initial_state(AnsiDev* dev);
 
 // general status bits
 #define GS_NOT_READY 0x01
@@ -118,11 +213,23 @@ void ansi_initial_state();
 #define SB2_POSITIONED_WITHIN_WRITE_PROTECTED_AREA 0x40
 #define SB2_VENDOR_ATTNS 0x80
 
-void set_general_status(uint8_t value);
-void clear_general_status(uint8_t value);
-void set_sb1(uint8_t value);
-void clear_sb1(uint8_t value);
-void set_sb2(uint8_t value);
-void clear_sb2(uint8_t value);
-
-void set_attention_state(bool state);
\ No newline at end of file
+// Attribute 0x0E, Table Modification.  Set when the host loads an attribute,
+// cleared once the sector format has been compiled from the new table.
+#define ATTR_TABLE_MODIFIED 0x01
+// Attribute 0x0E bit 6, set by the Load Sector Pulses Per Track and Load
+// Bytes Per Sector commands and cleared when Reformat Track completes.
+#define ATTR_REFORMAT_PENDING 0x40
+
+void set_general_status(AnsiDev* dev, uint8_t value);
+void clear_general_status(AnsiDev* dev, uint8_t value);
+void set_sb1(AnsiDev* dev, uint8_t value);
+void clear_sb1(AnsiDev* dev, uint8_t value);
+void set_sb2(AnsiDev* dev, uint8_t value);
+void clear_sb2(AnsiDev* dev, uint8_t value);
+
+void set_attention_state(AnsiDev* dev, bool state);
+
+// BUSY is driven by the selected device, from its Busy Executing status bit.
+// Called whenever the selection or a device's busy status changes.
+void ansi_update_busy();
+void set_attention_enabled(AnsiDev* dev, bool enabled);
@@ -1,490 +1,620 @@
 #include <cstring>
 
 #include "TANSI_log.h"
+#include "TANSI_platform.h"
 #include "ansi.h"
-#include "elapsedMillis.h"
+#include "latency.h"
+#include "rotation.h"
+#include "schedule.h"
+
+static void load_attribute(AnsiDev* dev, uint8_t attribute_value);
+static uint8_t report_attribute(AnsiDev* dev);
+
+// extra bookkeeping for our time dependent (not immediate) commands.  The
+// callback runs when the duration has passed, and returns false if the
+// command needs more time (it is then polled again.)
+typedef bool (*TimeDependentCallback)(AnsiDev* dev);
+static void
+start_time_dependent_command(AnsiDev* dev, uint32_t durationMicros,
+                             TimeDependentCallback callback = nullptr);
+struct SeekParams {
+    uint16_t cylinder;
+};
+static SeekParams gSeekParams[ANSI_MAX_DEVICES];
+static uint32_t seek_duration(AnsiDev* dev, uint16_t cylinder);
+static bool finish_seek(AnsiDev* dev);
+static bool finish_rezero(AnsiDev* dev);
+static bool finish_spin_down(AnsiDev* dev);
+static bool finish_reformat(AnsiDev* dev);
+// Reformats whose revolution has passed wait for ansi_poll_reformats() to
+// apply the new geometry, which calls back into the storage and the rotation
+// and can't be done from the schedule with interrupts off.
+static volatile uint8_t g_reformat_pending;
+static volatile uint8_t g_reformat_applied;
+static volatile uint8_t g_reformat_failed;
+static void initialize_attributes(AnsiDev* dev);
+
+// how often a seek checks whether its cylinder has been staged
+#define STAGE_POLL_MICROS 100
+
+static void cmd_report_illegal_command(AnsiDev* dev) {
+    // This command shall force the Illegal Command Bit to be set in the
+    // General Status Byte (see Section 4.4). The General Status Byte,
+    // with the Illegal Command Bit equal to one, is returned to the host
+    // by the Parameter Byte of the command sequence.
+    dev->general_status |= GS_ILLEGAL_COMMAND;
+    dev->param_in = dev->general_status;
+}
 
-extern AnsiDev gAnsiDev;
+static void cmd_clear_fault(AnsiDev* dev) {
+    // This command shall cause all fault status bits of the selected
+    // device to be reset, provided the fault condition has passed. If
+    // the fault condition persits the appropriate status bit shall
+    // continue to be equal to one. The General Status Byte, cleared of
+    // previous fault status, shall be returned by the Parameter Byte of
+    // the command sequence.
+    // The Clear Fault Command shall also reset the Attention Condition
+    // caused by the fault condition, again only if the fault condition no
+    // longer exists.
 
-static void load_attribute(uint8_t attribute_value);
-static uint8_t report_attribute();
+    dev->general_status &=
+        ~(GS_CONTROL_BUS_ERROR | GS_ILLEGAL_COMMAND | GS_ILLEGAL_PARAMETER);
 
-// extra bookkeeping for our time dependent (not immediate) commands
-static void start_time_dependent_command(uint32_t durationMillis,
-                                         void (*callback)() = nullptr);
-struct SeekParams {
-    uint8_t cylinder_high;
-    uint8_t cylinder_low;
-};
-static SeekParams gSeekParams;
-static void finish_seek();
-static void finish_rezero();
+    clear_sb1(dev, SB1_SEEK_ERROR | SB1_RW_FAULT | SB1_POWER_FAULT |
+                       SB1_COMMAND_REJECT);
 
-void ansi_execute_command() {
-    AnsiDev* dev = &gAnsiDev;
-    uint8_t param_out = dev->param_out;
+    set_attention_state(dev, false);
 
-    switch (dev->cmd) {
-    case ANSI_CMD_REPORT_ILLEGAL_COMMAND:
-        dbgmsg("ansicmd REPORT_ILLEGAL_COMMAND");
-        // This command shall force the Illegal Command Bit to be set in the
-        // General Status Byte (see Section 4.4). The General Status Byte,
-        // with the Illegal Command Bit equal to one, is returned to the host
-        // by the Parameter Byte of the command sequence.
-        dev->general_status |= GS_ILLEGAL_COMMAND;
-        dev->param_in = dev->general_status;
-        return;
+    dev->param_in = dev->general_status;
+}
 
-    case ANSI_CMD_CLEAR_FAULT:
-        dbgmsg("ansicmd CLEAR_FAULT");
-        // This command shall cause all fault status bits of the selected
-        // device to be reset, provided the fault condition has passed. If
-        // the fault condition persits the appropriate status bit shall
-        // continue to be equal to one. The General Status Byte, cleared of
-        // previous fault status, shall be returned by the Parameter Byte of
-        // the command sequence.
-        // The Clear Fault Command shall also reset the Attention Condition
-        // caused by the fault condition, again only if the fault condition no
-        // longer exists.
+static void cmd_clear_attention(AnsiDev* dev) {
+    // This command shall cause the Attention Condition to be reset in the
+    // selected device. The General Status Byte shall be returned by the
+    // Parameter Byte of the command sequence.
+    //
+    // If the error or other condition that caused the Attention Condition
+    // persists, the Attention Condition shall not be set again. If,
+    // however, the condition is reset and the error reoccurs, the
+    // Attention Condition shall be set again.
+    dev->sense_byte_2 &= ~(SB2_INITIAL_STATE | SB2_READY_TRANSITION |
+                           SB2_DEVICE_ATTR_TABLE_MODIFIED);
 
-        dev->general_status &=
-            ~(GS_CONTROL_BUS_ERROR | GS_ILLEGAL_COMMAND | GS_ILLEGAL_PARAMETER);
+    dev->general_status &= ~GS_NORMAL_COMPLETE;
 
-        clear_sb1(SB1_SEEK_ERROR | SB1_RW_FAULT | SB1_POWER_FAULT |
-                  SB1_COMMAND_REJECT);
+    set_attention_state(dev, false);
 
-        set_attention_state(false);
+    dev->param_in = dev->general_status;
+}
 
+static void cmd_seek(AnsiDev* dev) {
+    // This command shall cause the selected device to seek to the
+    // cylinder identified as the target cylinder by the Load Cylinder
+    // Address Commands (see Sections 4.1.3 and 4.1.4). The General
+    // Status Byte shall be returned to the host by the Parameter Byte of
+    // the command sequence with the Busy Executing bit set (see Section
+    // 4.4.1.7).
+    // The Seek Command shall set the Attention Condition and the Illegal
+    // Parameter Bit in the General Status Byte if the target cylinder
+    // address is outside the cylinder address range of the device.
+    // Upon completion of any seek (including a zero length seek) the
+    // device shall clear the Busy Executing bit in the General Status
+    // Byte and set the Attention Condition.
+
+    uint16_t cylinder =
+        (dev->load_cylinder_high << 8) | dev->load_cylinder_low;
+    if (cylinder >= dev->disk_type->cylinders) {
+        set_general_status(dev, GS_ILLEGAL_PARAMETER);
+        set_attention_state(dev, true);
         dev->param_in = dev->general_status;
         return;
+    }
 
-    case ANSI_CMD_CLEAR_ATTENTION:
-        dbgmsg("ansicmd CLEAR_ATTENTION");
-        // This command shall cause the Attention Condition to be reset in the
-        // selected device. The General Status Byte shall be returned by the
-        // Parameter Byte of the command sequence.
-        //
-        // If the error or other condition that caused the Attention Condition
-        // persists, the Attention Condition shall not be set again. If,
-        // however, the condition is reset and the error reoccurs, the
-        // Attention Condition shall be set again.
-        dev->sense_byte_2 &= ~(SB2_INITIAL_STATE | SB2_READY_TRANSITION |
-                               SB2_DEVICE_ATTR_TABLE_MODIFIED);
+    gSeekParams[dev->id].cylinder = cylinder;
+    start_time_dependent_command(dev, seek_duration(dev, cylinder),
+                                 finish_seek);
 
-        dev->general_status &= ~GS_NORMAL_COMPLETE;
+    dev->param_in = dev->general_status;
+}
 
-        set_attention_state(false);
+static void cmd_rezero(AnsiDev* dev) {
+    // This command shall cause the selected device to position the moving
+    // head(s) over cylinder zero. The General Status byte shall be
+    // returned to the host by the Parameter Byte of the command sequence
+    // with the Busy Executing bit set (see Section 4.4.1.7).
+    //
+    // Upon the completion of the positioning of the moving head(s) over
+    // cylinder zero the device shall clear the Busy Executing bit in the
+    // General Status byte and set the Attention Condition.
 
-        dev->param_in = dev->general_status;
-        return;
+    gSeekParams[dev->id].cylinder = 0;
+    start_time_dependent_command(dev, seek_duration(dev, 0), finish_rezero);
 
-    case ANSI_CMD_SEEK:
-        dbgmsg("ansicmd SEEK");
-        // This command shall cause the selected device to seek to the
-        // cylinder identified as the target cylinder by the Load Cylinder
-        // Address Commands (see Sections 4.1.3 and 4.1.4). The General
-        // Status Byte shall be returned to the host by the Parameter Byte of
-        // the command sequence with the Busy Executing bit set (see Section
-        // 4.4.1.7).
-        // The Seek Command shall set the Attention Condition and the Illegal
-        // Parameter Bit in the General Status Byte if the target cylinder
-        // address is outside the cylinder address range of the device.
-        // Upon completion of any seek (including a zero length seek) the
-        // device shall clear the Busy Executing bit in the General Status
-        // Byte and set the Attention Condition.
-
-        gSeekParams.cylinder_high = dev->load_cylinder_high;
-        gSeekParams.cylinder_low = dev->load_cylinder_low;
-        start_time_dependent_command(5, // 5ms.  look up this timing...
-                                     finish_seek);
-
-        dev->general_status |= GS_BUSY_EXECUTING;
-        dev->param_in = dev->general_status;
-        return;
+    dev->param_in = dev->general_status;
+}
 
-    case ANSI_CMD_REZERO:
-        dbgmsg("ansicmd REZERO");
-        // This command shall cause the selected device to position the moving
-        // head(s) over cylinder zero. The General Status byte shall be
-        // returned to the host by the Parameter Byte of the command sequence
-        // with the Busy Executing bit set (see Section 4.4.1.7).
-        //
-        // Upon the completion of the positioning of the moving head(s) over
-        // cylinder zero the device shall clear the Busy Executing bit in the
-        // General Status byte and set the Attention Condition.
-
-        start_time_dependent_command(5, // 5ms.  look up this timing...
-                                     finish_rezero);
-
-        dev->general_status |= GS_BUSY_EXECUTING;
-        dev->param_in = dev->general_status;
-        return;
+static void cmd_report_sense_byte_2(AnsiDev* dev) {
+    // The command shall cause the selected device to return Sense Byte 2
+    // by the Parameter Byte of the command sequence. No other action
+    // shall be taken in the device.
+    dev->param_in = dev->sense_byte_2;
+}
 
-    case ANSI_CMD_REPORT_SENSE_BYTE_2:
-        dbgmsg("ansicmd REPORT_SENSE_BYTE_2");
-        // The command shall cause the selected device to return Sense Byte 2
-        // by the Parameter Byte of the command sequence. No other action
-        // shall be taken in the device.
-        dev->param_in = dev->sense_byte_2;
-        return;
+static void cmd_report_sense_byte_1(AnsiDev* dev) {
+    // This command shall cause the selected device to return Sense Byte 1
+    // by the Parameter Byte of the command sequence. No other action
+    // shall be taken in the device.
+    dev->param_in = dev->sense_byte_1;
+}
 
-    case ANSI_CMD_REPORT_SENSE_BYTE_1:
-        dbgmsg("ansicmd REPORT_SENSE_BYTE_1");
-        // This command shall cause the selected device to return Sense Byte 1
-        // by the Parameter Byte of the command sequence. No other action
-        // shall be taken in the device.
-        dev->param_in = dev->sense_byte_1;
-        return;
+static void cmd_report_general_status(AnsiDev* dev) {
+    // This command shall cause the selected device to return the general
+    // Status Byte by the Parameter Byte of the command sequence. This
+    // command shall not perform any other function in the device and acts
+    // as a "no-op" in order to allow the host to monitor the device's
+    // General Status Byte without changing any device condition.
+    dev->param_in = dev->general_status;
+}
 
-    case ANSI_CMD_REPORT_GENERAL_STATUS:
-        dbgmsg("ansicmd REPORT_GENERAL_STATUS");
-        // This command shall cause the selected device to return the general
-        // Status Byte by the Parameter Byte of the command sequence. This
-        // command shall not perform any other function in the device and acts
-        // as a "no-op" in order to allow the host to monitor the device's
-        // General Status Byte without changing any device condition.
-        dev->param_in = dev->general_status;
-        return;
+static void cmd_report_attribute(AnsiDev* dev) {
+    // This command shall cause the selected device to return a byte of
+    // information that is the Device Attribute whose number was defined
+    // in the Load Attribute Number Command (see Section 4.1.6). The
+    // contents of the byte is defined by Table 4-3 and Section 4.3.
+    dbgmsg("    attribute =", dev->attribute_number);
+    dev->param_in = report_attribute(dev);
+}
 
-    case ANSI_CMD_REPORT_ATTRIBUTE:
-        dbgmsg("ansicmd REPORT_ATTRIBUTE");
-        // This command shall cause the selected device to return a byte of
-        // information that is the Device Attribute whose number was defined
-        // in the Load Attribute Number Command (see Section 4.1.6). The
-        // contents of the byte is defined by Table 4-3 and Section 4.3.
-        dbgmsg("    attribute =", dev->attribute_number);
-        dev->param_in = report_attribute();
-        return;
+static void cmd_set_attention(AnsiDev* dev) {
+    // This command shall cause the selected device to set the Attention
+    // Condition. No other action shall be caused.
+    // The General Status Byte shall be transferred to the host by the
+    // Parameter Byte of the command sequence.
+
+    start_time_dependent_command(dev, 5000 // 5ms.  look up this timing...
+                                           // no callback yet
+    );
+    dev->param_in = dev->general_status;
+}
 
-    case ANSI_CMD_SET_ATTENTION:
-        dbgmsg("ansicmd SET_ATTENTION");
-        // This command shall cause the selected device to set the Attention
-        // Condition. No other action shall be caused.
-        // The General Status Byte shall be transferred to the host by the
-        // Parameter Byte of the command sequence.
+static void cmd_selective_reset(AnsiDev* dev) {
+    // This command shall cause the selected device to reach Initial State
+    // (see Section 3.2.1). This is a time dependent command and as such
+    // shall set the Busy Executing bit prior to the assertion of the
+    // acknowledge to parameter request and shall be reflected in the
+    // returned General Status Byte. Upon completion of.the parameter
+    // byte transfer the device shall go to the initial state and all
+    // resetable parameter. attentions. errors. etc •• shall be reset.
+    // When the initial state is reached bit 0 of Sense Byte 2 will be set
+    // and bit 6 of the General Status Byte shall be cleared. (This
+    // causes the setting of the Attention Condition).
+    //
+    // TODO
+    dbgmsg("ANSI_CMD_SELECTIVE_RESET unimplemented");
+
+    start_time_dependent_command(dev, 5000 // 5ms.  look up this timing...
+                                           // no callback yet
+    );
+
+    dev->param_in = dev->general_status;
+}
 
-        start_time_dependent_command(5 // 5ms.  look up this timing...
-                                       // no callback yet
-        );
+static void cmd_reformat_track(AnsiDev* dev) {
+    // This command shall cause the selected device to reconfigure the
+    // arrangement of Sector Pulse generation according to parameters
+    // received via the Load Sector Pulses Per Track Commands (see
+    // Sections 4.1.9 to 4.1.11). The General Status Byte shall be
+    // returned to the host by the Parameter Byte of the command
+    // sequence.
+    // The Partition Track Command is a Time Dependent Command and as such
+    // shall set the Busy Executing bit in the General Status Byte
+    // returned by this command (see Section 4.4.1.7) and it is to remain
+    // set while this command execution is in process. Also. the device
+    // shall exercise appropriate control over the Busy signal at the
+    // interface (see Section 3.2.7).
+    // Upon the completion of execution of this command the Bytes Per
+    // Sector and the Sector Per Track will be updated in the Attribute
+    // Table and also bit 6 of Attribute byte OE Hex will be cleared and
+    // this shall set the Attention Condition.
+    // The Partition Track Command shall set the Attention Condition and
+    // the Illegal Parameter Bit in the General Status Byte if the Sector
+    // Pulses Per Track create a set that is outside the range of the
+    // device.
+    // activating Read Gate or Write Gate while this command is executing
+    // is a violation of protocol.
+    //
+    // The image has a single geometry, so the whole device is reformatted
+    // rather than just the track under the heads.
+    if (!ansi_geometry_valid(dev, dev->load_sectors,
+                             dev->load_sector_bytes)) {
+        set_general_status(dev, GS_ILLEGAL_PARAMETER);
+        set_attention_state(dev, true);
         dev->param_in = dev->general_status;
         return;
+    }
 
-    case ANSI_CMD_SELECTIVE_RESET:
-        dbgmsg("ansicmd SELECTIVE_RESET");
-        // This command shall cause the selected device to reach Initial State
-        // (see Section 3.2.1). This is a time dependent command and as such
-        // shall set the Busy Executing bit prior to the assertion of the
-        // acknowledge to parameter request and shall be reflected in the
-        // returned General Status Byte. Upon completion of.the parameter
-        // byte transfer the device shall go to the initial state and all
-        // resetable parameter. attentions. errors. etc •• shall be reset.
-        // When the initial state is reached bit 0 of Sense Byte 2 will be set
-        // and bit 6 of the General Status Byte shall be cleared. (This
-        // causes the setting of the Attention Condition).
-        //
-        // TODO
-        dbgmsg("ANSI_CMD_SELECTIVE_RESET unimplemented");
-
-        start_time_dependent_command(5 // 5ms.  look up this timing...
-                                       // no callback yet
-        );
+    // what was written with the old geometry goes to the image first
+    ansi_storage_flush(dev->id);
+    g_reformat_pending &= ~(1 << dev->id);
+    g_reformat_applied &= ~(1 << dev->id);
+    g_reformat_failed &= ~(1 << dev->id);
+    // a revolution to write the new sector marks
+    start_time_dependent_command(dev, ansi_rotation_revolution_us(),
+                                 finish_reformat);
+    dev->param_in = dev->general_status;
+}
 
-        dev->param_in = dev->general_status;
-        return;
+static void cmd_report_cyl_addr_high(AnsiDev* dev) {
+    // This command shall cause the selected device to return a byte of
+    // information that is the most significant byte of a 16 bit .number
+    // that, indicates the cylinder address of the current position of the
+    // moving heads. This number shall not reflect the most recent
+    // cylinder address set by the Set Cylinder Address Commands (see
+    // Sections 4.1.3 and 4.1.4) ,unless there has been an intervening Seek
+    // Command completed (see Section 4.2.4).
+    // If executed during a seek operation, the information returned shall
+    // be ascertained by the vendor specification.
+    // The information shall be transferred by the Parameter Byte of the
+    // command sequence.
+    dbgmsg("    CYL_ADDR_HIGH", dev->current_cylinder_high);
+    dev->param_in = dev->current_cylinder_high;
+}
 
-    case ANSI_CMD_REFORMAT_TRACK:
-        dbgmsg("ansicmd REFORMAT_TRACK");
-        // This command shall cause the selected device to reconfigure the
-        // arrangement of Sector Pulse generation according to parameters
-        // received via the Load Sector Pulses Per Track Commands (see
-        // Sections 4.1.9 to 4.1.11). The General Status Byte shall be
-        // returned to the host by the Parameter Byte of the command
-        // sequence.
-        // The Partition Track Command is a Time Dependent Command and as such
-        // shall set the Busy Executing bit in the General Status Byte
-        // returned by this command (see Section 4.4.1.7) and it is to remain
-        // set while this command execution is in process. Also. the device
-        // shall exercise appropriate control over the Busy signal at the
-        // interface (see Section 3.2.7).
-        // Upon the completion of execution of this command the Bytes Per
-        // Sector and the Sector Per Track will be updated in the Attribute
-        // Table and also bit 6 of Attribute byte OE Hex will be cleared and
-        // this shall set the Attention Condition.
-        // The Partition Track Command shall set the Attention Condition and
-        // the Illegal Parameter Bit in the General Status Byte if the Sector
-        // Pulses Per Track create a set that is outside the range of the
-        // device.
-        // activating Read Gate or Write Gate while this command is executing
-        // is a violation of protocol.
-        //
-        // TODO
-        dbgmsg("ANSI_CMD_REFORMAT_TRACK unimplemented");
-        start_time_dependent_command(5 // 5ms.  look up this timing...
-                                       // no callback yet
-        );
-        dev->general_status |= GS_BUSY_EXECUTING;
-        dev->param_in = dev->general_status;
-        return;
+static void cmd_report_cyl_addr_low(AnsiDev* dev) {
+    // This command shall cause the selected device to return a byte of
+    // information that is the least significant byte of a 16 bit number
+    // that indicates the cylinder address of the current position of the
+    // moving heads. This number shall not reflect the most recent
+    // cylinder address set by the Set Cylinder Address Commands (see
+    // Sections 4.1.3 and 4.1.4) unless there has been an intervening Seek
+    // Command completed (see Section 4.2.4).
+    // If executed during a seek operation, the information returned shall
+    // be ascertained by the vendor specification.
+    // The information shall be transferred by the Parameter Byte of the
+    // command sequence.
+    //
+    dbgmsg("    CYL_ADDR_LOW", dev->current_cylinder_low);
+    dev->param_in = dev->current_cylinder_low;
+}
 
-    case ANSI_CMD_REPORT_CYL_ADDR_HIGH:
-        dbgmsg("ansicmd REPORT_CYL_ADDR_HIGH");
-        // This command shall cause the selected device to return a byte of
-        // information that is the most significant byte of a 16 bit .number
-        // that, indicates the cylinder address of the current position of the
-        // moving heads. This number shall not reflect the most recent
-        // cylinder address set by the Set Cylinder Address Commands (see
-        // Sections 4.1.3 and 4.1.4) ,unless there has been an intervening Seek
-        // Command completed (see Section 4.2.4).
-        // If executed during a seek operation, the information returned shall
-        // be ascertained by the vendor specification.
-        // The information shall be transferred by the Parameter Byte of the
-        // command sequence.
-        dbgmsg("    CYL_ADDR_HIGH", dev->current_cylinder_high);
-        dev->param_in = dev->current_cylinder_high;
-        return;
+static void cmd_report_test_byte(AnsiDev* dev) {
+    // This command shall cause the selected device to return a copy of
+    // the Test Byte transferred to the device via the Load 'Test Byte
+    // Command. (See Section 4.1.12.)
+    // The Test Byte shall be transferred by the Parameter Byte of the
+    // command sequence.
+    //
+    dbgmsg("ANSI_CMD_REPORT_TEST_BYTE", dev->test_byte);
+    dev->param_in = dev->test_byte;
+}
 
-    case ANSI_CMD_REPORT_CYL_ADDR_LOW:
-        dbgmsg("ansicmd REPORT_CYL_ADDR_LOW");
-        // This command shall cause the selected device to return a byte of
-        // information that is the least significant byte of a 16 bit number
-        // that indicates the cylinder address of the current position of the
-        // moving heads. This number shall not reflect the most recent
-        // cylinder address set by the Set Cylinder Address Commands (see
-        // Sections 4.1.3 and 4.1.4) unless there has been an intervening Seek
-        // Command completed (see Section 4.2.4).
-        // If executed during a seek operation, the information returned shall
-        // be ascertained by the vendor specification.
-        // The information shall be transferred by the Parameter Byte of the
-        // command sequence.
-        //
-        dbgmsg("    CYL_ADDR_LOW", dev->current_cylinder_low);
-        dev->param_in = dev->current_cylinder_low;
-        return;
+static void cmd_attention_control(AnsiDev* dev) {
+    uint8_t param_out = dev->param_out;
 
-    case ANSI_CMD_REPORT_TEST_BYTE:
-        dbgmsg("ansicmd REPORT_TEST_BYTE");
-        // This command shall cause the selected device to return a copy of
-        // the Test Byte transferred to the device via the Load 'Test Byte
-        // Command. (See Section 4.1.12.)
-        // The Test Byte shall be transferred by the Parameter Byte of the
-        // command sequence.
-        //
-        dbgmsg("ANSI_CMD_REPORT_TEST_BYTE", dev->test_byte);
-        dev->param_in = dev->test_byte;
-        return;
+    // This command shall condition the selected device to enable or
+    // disable its attention circuitry based on the value of the Parameter
+    // Byte as shown below.
+    // 7 6 5 4 3 2 1 0
+    // | o o o o o o o
+    // |
+    // o - Enable Attention
+    // 1 - Disable Attention
+    //
+    // This command allows the host to selectively ignore attention
+    // requests from certain devices on the interface. This might be done
+    // in response to a device that generates spurious attention requests
+    // due to a malfuntion.
+    // The Enable Attention Command shall cause the selected device to
+    // gate its internal Attention Condition onto the party line ("wired
+    // OR") Attention Signal. The Disable Attention Command shall cause
+    // the selected device to disable the gating of the internal Attention
+    // Condition onto the party line Attention Signal. This command shall
+    // have no impact on the function of the radial status returned with
+    // the Attention In Strobe Signal (see Signal 3.2.3.2).
+    // Devices shall be initilized with the Attention circuitry enabled.
+    //
+    set_attention_enabled(dev, (param_out & 0x80) ? false : true);
+}
 
-    case ANSI_CMD_ATTENTION_CONTROL:
-        dbgmsg("ansicmd ATTENTION_CONTROL");
-        // This command shall condition the selected device to enable or
-        // disable its attention circuitry based on the value of the Parameter
-        // Byte as shown below.
-        // 7 6 5 4 3 2 1 0
-        // | o o o o o o o
-        // |
-        // o - Enable Attention
-        // 1 - Disable Attention
-        //
-        // This command allows the host to selectively ignore attention
-        // requests from certain devices on the interface. This might be done
-        // in response to a device that generates spurious attention requests
-        // due to a malfuntion.
-        // The Enable Attention Command shall cause the selected device to
-        // gate its internal Attention Condition onto the party line ("wired
-        // OR") Attention Signal. The Disable Attention Command shall cause
-        // the selected device to disable the gating of the internal Attention
-        // Condition onto the party line Attention Signal. This command shall
-        // have no impact on the function of the radial status returned with
-        // the Attention In Strobe Signal (see Signal 3.2.3.2).
-        // Devices shall be initilized with the Attention circuitry enabled.
-        //
-        dev->attention_enabled = (param_out & 0x80) ? false : true;
-        return;
+static void cmd_write_control(AnsiDev* dev) {
+    uint8_t param_out = dev->param_out;
 
-    case ANSI_CMD_WRITE_CONTROL:
-        dbgmsg("ansicmd WRITE_CONTROL");
-        // This command shall condition the selected device to enable or
-        // disable its write circuitry based on the value of the parameter
-        // Byte as shown below:
-        // 7 6 5 4 3 2 1 0
-        // | o o o o o o o
-        // |
-        // 1 - Write Enable
-        // o - Write Disable
-        //
-        // This command is used in conjunction with the Write Gate Signal and
-        // therefore merely enables the write circuitry while the Write Gate
-        // Signal activates the circuitry at the proper time. An active Write
-        // Gate Signal while the device's write circuitry is disabled shall
-        // result in no data being recorded.
-        // Devices shall be initialized with the write circuitry disabled.
-        // A Write Control Command execute during a write operation is a
-        // violation of protocol.
-        //
-        dev->write_enabled = (param_out & 0x80) != 0;
-        return;
+    // This command shall condition the selected device to enable or
+    // disable its write circuitry based on the value of the parameter
+    // Byte as shown below:
+    // 7 6 5 4 3 2 1 0
+    // | o o o o o o o
+    // |
+    // 1 - Write Enable
+    // o - Write Disable
+    //
+    // This command is used in conjunction with the Write Gate Signal and
+    // therefore merely enables the write circuitry while the Write Gate
+    // Signal activates the circuitry at the proper time. An active Write
+    // Gate Signal while the device's write circuitry is disabled shall
+    // result in no data being recorded.
+    // Devices shall be initialized with the write circuitry disabled.
+    // A Write Control Command execute during a write operation is a
+    // violation of protocol.
+    //
+    dev->write_enabled = (param_out & 0x80) != 0;
+}
 
-    case ANSI_CMD_LOAD_CYL_ADDR_HIGH:
-        dbgmsg("ansicmd LOAD_CYL_ADDR_HIGH");
-        // This command shall condition the selected device to accept the
-        // Parameter Byte as the most significant Byte of a cylinder address.
-        // This command is used in conjunction with the Seek Command (see
-        // Section 4.2.4) and therefore is a means of supplying the most
-        // significant byte of a target cylinder address.
-        // This command shall not cause any head motion. Loading a cylinder
-        // address outside the range of a device shall not cause an error
-        // unless a subsequent Seek Command is issued to that illegal
-        // cylinder.
-        // Devices shall be initialized with the target cylinder address equal
-        // to zero.
-        //
-        dbgmsg("  cyl_addr_high", param_out);
-        dev->load_cylinder_high = param_out;
-        return;
+static void cmd_load_cyl_addr_high(AnsiDev* dev) {
+    uint8_t param_out = dev->param_out;
 
-    case ANSI_CMD_LOAD_CYL_ADDR_LOW:
-        dbgmsg("ansicmd LOAD_CYL_ADDR_LOW");
-        // This command shall condition the selected device to accept the
-        // Parameter Byte as the least signficant byte of a cylinder address.
-        // This command is used in conjunction with the Seek Command (see
-        // Section 4.2.4) and therefore is a means of supplying the least
-        // significant byte of a target cylinder address.
-        // This command shall not cause any head motion. Loading a cylinder
-        // address outside the range of a device shall not cause an error
-        // unless a subsequent seek command is issued to that illegal
-        // cylinder.
-        // Devices shall be initialized with the target cylinder address equal
-        // to zero.
-        //
-        dbgmsg("ANSI_CMD_LOAD_CYL_ADDR_LOW", param_out);
-        dev->load_cylinder_low = param_out;
-        return;
+    // This command shall condition the selected device to accept the
+    // Parameter Byte as the most significant Byte of a cylinder address.
+    // This command is used in conjunction with the Seek Command (see
+    // Section 4.2.4) and therefore is a means of supplying the most
+    // significant byte of a target cylinder address.
+    // This command shall not cause any head motion. Loading a cylinder
+    // address outside the range of a device shall not cause an error
+    // unless a subsequent Seek Command is issued to that illegal
+    // cylinder.
+    // Devices shall be initialized with the target cylinder address equal
+    // to zero.
+    //
+    dbgmsg("  cyl_addr_high", param_out);
+    dev->load_cylinder_high = param_out;
+}
 
-    case ANSI_CMD_SELECT_HEAD:
-        dbgmsg("ansicmd SELECT_HEAD");
-        // This command shall condition the selected device to. accept the
-        // Parameter Byte as the binary address of the head selected for read
-        // or write operations. This command shall enable the moving heads
-        // and shall disable the fixed heads.
-        // A Select Moving Head Command issued during a read or write
-        // operation is a violation of protocol.
-        // The device shall set the Attention Condition and the Illegal
-        // Parameter Bit in the General Status Byte upon receipt of a head
-        // address outside the head address range of the device.
-        // Devices shall be initialized with moving head zero selected.
-        dev->selected_head = param_out;
-        return;
+static void cmd_load_cyl_addr_low(AnsiDev* dev) {
+    uint8_t param_out = dev->param_out;
 
-    case ANSI_CMD_LOAD_ATTRIBUTE_NUMBER:
-        dbgmsg("ansicmd LOAD_ATTRIBUTE_NUMBER", param_out);
-        // This command shall condition the selected device to accept the
-        // Parameter Byte as the number of a Device Attribute as defined in
-        // Table 4-3. This command prepares the device for a subsequent Load
-        // Device Attribute Command or Report Device Attribute Command (see
-        // Sections 4.1.7 and 4.2.9). This command may be issued at any time.
-        dev->attribute_number = param_out;
-        return;
+    // This command shall condition the selected device to accept the
+    // Parameter Byte as the least signficant byte of a cylinder address.
+    // This command is used in conjunction with the Seek Command (see
+    // Section 4.2.4) and therefore is a means of supplying the least
+    // significant byte of a target cylinder address.
+    // This command shall not cause any head motion. Loading a cylinder
+    // address outside the range of a device shall not cause an error
+    // unless a subsequent seek command is issued to that illegal
+    // cylinder.
+    // Devices shall be initialized with the target cylinder address equal
+    // to zero.
+    //
+    dbgmsg("ANSI_CMD_LOAD_CYL_ADDR_LOW", param_out);
+    dev->load_cylinder_low = param_out;
+}
 
-    case ANSI_CMD_LOAD_ATTRIBUTE:
-        dbgmsg("ansicmd LOAD_ATTRIBUTE", dev->attribute_number);
-        // This command shall condition the selected device to accept the
-        // Parameter Byte as the new value of a Device Attribute. The number
-        // of the Device Attribute must have been previously defined by the
-        // Load Attribute Number Command (see Section 4.1.6).
-        dbgmsg("    value=", param_out);
-        load_attribute(param_out);
-        dbgmsg("    done");
-        return;
+static void cmd_select_head(AnsiDev* dev) {
+    uint8_t param_out = dev->param_out;
 
-    case ANSI_CMD_SPIN_CONTROL:
-        dbgmsg("ansicmd SPIN_CONTROL");
-        // This command shall condition the seleted device to enter a spin up
-        // or spin down cycle based on the value of the Parameter Byte as
-        // shown below.
-        // 7 6 5 4 3 2 1 0
-        // | o o o o o o o
-        // |
-        // 1 - Spin Up
-        // o - Spin Down
-        // A spin up cycle shall consist of starting the rotation of the
-        // spindle. A spin down cycle shall consist of stopping the rotation
-        // of the spindle.
-        // Upon completion of a spin control cycle the device shall set the
-        // Attention Condition. Issuing a spin up command to a device whose
-        // spindle is already at full speed or issuing a spin down command to
-        // a device whose spindle has already stopped shall also set the
-        // Attention Condition.
-        // The Spin Control Command is a Time Dependent Command and as such
-        // shall set the Busy Executing bit in the General Status Byte (see
-        // Section 4.4.1.7) while command execution is in process. Also, the
-        // device shall exercise appropriate control over the Busy signal at
-        // the interface (see Section 3.2.7).
-        // A spin down cycle shall cause the repositioning of the moving
-        // head(s) over the landing zone and stop the rotation of the
-        // spindle. If the device detects that it cannot successfully seek to
-        // the landing zone it shall set the Attention Condition and set bit 0
-        // of Sense Byte 1.
-        // See vendor specification for initial state of the Spin Control.
-
-        start_time_dependent_command(10 // 10ms.  look up this timing...
-                                        // no callback for the time being
-        );
-        return;
+    // This command shall condition the selected device to. accept the
+    // Parameter Byte as the binary address of the head selected for read
+    // or write operations. This command shall enable the moving heads
+    // and shall disable the fixed heads.
+    // A Select Moving Head Command issued during a read or write
+    // operation is a violation of protocol.
+    // The device shall set the Attention Condition and the Illegal
+    // Parameter Bit in the General Status Byte upon receipt of a head
+    // address outside the head address range of the device.
+    // Devices shall be initialized with moving head zero selected.
+    dev->selected_head = param_out;
+}
 
-    case ANSI_CMD_LOAD_SECT_PER_TRACK_HIGH:
-        dbgmsg("ansicmd LOAD_SECT_PER_TRACK_HIGH unimplemented");
-        return;
+static void cmd_load_attribute_number(AnsiDev* dev) {
+    uint8_t param_out = dev->param_out;
 
-    case ANSI_CMD_LOAD_SECT_PER_TRACK_MEDIUM:
-        dbgmsg("ansicmd LOAD_SECT_PER_TRACK_MEDIUM unimplemented");
-        return;
+    dbgmsg("    attribute =", param_out);
+    // This command shall condition the selected device to accept the
+    // Parameter Byte as the number of a Device Attribute as defined in
+    // Table 4-3. This command prepares the device for a subsequent Load
+    // Device Attribute Command or Report Device Attribute Command (see
+    // Sections 4.1.7 and 4.2.9). This command may be issued at any time.
+    dev->attribute_number = param_out;
+}
 
-    case ANSI_CMD_LOAD_SECT_PER_TRACK_LOW:
-        dbgmsg("ansicmd LOAD_SECT_PER_TRACK_LOW unimplemented");
-        return;
+static void cmd_load_attribute(AnsiDev* dev) {
+    uint8_t param_out = dev->param_out;
 
-    case ANSI_CMD_LOAD_BYTES_PER_SECT_HIGH:
-        dbgmsg("ansicmd LOAD_BYTES_PER_SECT_HIGH unimplemented");
-        return;
+    dbgmsg("    attribute =", dev->attribute_number);
+    // This command shall condition the selected device to accept the
+    // Parameter Byte as the new value of a Device Attribute. The number
+    // of the Device Attribute must have been previously defined by the
+    // Load Attribute Number Command (see Section 4.1.6).
+    dbgmsg("    value=", param_out);
+    load_attribute(dev, param_out);
+    dbgmsg("    done");
+}
 
-    case ANSI_CMD_LOAD_BYTES_PER_SECT_MEDIUM:
-        dbgmsg("ansicmd LOAD_BYTES_PER_SECT_MEDIUM unimplemented");
-        return;
+static void cmd_spin_control(AnsiDev* dev) {
+    // This command shall condition the seleted device to enter a spin up
+    // or spin down cycle based on the value of the Parameter Byte as
+    // shown below.
+    // 7 6 5 4 3 2 1 0
+    // | o o o o o o o
+    // |
+    // 1 - Spin Up
+    // o - Spin Down
+    // A spin up cycle shall consist of starting the rotation of the
+    // spindle. A spin down cycle shall consist of stopping the rotation
+    // of the spindle.
+    // Upon completion of a spin control cycle the device shall set the
+    // Attention Condition. Issuing a spin up command to a device whose
+    // spindle is already at full speed or issuing a spin down command to
+    // a device whose spindle has already stopped shall also set the
+    // Attention Condition.
+    // The Spin Control Command is a Time Dependent Command and as such
+    // shall set the Busy Executing bit in the General Status Byte (see
+    // Section 4.4.1.7) while command execution is in process. Also, the
+    // device shall exercise appropriate control over the Busy signal at
+    // the interface (see Section 3.2.7).
+    // A spin down cycle shall cause the repositioning of the moving
+    // head(s) over the landing zone and stop the rotation of the
+    // spindle. If the device detects that it cannot successfully seek to
+    // the landing zone it shall set the Attention Condition and set bit 0
+    // of Sense Byte 1.
+    // See vendor specification for initial state of the Spin Control.
+
+    // spinning down waits until the written data is safely in the image
+    bool spin_up = (dev->param_out & 0x80) != 0;
+    if (!spin_up) {
+        ansi_storage_flush(dev->id);
+    }
 
-    case ANSI_CMD_LOAD_BYTES_PER_SECT_LOW:
-        dbgmsg("ansicmd LOAD_BYTES_PER_SECT_LOW unimplemented");
-        return;
+    start_time_dependent_command(dev, 10000, // 10ms.  look up this timing...
+                                 spin_up ? nullptr : finish_spin_down);
+}
 
-    case ANSI_CMD_LOAD_READ_PERMIT_HIGH:
-        dbgmsg("ansicmd LOAD_READ_PERMIT_HIGH unimplemented");
-        return;
+// Load Sector Pulses Per Track and Load Bytes Per Sector each load a byte of
+// a 24 bit number, applied by the next Reformat Track.
+static void load_geometry_byte(AnsiDev* dev, uint32_t& value, int shift) {
+    value = (value & ~(0xffu << shift)) | ((uint32_t)dev->param_out << shift);
 
-    case ANSI_CMD_LOAD_READ_PERMIT_LOW:
-        dbgmsg("ansicmd LOAD_READ_PERMIT_LOW unimplemented");
-        return;
+    initialize_attributes(dev);
+    dev->attributes[0x0E] |= ATTR_REFORMAT_PENDING;
+}
 
-    case ANSI_CMD_LOAD_WRITE_PERMIT_HIGH:
-        dbgmsg("ansicmd LOAD_WRITE_PERMIT_HIGH unimplemented");
-        return;
+static void cmd_load_sectors_high(AnsiDev* dev) {
+    // These commands shall condition the selected device to accept the
+    // Parameter Byte as a byte of the number of Sector Pulses Per Track
+    // used by a subsequent Reformat Track Command (see Section 4.2.7).
+    load_geometry_byte(dev, dev->load_sectors, 16);
+}
+
+static void cmd_load_sectors_medium(AnsiDev* dev) {
+    load_geometry_byte(dev, dev->load_sectors, 8);
+}
+
+static void cmd_load_sectors_low(AnsiDev* dev) {
+    load_geometry_byte(dev, dev->load_sectors, 0);
+}
+
+static void cmd_load_sect_bytes_high(AnsiDev* dev) {
+    // Likewise for the number of Bytes Per Sector.
+    load_geometry_byte(dev, dev->load_sector_bytes, 16);
+}
 
-    case ANSI_CMD_LOAD_WRITE_PERMIT_LOW:
-        dbgmsg("ansicmd LOAD_WRITE_PERMIT_LOW unimplemented");
+static void cmd_load_sect_bytes_medium(AnsiDev* dev) {
+    load_geometry_byte(dev, dev->load_sector_bytes, 8);
+}
+
+static void cmd_load_sect_bytes_low(AnsiDev* dev) {
+    load_geometry_byte(dev, dev->load_sector_bytes, 0);
+}
+
+static void cmd_load_test_byte(AnsiDev* dev) {
+    uint8_t param_out = dev->param_out;
+
+    dbgmsg("    test byte =", param_out);
+    // This command shall condition the selected device to accept the
+    // Parameter Byte as a specific test byte that shall be returned to the
+    // host as part of the Report Test Byte Command (see Section 4.2.15).
+    //
+    // This command pair allows the host to test the integrity of data
+    // transfer over the Control Bus.
+    dev->test_byte = param_out;
+}
+
+// Every command byte maps to a descriptor.  Command bytes we know nothing
+// about keep the parameter direction encoded in bit 6 of the command, so the
+// handshake with the host still completes.
+static constexpr AnsiCmdTable build_ansi_cmd_table() {
+    AnsiCmdTable t{};
+
+    for (int cmd = 0; cmd < 256; cmd++) {
+        t.cmds[cmd] = {nullptr, nullptr,
+                       (uint8_t)((cmd & 0x40) ? ANSI_CMD_PARAM_OUT : 0)};
+    }
+
+#define CMD(cmdName, handler, flags)                                           \
+    t.cmds[ANSI_CMD_##cmdName] = {                                             \
+        #cmdName, handler,                                                     \
+        (uint8_t)(((ANSI_CMD_##cmdName & 0x40) ? ANSI_CMD_PARAM_OUT : 0) |     \
+                  (flags))}
+
+    // clang-format off
+    CMD(REPORT_ILLEGAL_COMMAND,     cmd_report_illegal_command, ANSI_CMD_GATES_ALLOWED);
+    CMD(CLEAR_FAULT,                cmd_clear_fault,            0);
+    CMD(CLEAR_ATTENTION,            cmd_clear_attention,        ANSI_CMD_GATES_ALLOWED);
+    CMD(SEEK,                       cmd_seek,                   ANSI_CMD_TIME_DEPENDENT);
+    CMD(REZERO,                     cmd_rezero,                 ANSI_CMD_TIME_DEPENDENT);
+    CMD(REPORT_SENSE_BYTE_2,        cmd_report_sense_byte_2,    ANSI_CMD_GATES_ALLOWED);
+    CMD(REPORT_SENSE_BYTE_1,        cmd_report_sense_byte_1,    ANSI_CMD_GATES_ALLOWED);
+    CMD(REPORT_GENERAL_STATUS,      cmd_report_general_status,  ANSI_CMD_GATES_ALLOWED);
+
+    CMD(REPORT_ATTRIBUTE,           cmd_report_attribute,       ANSI_CMD_GATES_ALLOWED);
+    CMD(SET_ATTENTION,              cmd_set_attention,          ANSI_CMD_TIME_DEPENDENT);
+    CMD(SELECTIVE_RESET,            cmd_selective_reset,        0);
+    CMD(SEEK_TO_LANDING_ZONE,       nullptr,                    0);
+    CMD(REFORMAT_TRACK,             cmd_reformat_track,         ANSI_CMD_TIME_DEPENDENT);
+
+    CMD(REPORT_CYL_ADDR_HIGH,       cmd_report_cyl_addr_high,   ANSI_CMD_GATES_ALLOWED);
+    CMD(REPORT_CYL_ADDR_LOW,        cmd_report_cyl_addr_low,    ANSI_CMD_GATES_ALLOWED);
+    CMD(REPORT_READ_PERMIT_HIGH,    nullptr,                    ANSI_CMD_GATES_ALLOWED);
+    CMD(REPORT_READ_PERMIT_LOW,     nullptr,                    ANSI_CMD_GATES_ALLOWED);
+    CMD(REPORT_WRITE_PERMIT_HIGH,   nullptr,                    ANSI_CMD_GATES_ALLOWED);
+    CMD(REPORT_WRITE_PERMIT_LOW,    nullptr,                    ANSI_CMD_GATES_ALLOWED);
+    CMD(REPORT_TEST_BYTE,           cmd_report_test_byte,       ANSI_CMD_GATES_ALLOWED);
+
+    CMD(ATTENTION_CONTROL,          cmd_attention_control,      ANSI_CMD_GATES_ALLOWED);
+    CMD(WRITE_CONTROL,              cmd_write_control,          0);
+    CMD(LOAD_CYL_ADDR_HIGH,         cmd_load_cyl_addr_high,     0);
+    CMD(LOAD_CYL_ADDR_LOW,          cmd_load_cyl_addr_low,      0);
+    CMD(SELECT_HEAD,                cmd_select_head,            0);
+
+    CMD(LOAD_ATTRIBUTE_NUMBER,      cmd_load_attribute_number,  ANSI_CMD_GATES_ALLOWED);
+    CMD(LOAD_ATTRIBUTE,             cmd_load_attribute,         0);
+    CMD(SPIN_CONTROL,               cmd_spin_control,           ANSI_CMD_TIME_DEPENDENT);
+    CMD(LOAD_SECT_PER_TRACK_HIGH,   cmd_load_sectors_high,      0);
+    CMD(LOAD_SECT_PER_TRACK_MEDIUM, cmd_load_sectors_medium,    0);
+    CMD(LOAD_SECT_PER_TRACK_LOW,    cmd_load_sectors_low,       0);
+    CMD(LOAD_BYTES_PER_SECT_HIGH,   cmd_load_sect_bytes_high,   0);
+    CMD(LOAD_BYTES_PER_SECT_MEDIUM, cmd_load_sect_bytes_medium, 0);
+    CMD(LOAD_BYTES_PER_SECT_LOW,    cmd_load_sect_bytes_low,    0);
+    CMD(LOAD_TEST_BYTE,             cmd_load_test_byte,         ANSI_CMD_GATES_ALLOWED);
+
+    // vendor commands, only described in the apollo engineering handbook
+    CMD(READ_CONTROL,               nullptr,                    0);
+    CMD(OFFSET_CONTROL,             nullptr,                    0);
+    CMD(LOAD_READ_PERMIT_HIGH,      nullptr,                    0);
+    CMD(LOAD_READ_PERMIT_LOW,       nullptr,                    0);
+    CMD(LOAD_WRITE_PERMIT_HIGH,     nullptr,                    0);
+    CMD(LOAD_WRITE_PERMIT_LOW,      nullptr,                    0);
+    // clang-format on
+
+#undef CMD
+
+    return t;
+}
+
+constexpr AnsiCmdTable g_ansi_cmd_table = build_ansi_cmd_table();
+
+static void execute_command(AnsiDev* dev, bool gates_active) {
+    const AnsiCmdDescriptor& desc = command_descriptor(dev->cmd);
+
+    if (!desc.name) {
+        // an opcode the standard doesn't define is an illegal command, and
+        // the host gets the general status saying so
+        dbgmsg("unknown ANSI command ", dev->cmd);
+        cmd_report_illegal_command(dev);
         return;
+    }
+
+    dbgmsg("ansicmd ", desc.name);
 
-    case ANSI_CMD_LOAD_TEST_BYTE:
-        dbgmsg("ansicmd LOAD_TEST_BYTE", param_out);
-        // This command shall condition the selected device to accept the
-        // Parameter Byte as a specific test byte that shall be returned to the
-        // host as part of the Report Test Byte Command (see Section 4.2.15).
-        //
-        // This command pair allows the host to test the integrity of data
-        // transfer over the Control Bus.
-        dev->test_byte = param_out;
+    if (gates_active && !(desc.flags & ANSI_CMD_GATES_ALLOWED)) {
+        // issuing this command while reading or writing is a violation of
+        // protocol.
+        dbgmsg("    not allowed with read/write gate active");
+        cmd_report_illegal_command(dev);
         return;
+    }
 
-    default:
-        dbgmsg("unknown ANSI command", dev->cmd);
+    if (!desc.handler) {
+        dbgmsg("    unimplemented");
         return;
     }
+
+    desc.handler(dev);
+}
+
+void ansi_execute_command(AnsiDev* dev, bool gates_active) {
+    uint32_t start = platform_cycle_count();
+    execute_command(dev, gates_active);
+    ansi_latency_record_command(dev->cmd, platform_cycle_count() - start);
 }
 
 enum DeviceTypeId {
@@ -492,8 +622,29 @@ enum DeviceTypeId {
     RemovableDisk = 0x02,
 };
 
-static void initialize_attributes() {
-    AnsiDev* dev = &gAnsiDev;
+// attributes 0x10-0x18, from the device's current geometry
+static void set_geometry_attributes(AnsiDev* dev) {
+    // the unformatted capacity, which a reformat doesn't change
+    uint32_t bytes_per_track = dev->disk_type->sectors * HARD_DISK_SECTOR_SIZE;
+    dev->attributes[0x10] =
+        (bytes_per_track >> 16) & 0xff; // MSB of # of bytes per track
+    dev->attributes[0x11] =
+        (bytes_per_track >> 8) & 0xff; // MedSB of # of bytes per track
+    dev->attributes[0x12] =
+        bytes_per_track & 0xff; // LSB of # of bytes per track
+    dev->attributes[0x13] = 0x00; // MSB of # of bytes per sector
+    dev->attributes[0x14] =
+        dev->sector_bytes >> 8; // MedSB of # of bytes per sector
+    dev->attributes[0x15] =
+        dev->sector_bytes & 0xff; // LSB of # of bytes per sector
+    dev->attributes[0x16] = 0x00; // MSB of # of sector pulses per track
+    dev->attributes[0x17] =
+        dev->sectors >> 8; // MedSB of # of sector pulses per track
+    dev->attributes[0x18] =
+        dev->sectors & 0xff; // LSB of # of sector pulses per track
+}
+
+static void initialize_attributes(AnsiDev* dev) {
     /* ensure our attributes have been initialized */
     if (!dev->attributes_initialized) {
         dev->attributes_initialized = true;
@@ -511,25 +662,7 @@ static void initialize_attributes() {
         dev->attributes[0x0E] = 0x00; // Table Modification - action dependent
         dev->attributes[0x0F] = 0x00; // Table ID - vendor defined
 
-        uint32_t bytes_per_track =
-            dev->disk_type->sectors * HARD_DISK_SECTOR_SIZE;
-        dev->attributes[0x10] =
-            (bytes_per_track >> 16) & 0xff; // MSB of # of bytes per track
-        dev->attributes[0x11] =
-            (bytes_per_track >> 8) & 0xff; // MedSB of # of bytes per track
-        dev->attributes[0x12] =
-            bytes_per_track & 0xff; // LSB of # of bytes per track
-        dev->attributes[0x13] = (HARD_DISK_SECTOR_SIZE >> 16) &
-                                0xff; // MSB of # of bytes per sector
-        dev->attributes[0x14] = (HARD_DISK_SECTOR_SIZE >> 8) &
-                                0xff; // MedSB of # of bytes per sector
-        dev->attributes[0x15] =
-            HARD_DISK_SECTOR_SIZE & 0xff; // LSB of # of bytes per sector
-        dev->attributes[0x16] = 0x00;     // MSB of # of sector pulses per track
-        dev->attributes[0x17] = dev->disk_type->sectors >>
-                                8; // MedSB of # of sector pulses per track
-        dev->attributes[0x18] = dev->disk_type->sectors &
-                                0xff; // LSB of # of sector pulses per track
+        set_geometry_attributes(dev);
         dev->attributes[0x19] = 0x00; // Sectoring method
 
         dev->attributes[0x20] =
@@ -558,50 +691,137 @@ static void initialize_attributes() {
     }
 }
 
-static void load_attribute(uint8_t attribute_value) {
-    initialize_attributes();
-    gAnsiDev.attributes[gAnsiDev.attribute_number] = attribute_value;
+static void load_attribute(AnsiDev* dev, uint8_t attribute_value) {
+    initialize_attributes(dev);
+    if (dev->attributes[dev->attribute_number] != attribute_value) {
+        dev->attributes[dev->attribute_number] = attribute_value;
+        dev->attributes[0x0E] |= ATTR_TABLE_MODIFIED;
+    }
 }
 
-static uint8_t report_attribute() {
-    initialize_attributes();
-    return gAnsiDev.attributes[gAnsiDev.attribute_number];
+static uint8_t report_attribute(AnsiDev* dev) {
+    initialize_attributes(dev);
+    return dev->attributes[dev->attribute_number];
 }
 
-static void finish_seek() {
-    AnsiDev* dev = &gAnsiDev;
-    dev->current_cylinder_high = gSeekParams.cylinder_high;
-    dev->current_cylinder_low = gSeekParams.cylinder_low;
+// Start staging the target cylinder's data and return how long the seek
+// takes.  In turbo mode that is no time at all, so the seek completes as soon
+// as finish_seek() finds the data staged.
+static uint32_t seek_duration(AnsiDev* dev, uint16_t cylinder) {
+    ansi_storage_stage_cylinder(dev->id, cylinder);
+
+    if (g_ansi_turbo_seek) {
+        return 0;
+    }
+
+    uint16_t current =
+        (dev->current_cylinder_high << 8) | dev->current_cylinder_low;
+    return ansi_seek_time_us(dev->disk_type, current, cylinder);
 }
 
-static void finish_rezero() {
-    AnsiDev* dev = &gAnsiDev;
-    dev->current_cylinder_high = 0;
-    dev->current_cylinder_low = 0;
+static bool finish_seek(AnsiDev* dev) {
+    uint16_t cylinder = gSeekParams[dev->id].cylinder;
+    if (!ansi_storage_cylinder_staged(dev->id, cylinder)) {
+        return false;
+    }
+
+    dev->current_cylinder_high = cylinder >> 8;
+    dev->current_cylinder_low = cylinder & 0xff;
+    return true;
 }
 
-// globals to store pointers to the callback and params for the time dependent
-// command
-elapsedMillis gTimeDependentElapsedMillis;
-uint32_t gTimeDependentDurationMillis;
-void (*gTimeDependentCallback)();
+static bool finish_rezero(AnsiDev* dev) { return finish_seek(dev); }
 
-static void start_time_dependent_command(uint32_t durationMillis,
-                                         void (*callback)()) {
-    gTimeDependentCallback = callback;
-    gTimeDependentDurationMillis = durationMillis;
-    gTimeDependentElapsedMillis = 0;
+static bool finish_spin_down(AnsiDev* dev) {
+    return ansi_storage_flushed(dev->id);
 }
 
-// returns true if the time dependent command is still executing (based on the
-// elapsed time.) if the command is done executing, the callback is invoked and
-// the function returns false.
-bool ansi_poll_time_dependent() {
-    if (gTimeDependentElapsedMillis >= gTimeDependentDurationMillis) {
-        if (gTimeDependentCallback) {
-            gTimeDependentCallback();
-        }
+static bool finish_reformat(AnsiDev* dev) {
+    uint8_t bit = 1 << dev->id;
+    if (!(g_reformat_applied & bit)) {
+        g_reformat_pending |= bit;
         return false;
     }
+    g_reformat_applied &= ~bit;
+
+    if (g_reformat_failed & bit) {
+        // the old geometry stays, as if the parameters had been refused
+        // when the command started
+        g_reformat_failed &= ~bit;
+        set_general_status(dev, GS_ILLEGAL_PARAMETER);
+        return true;
+    }
+
+    initialize_attributes(dev);
+    set_geometry_attributes(dev);
+    dev->attributes[0x0E] &= ~ATTR_REFORMAT_PENDING;
+    // the sector format follows the new bytes per sector
+    dev->attributes[0x0E] |= ATTR_TABLE_MODIFIED;
     return true;
 }
+
+void ansi_poll_reformats() {
+    for (uint8_t mask = g_reformat_pending; mask; mask &= mask - 1) {
+        AnsiDev* dev = &gAnsiDevs[__builtin_ctz(mask)];
+        uint8_t bit = 1 << dev->id;
+        if (!ansi_storage_flushed(dev->id)) {
+            continue;
+        }
+
+        // checked when the command started, so this only fails if the
+        // device was reconfigured since, and the command then ends with
+        // Illegal Parameter.
+        bool ok = ansi_set_geometry(dev, dev->load_sectors,
+                                    dev->load_sector_bytes);
+        if (ok) {
+            logmsg("ANSI", dev->id, " reformatted to ", (int)dev->sectors,
+                   " sectors of ", (int)dev->sector_bytes, " bytes");
+        } else {
+            logmsg("ANSI", dev->id, " reformat to ", (int)dev->load_sectors,
+                   " sectors of ", (int)dev->load_sector_bytes,
+                   " bytes failed");
+        }
+        noInterrupts();
+        g_reformat_pending &= ~bit;
+        g_reformat_applied |= bit;
+        if (!ok) {
+            g_reformat_failed |= bit;
+        }
+        interrupts();
+    }
+}
+
+// the command specific part of each device's pending time dependent command
+static TimeDependentCallback gTimeDependentCallback[ANSI_MAX_DEVICES];
+
+static void finish_time_dependent_command(AnsiDev* dev) {
+    TimeDependentCallback callback = gTimeDependentCallback[dev->id];
+    uint8_t status = dev->general_status;
+    if (callback && !callback(dev)) {
+        ansi_schedule(dev, STAGE_POLL_MICROS,
+                      finish_time_dependent_command);
+        return;
+    }
+
+    // upon completion the device shall clear the Busy Executing bit in the
+    // General Status Byte and set the Attention Condition, whether or not it
+    // is still selected.  A command whose callback raised an error doesn't
+    // complete normally.
+    clear_general_status(dev, GS_BUSY_EXECUTING);
+    if (!(dev->general_status & ~status &
+          (GS_CONTROL_BUS_ERROR | GS_ILLEGAL_COMMAND |
+           GS_ILLEGAL_PARAMETER))) {
+        set_general_status(dev, GS_NORMAL_COMPLETE);
+    }
+    set_attention_state(dev, true);
+    ansi_update_busy();
+}
+
+// Time dependent commands set Busy Executing while they are in process, and
+// complete from the scheduler once durationMicros has passed.
+static void start_time_dependent_command(AnsiDev* dev, uint32_t durationMicros,
+                                         TimeDependentCallback callback) {
+    gTimeDependentCallback[dev->id] = callback;
+    set_general_status(dev, GS_BUSY_EXECUTING);
+    ansi_schedule(dev, durationMicros, finish_time_dependent_command);
+}
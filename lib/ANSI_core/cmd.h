@@ -53,20 +53,49 @@ typedef enum {
     // clang-format on
 } AnsiCmd;
 
-void ansi_execute_command();
-bool ansi_poll_time_dependent();
+struct AnsiDev;
+
+// command descriptor flags
+#define ANSI_CMD_PARAM_OUT 0x01      // parameter byte comes from the host
+#define ANSI_CMD_TIME_DEPENDENT 0x02 // completes later and sets attention
+#define ANSI_CMD_GATES_ALLOWED 0x04  // legal while read/write gate is active
+
+struct AnsiCmdDescriptor {
+    // command name for logging, nullptr for command bytes we don't know
+    const char* name;
+    // nullptr for known commands that aren't implemented yet
+    void (*handler)(AnsiDev* dev);
+    uint8_t flags;
+};
+
+struct AnsiCmdTable {
+    AnsiCmdDescriptor cmds[256];
+};
+
+// built at compile time in cmd.cpp, this is the one place commands
+// (including vendor commands) are registered.
+extern const AnsiCmdTable g_ansi_cmd_table;
+
+static inline const AnsiCmdDescriptor& command_descriptor(uint8_t cmd) {
+    return g_ansi_cmd_table.cmds[cmd];
+}
+
+// Execute the command in dev->cmd.  gates_active is whether read or write
+// gate is active, which makes most commands illegal.
+void ansi_execute_command(AnsiDev* dev, bool gates_active);
+
+// Apply the new geometry of Reformat Track commands whose revolution has
+// passed, once what was written with the old one has been flushed.  Called
+// by ansi_poll() with interrupts enabled.
+void ansi_poll_reformats();
 
 static inline bool command_is_param_out(uint8_t cmd) {
-    return (cmd & 0x40) != 0;
+    return (command_descriptor(cmd).flags & ANSI_CMD_PARAM_OUT) != 0;
 }
 static inline bool command_is_param_in(uint8_t cmd) {
-    return (cmd & 0x40) == 0;
+    return (command_descriptor(cmd).flags & ANSI_CMD_PARAM_OUT) == 0;
 }
 
 static inline bool command_is_time_dependent(uint8_t cmd) {
-    // there doesn't seem to be a nice bit check possible for this, so we just
-    // check for the specific command values from the spec.
-    return (cmd == ANSI_CMD_SPIN_CONTROL || cmd == ANSI_CMD_SEEK ||
-            cmd == ANSI_CMD_REZERO || cmd == ANSI_CMD_SET_ATTENTION ||
-            cmd == ANSI_CMD_REFORMAT_TRACK);
+    return (command_descriptor(cmd).flags & ANSI_CMD_TIME_DEPENDENT) != 0;
 }
@@ -0,0 +1,43 @@
+#include "crc.h"
+
+#define CRC_POLY 0x1021
+
+// table[k][b] is the CRC of byte b followed by k zero bytes, so the CRC of
+// 8 bytes is the xor of table[7 - i][byte i] once the CRC so far has been
+// folded into the first two.
+struct CrcTables {
+    uint16_t table[8][256];
+
+    constexpr CrcTables() : table() {
+        for (int b = 0; b < 256; b++) {
+            uint16_t crc = b << 8;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 0x8000) ? (crc << 1) ^ CRC_POLY : crc << 1;
+            }
+            table[0][b] = crc;
+        }
+        for (int k = 1; k < 8; k++) {
+            for (int b = 0; b < 256; b++) {
+                uint16_t prev = table[k - 1][b];
+                table[k][b] = (prev << 8) ^ table[0][prev >> 8];
+            }
+        }
+    }
+};
+
+// not const, so it is copied to DTCM rather than read from flash
+static CrcTables g_crc = CrcTables();
+
+uint16_t ansi_crc16(uint16_t crc, const uint8_t* data, uint32_t len) {
+    const uint16_t(*t)[256] = g_crc.table;
+
+    for (; len >= 8; len -= 8, data += 8) {
+        crc = t[7][data[0] ^ (crc >> 8)] ^ t[6][data[1] ^ (crc & 0xff)] ^
+              t[5][data[2]] ^ t[4][data[3]] ^ t[3][data[4]] ^ t[2][data[5]] ^
+              t[1][data[6]] ^ t[0][data[7]];
+    }
+    for (; len; len--, data++) {
+        crc = (crc << 8) ^ t[0][*data ^ (crc >> 8)];
+    }
+    return crc;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+
+// CRC-16/CCITT (polynomial 0x1021, msb first, initial value 0xffff, no final
+// xor) over the data field of a sector, sent msb first after the data.  The
+// CRC of the data followed by its CRC is 0, which is how written sectors are
+// checked.
+//
+// ansi_crc16() works 8 bytes at a time from slice-by-8 tables (4KB in DTCM),
+// a couple of cycles a byte, and takes the CRC so far so a sector can be done
+// in pieces as it arrives.
+
+#define ANSI_CRC_INIT 0xffff
+#define ANSI_CRC_BYTES 2
+
+uint16_t ansi_crc16(uint16_t crc, const uint8_t* data, uint32_t len);
+
+// the CRC as it goes on the wire
+static inline void ansi_crc16_store(uint16_t crc, uint8_t* out) {
+    out[0] = crc >> 8;
+    out[1] = crc & 0xff;
+}
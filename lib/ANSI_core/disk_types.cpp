@@ -1,5 +1,7 @@
 #include "disk_types.h"
 
+#include <strings.h>
+
 static AnsiDiskType PRIAM_7050 = {
     .name = "PRIAM_7050",
     .model_id = 0x105,
@@ -7,6 +9,12 @@ static AnsiDiskType PRIAM_7050 = {
     .heads = 5,
     .sectors = 12,
     .rpm = 3600,
+    .data_rate = 7500000,
+    // approximate figures for the Priam voice coil actuator
+    .seek_track_to_track_us = 8000,
+    .seek_average_us = 33000,
+    .seek_full_stroke_us = 60000,
+    .seek_settle_us = 2000,
 };
 
 static AnsiDiskType PRIAM_3450 = {
@@ -16,6 +24,12 @@ static AnsiDiskType PRIAM_3450 = {
     .heads = 5,
     .sectors = 12,
     .rpm = 3600,
+    .data_rate = 7500000,
+    // approximate figures for the Priam voice coil actuator
+    .seek_track_to_track_us = 8000,
+    .seek_average_us = 33000,
+    .seek_full_stroke_us = 60000,
+    .seek_settle_us = 2000,
 };
 
 const AnsiDiskType g_disk_types[] = {
@@ -23,4 +37,46 @@ const AnsiDiskType g_disk_types[] = {
     PRIAM_3450,
 };
 
-const int g_disk_type_count = sizeof(g_disk_types) / sizeof(g_disk_types[0]);
\ No newline at end of file
+const int g_disk_type_count = sizeof(g_disk_types) / sizeof(g_disk_types[0]);
+
+const AnsiDiskType* ansi_find_disk_type(const char* name) {
+    for (int i = 0; i < g_disk_type_count; i++) {
+        if (strcasecmp(g_disk_types[i].name, name) == 0) {
+            return &g_disk_types[i];
+        }
+    }
+    return nullptr;
+}
+
+// linear interpolation of y at x between (x0, y0) and (x1, y1)
+static uint32_t interpolate(uint32_t x, uint32_t x0, uint32_t x1, uint32_t y0,
+                            uint32_t y1) {
+    if (x1 <= x0) {
+        return y1;
+    }
+    return y0 + (uint64_t)(y1 - y0) * (x - x0) / (x1 - x0);
+}
+
+uint32_t ansi_seek_time_us(const AnsiDiskType* type, uint16_t from,
+                           uint16_t to) {
+    uint32_t distance = from > to ? from - to : to - from;
+    if (distance == 0) {
+        return 0;
+    }
+
+    uint32_t full_distance = type->cylinders - 1;
+    uint32_t average_distance = full_distance / 3;
+    uint32_t seek_us;
+
+    if (distance <= average_distance) {
+        seek_us = interpolate(distance, 1, average_distance,
+                              type->seek_track_to_track_us,
+                              type->seek_average_us);
+    } else {
+        seek_us = interpolate(distance, average_distance, full_distance,
+                              type->seek_average_us,
+                              type->seek_full_stroke_us);
+    }
+
+    return seek_us + type->seek_settle_us;
+}
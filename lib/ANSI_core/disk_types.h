@@ -2,8 +2,9 @@
 #pragma once
 
 #include <cstdint>
-// this really needs to be configurable but for now we're only trying to support
-// apollos.
+// The sector size the drives come formatted with (an apollo's), and the
+// largest one a Reformat Track can ask for.  Each type's unformatted track
+// holds `sectors` of these.
 #define HARD_DISK_SECTOR_SIZE 1056
 
 struct AnsiDiskType {
@@ -13,7 +14,24 @@ struct AnsiDiskType {
     uint8_t heads;
     uint16_t sectors;
     uint16_t rpm;
+    // NRZ data rate in bits per second, also the READ_REF_CLOCK frequency
+    uint32_t data_rate;
+
+    // seek profile, see ansi_seek_time_us()
+    uint32_t seek_track_to_track_us;
+    uint32_t seek_average_us; // over 1/3 of the cylinders
+    uint32_t seek_full_stroke_us;
+    uint32_t seek_settle_us;
 };
 
 extern const AnsiDiskType g_disk_types[];
-extern const int g_disk_type_count;
\ No newline at end of file
+extern const int g_disk_type_count;
+
+// look up a disk type by name (case insensitive), nullptr if unknown
+const AnsiDiskType* ansi_find_disk_type(const char* name);
+
+// Time to seek between two cylinders, interpolated piecewise linearly
+// between the track to track, average and full stroke times of the profile,
+// plus the head settle time.  A zero length seek takes no time.
+uint32_t ansi_seek_time_us(const AnsiDiskType* type, uint16_t from,
+                           uint16_t to);
@@ -0,0 +1,93 @@
+#include "latency.h"
+
+#include <cstring>
+
+#include "TANSI_log.h"
+#include "TANSI_platform.h"
+#include "ansi.h"
+
+static const char* phase_names[] = {
+    "SELECT_ACK",    "ATTENTION_POLL", "COMMAND_ACK",
+    "PARAM_OUT_ACK", "PARAM_IN_BYTE",
+};
+static_assert(sizeof(phase_names) / sizeof(phase_names[0]) ==
+                  ANSI_LATENCY_PHASE_COUNT,
+              "phase_names out of sync with AnsiLatencyPhase");
+
+static AnsiLatencyHistogram g_phase_latency[ANSI_LATENCY_PHASE_COUNT];
+static AnsiLatencyHistogram g_state_latency[ANSI_DEV_STATE_COUNT];
+PLATFORM_BULK_RAM static AnsiLatencyHistogram g_command_latency[256];
+
+void ansi_latency_record_phase(AnsiLatencyPhase phase, uint32_t cycles) {
+    ansi_latency_record(g_phase_latency[phase], cycles);
+}
+
+void ansi_latency_record_state(int state, uint32_t cycles) {
+    ansi_latency_record(g_state_latency[state], cycles);
+}
+
+void ansi_latency_record_command(uint8_t cmd, uint32_t cycles) {
+    ansi_latency_record(g_command_latency[cmd], cycles);
+}
+
+// upper bound in ns of the bucket holding the given fraction (in percent) of
+// the samples
+static int percentile_ns(const AnsiLatencyHistogram& h, int percent) {
+    uint32_t wanted = ((uint64_t)h.count * percent + 99) / 100;
+    uint32_t seen = 0;
+    for (int i = 0; i < ANSI_LATENCY_BUCKETS; i++) {
+        seen += h.buckets[i];
+        if (seen >= wanted) {
+            uint32_t bound = i == 31 ? h.max : (2u << i) - 1;
+            return platform_cycles_to_ns(bound < h.max ? bound : h.max);
+        }
+    }
+    return platform_cycles_to_ns(h.max);
+}
+
+static void dump_histogram(const char* kind, const char* name,
+                           const AnsiLatencyHistogram& live) {
+    // the ISR keeps recording while this formats
+    noInterrupts();
+    AnsiLatencyHistogram h = live;
+    interrupts();
+
+    if (h.count == 0) {
+        return;
+    }
+
+    logmsg("ANSI latency ", kind, " ", name, ": n=", (int)h.count,
+           " min=", (int)platform_cycles_to_ns(h.min),
+           "ns p50<=", percentile_ns(h, 50), "ns p90<=", percentile_ns(h, 90),
+           "ns p99<=", percentile_ns(h, 99),
+           "ns max=", (int)platform_cycles_to_ns(h.max), "ns");
+
+    for (int i = 0; i < ANSI_LATENCY_BUCKETS - 1; i++) {
+        if (h.buckets[i]) {
+            logmsg("    <", (int)platform_cycles_to_ns(2u << i),
+                   "ns: ", (int)h.buckets[i]);
+        }
+    }
+}
+
+void ansi_latency_dump() {
+    for (int i = 0; i < ANSI_LATENCY_PHASE_COUNT; i++) {
+        dump_histogram("phase", phase_names[i], g_phase_latency[i]);
+    }
+    for (int i = 0; i < ANSI_DEV_STATE_COUNT; i++) {
+        dump_histogram("state", ansi_state_name(i), g_state_latency[i]);
+    }
+    for (int i = 0; i < 256; i++) {
+        const char* name = command_descriptor(i).name;
+        dump_histogram("command", name ? name : "unknown",
+                       g_command_latency[i]);
+    }
+}
+
+void ansi_latency_reset() {
+    noInterrupts();
+    memset(g_phase_latency, 0, sizeof(g_phase_latency));
+    memset(g_state_latency, 0, sizeof(g_state_latency));
+    memset(g_command_latency, 0, sizeof(g_command_latency));
+    interrupts();
+}
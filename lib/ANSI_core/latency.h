@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+
+// Latency histograms in cycles of the DWT cycle counter.  Bucket n counts
+// latencies in [2^n, 2^(n+1)) cycles (bucket 0 also holds 0), which is
+// coarse but takes a handful of cycles to record, so it can stay on in the
+// bus ISR.  Percentiles are reported as the upper bound of their bucket.
+
+#define ANSI_LATENCY_BUCKETS 32
+
+struct AnsiLatencyHistogram {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint32_t buckets[ANSI_LATENCY_BUCKETS];
+};
+
+// handshake phases, measured from the pin change the host made (the ISR
+// entry in interrupt-driven mode, the pin sample when polling) to the
+// device's response.
+enum AnsiLatencyPhase {
+    ANSI_LATENCY_SELECT_ACK,     // select out strobe -> BUS_ACKNOWLEDGE
+    ANSI_LATENCY_ATTENTION_POLL, // attn in strobe -> attention byte driven
+    ANSI_LATENCY_COMMAND_ACK,    // COMMAND_REQUEST -> BUS_ACKNOWLEDGE
+    ANSI_LATENCY_PARAM_OUT_ACK,  // PARAMETER_REQUEST -> BUS_ACKNOWLEDGE
+    ANSI_LATENCY_PARAM_IN_BYTE,  // PARAMETER_REQUEST -> param byte driven
+    ANSI_LATENCY_PHASE_COUNT
+};
+
+static inline void ansi_latency_record(AnsiLatencyHistogram& h,
+                                       uint32_t cycles) {
+    h.buckets[31 - __builtin_clz(cycles | 1)]++;
+    if (h.count == 0 || cycles < h.min) {
+        h.min = cycles;
+    }
+    if (cycles > h.max) {
+        h.max = cycles;
+    }
+    h.count++;
+}
+
+void ansi_latency_record_phase(AnsiLatencyPhase phase, uint32_t cycles);
+// time from the host's pin change to a transition out of `state`
+void ansi_latency_record_state(int state, uint32_t cycles);
+// time spent executing command `cmd`
+void ansi_latency_record_command(uint8_t cmd, uint32_t cycles);
+
+// Write every non-empty histogram to the log.
+void ansi_latency_dump();
+void ansi_latency_reset();
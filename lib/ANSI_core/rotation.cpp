@@ -0,0 +1,99 @@
+#include "rotation.h"
+
+#include "TANSI_log.h"
+#include "TANSI_platform.h"
+
+// INDEX and SECTOR_MARK are active for this long
+#define ANSI_ROTATION_PULSE_NS 1000
+
+static const AnsiDiskType* g_rotation_type;
+static uint16_t g_rotation_sectors;
+static uint32_t g_rotation_revolution_us;
+
+static volatile uint8_t g_rotation_sector;
+// cycle count at the start of g_rotation_sector
+static volatile uint32_t g_rotation_sector_cycles;
+static volatile bool g_rotation_gated;
+
+static void ansi_rotation_isr() {
+    uint32_t cycles = platform_cycle_count();
+    uint8_t sector = g_rotation_sector + 1;
+    if (sector == g_rotation_sectors) {
+        sector = 0;
+    }
+    g_rotation_sector = sector;
+    g_rotation_sector_cycles = cycles;
+
+    if (!g_rotation_gated) {
+        return;
+    }
+
+    // pulses are too short to be worth another timer interrupt to end them
+    uint32_t pulse_cycles =
+        ANSI_ROTATION_PULSE_NS * platform_cycles_per_us() / 1000;
+    if (sector == 0) {
+        SET_ACTIVE(INDEX);
+        while (platform_cycle_count() - cycles < pulse_cycles) {
+        }
+        SET_INACTIVE(INDEX);
+    } else {
+        SET_ACTIVE(SECTOR_MARK);
+        while (platform_cycle_count() - cycles < pulse_cycles) {
+        }
+        SET_INACTIVE(SECTOR_MARK);
+    }
+}
+
+void ansi_rotation_start(const AnsiDiskType* type) {
+    if (g_rotation_type) {
+        if (type->rpm != g_rotation_type->rpm) {
+            logmsg("ANSI WARNING: ", type->name, " shares the rotation of ",
+                   g_rotation_type->name,
+                   ", sector timing will be off for it");
+        }
+        return;
+    }
+
+    g_rotation_type = type;
+    g_rotation_revolution_us = 60000000 / type->rpm;
+    ansi_rotation_set_sectors(type->sectors);
+}
+
+void ansi_rotation_set_sectors(uint16_t sectors) {
+    if (!g_rotation_type || sectors == g_rotation_sectors) {
+        return;
+    }
+
+    uint32_t irq = platform_disable_interrupts();
+    g_rotation_sectors = sectors;
+    g_rotation_sector = 0;
+    g_rotation_sector_cycles = platform_cycle_count();
+    platform_restore_interrupts(irq);
+
+    // starting the timer again restarts the period
+    platform_start_rotation_timer(
+        (float)g_rotation_revolution_us / g_rotation_sectors,
+        ansi_rotation_isr);
+}
+
+void ansi_rotation_stop() {
+    platform_stop_rotation_timer();
+    g_rotation_type = nullptr;
+    g_rotation_sectors = 0;
+    g_rotation_gated = false;
+    SET_INACTIVE(INDEX);
+    SET_INACTIVE(SECTOR_MARK);
+}
+
+void ansi_rotation_gate(bool enabled) { g_rotation_gated = enabled; }
+
+uint8_t ansi_rotation_sector() { return g_rotation_sector; }
+
+uint32_t ansi_rotation_sector_offset_us() {
+    return (platform_cycle_count() - g_rotation_sector_cycles) /
+           platform_cycles_per_us();
+}
+
+uint16_t ansi_rotation_sectors() { return g_rotation_sectors; }
+
+uint32_t ansi_rotation_revolution_us() { return g_rotation_revolution_us; }
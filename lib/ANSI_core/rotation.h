@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+
+#include "disk_types.h"
+
+// Rotational position model.  The spindle turns at the disk type's rpm, and
+// a periodic timer interrupt at every sector boundary advances the sector
+// under the heads and pulses INDEX (at sector 0) or SECTOR_MARK (at every
+// other sector) while a device is selected.
+//
+// The timing is only as good as the interrupt's latency.  It runs at the
+// same priority as the control bus interrupt, so neither preempts the other:
+// a pulse waits behind a command the bus interrupt is handling, and behind
+// every stretch of the main loop with interrupts off (the schedule's
+// callbacks, copying a loaded track into the cylinder cache).  That puts its
+// jitter well above a microsecond.  The pulse is ended by spinning in the
+// interrupt, which in turn holds off a BUS_ACKNOWLEDGE for as long.
+//
+// All emulated drives share the one spindle, which is started with the type
+// of the first configured device.  Its sector pulses follow the geometry of
+// whichever device is selected.
+
+void ansi_rotation_start(const AnsiDiskType* type);
+void ansi_rotation_stop();
+
+// Reformat the spindle into `sectors` sector pulses a revolution, done by
+// ansi_poll() when a device with another geometry is selected.  Restarts
+// the rotation timer, so not from an interrupt.
+void ansi_rotation_set_sectors(uint16_t sectors);
+
+// drive INDEX and SECTOR_MARK, only done while a device is selected
+void ansi_rotation_gate(bool enabled);
+
+// the sector passing under the heads
+uint8_t ansi_rotation_sector();
+
+// microseconds since the start of the sector under the heads
+uint32_t ansi_rotation_sector_offset_us();
+
+// sectors and length of a revolution of the running spindle
+uint16_t ansi_rotation_sectors();
+uint32_t ansi_rotation_revolution_us();
@@ -0,0 +1,122 @@
+#include "schedule.h"
+
+#include "TANSI_platform.h"
+#include "ansi.h"
+
+struct ScheduledOp {
+    uint32_t deadline_us;
+    uint8_t id;
+};
+
+// binary min-heap ordered by deadline, plus each device's position in it (or
+// -1) so an operation can be replaced or cancelled without a search.
+static ScheduledOp g_heap[ANSI_MAX_DEVICES];
+static int g_heap_size;
+static int8_t g_heap_index[ANSI_MAX_DEVICES] = {-1, -1, -1, -1,
+                                                -1, -1, -1, -1};
+static AnsiScheduleCallback g_callbacks[ANSI_MAX_DEVICES];
+
+// micros() wraps every ~71 minutes, so deadlines are compared by the sign of
+// their difference rather than by value.
+static inline bool before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+static void heap_set(int i, const ScheduledOp& op) {
+    g_heap[i] = op;
+    g_heap_index[op.id] = i;
+}
+
+static void sift_up(int i) {
+    ScheduledOp op = g_heap[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!before(op.deadline_us, g_heap[parent].deadline_us)) {
+            break;
+        }
+        heap_set(i, g_heap[parent]);
+        i = parent;
+    }
+    heap_set(i, op);
+}
+
+static void sift_down(int i) {
+    ScheduledOp op = g_heap[i];
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= g_heap_size) {
+            break;
+        }
+        if (child + 1 < g_heap_size &&
+            before(g_heap[child + 1].deadline_us, g_heap[child].deadline_us)) {
+            child++;
+        }
+        if (!before(g_heap[child].deadline_us, op.deadline_us)) {
+            break;
+        }
+        heap_set(i, g_heap[child]);
+        i = child;
+    }
+    heap_set(i, op);
+}
+
+static void heap_remove(int i) {
+    g_heap_index[g_heap[i].id] = -1;
+    g_heap_size--;
+    if (i == g_heap_size) {
+        return;
+    }
+    ScheduledOp last = g_heap[g_heap_size];
+    heap_set(i, last);
+    sift_down(i);
+    sift_up(g_heap_index[last.id]);
+}
+
+static void set_deadline(uint8_t id, uint32_t deadline_us) {
+    int i = g_heap_index[id];
+    if (i < 0) {
+        i = g_heap_size++;
+    }
+    heap_set(i, ScheduledOp{deadline_us, id});
+    sift_down(i);
+    sift_up(g_heap_index[id]);
+}
+
+void ansi_schedule(AnsiDev* dev, uint32_t delay_us,
+                   AnsiScheduleCallback callback) {
+    g_callbacks[dev->id] = callback;
+    set_deadline(dev->id, micros() + delay_us);
+}
+
+void ansi_schedule_cancel(AnsiDev* dev) {
+    int i = g_heap_index[dev->id];
+    if (i >= 0) {
+        heap_remove(i);
+    }
+}
+
+bool ansi_schedule_pending(AnsiDev* dev) { return g_heap_index[dev->id] >= 0; }
+
+void ansi_schedule_reset() {
+    for (int i = 0; i < ANSI_MAX_DEVICES; i++) {
+        g_heap_index[i] = -1;
+    }
+    g_heap_size = 0;
+}
+
+int ansi_schedule_run(uint32_t now_us) {
+    int count = 0;
+
+    while (g_heap_size > 0 && !before(now_us, g_heap[0].deadline_us)) {
+        uint8_t id = g_heap[0].id;
+        heap_remove(0);
+        // the callback may schedule the device again, so it runs after the
+        // entry is gone.
+        if (g_callbacks[id]) {
+            g_callbacks[id](&gAnsiDevs[id]);
+        }
+        count++;
+    }
+
+    return count;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+struct AnsiDev;
+
+// Deadline scheduler for the completion of time dependent commands.  Each
+// device has at most one pending operation (ANSI devices execute one time
+// dependent command at a time), and pending operations of different devices
+// run concurrently, so the host can overlap seeks across drives.
+//
+// Deadlines are absolute micros() values kept in a min-heap, so finding the
+// next expiring operation is O(1) and scheduling/completing is O(log n).
+
+typedef void (*AnsiScheduleCallback)(AnsiDev* dev);
+
+// Schedule callback(dev) to run delay_us from now.  Replaces any operation
+// already pending for the device.
+void ansi_schedule(AnsiDev* dev, uint32_t delay_us,
+                   AnsiScheduleCallback callback);
+
+void ansi_schedule_cancel(AnsiDev* dev);
+bool ansi_schedule_pending(AnsiDev* dev);
+
+// Drop every pending operation.
+void ansi_schedule_reset();
+
+// Run the callbacks of all operations whose deadline is at or before now_us,
+// in deadline order.  Returns the number of callbacks run.
+int ansi_schedule_run(uint32_t now_us);
@@ -0,0 +1,83 @@
+#include "sector_format.h"
+
+#include <cstring>
+
+#include "TANSI_log.h"
+#include "TANSI_platform.h"
+#include "ansi.h"
+
+// the read data engine shifts these out, so they stay put in the OCRAM
+PLATFORM_BULK_RAM static AnsiSectorFormat g_sector_formats[ANSI_MAX_DEVICES];
+
+// count bytes of pattern at out, returns the byte after them
+static uint8_t* fill_pattern(uint8_t* out, uint8_t count, uint8_t pattern) {
+    memset(out, pattern, count);
+    return out + count;
+}
+
+// a zero byte, then a byte with its top bit set
+#define DEFAULT_SYNC_PATTERN 0x0080
+#define DEFAULT_SYNC_MASK 0xff80
+
+static void compile(AnsiDev* dev, AnsiSectorFormat* format) {
+    const uint8_t* attributes = dev->attributes;
+
+    uint32_t data_bytes =
+        (attributes[0x13] << 16) | (attributes[0x14] << 8) | attributes[0x15];
+    if (data_bytes == 0 || data_bytes > dev->sector_bytes) {
+        data_bytes = dev->sector_bytes;
+    }
+    format->data_bytes = data_bytes;
+
+    uint8_t* out = format->header;
+    uint8_t preamble_bytes = attributes[0x31];
+    if (preamble_bytes) {
+        out = fill_pattern(out, preamble_bytes, attributes[0x32]);
+        // the sync byte is what the reader aligns on, so it only comes
+        // with a preamble
+        *out++ = attributes[0x33];
+        format->sync_pattern = (attributes[0x32] << 8) | attributes[0x33];
+        format->sync_mask = 0xffff;
+    } else {
+        format->sync_pattern = DEFAULT_SYNC_PATTERN;
+        format->sync_mask = DEFAULT_SYNC_MASK;
+    }
+    format->header_bytes = out - format->header;
+
+    out = format->trailer;
+    out = fill_pattern(out, attributes[0x34], attributes[0x35]);
+    out = fill_pattern(out, attributes[0x36], attributes[0x37]);
+    format->trailer_bytes = out - format->trailer;
+
+    format->compiled = true;
+    dev->attributes[0x0E] &= ~ATTR_TABLE_MODIFIED;
+
+    dbgmsg("ANSI", dev->id, " sector format: ", (int)format->header_bytes,
+           " header, ", (int)format->data_bytes, " data, ",
+           (int)format->trailer_bytes, " trailer bytes");
+}
+
+const AnsiSectorFormat* ansi_sector_format(AnsiDev* dev) {
+    AnsiSectorFormat* format = &g_sector_formats[dev->id];
+    if (!dev->attributes_initialized) {
+        // the default table, until the host loads or reports an attribute
+        if (!format->compiled) {
+            format->data_bytes = dev->sector_bytes;
+            format->header_bytes = 0;
+            format->trailer_bytes = 0;
+            format->sync_pattern = DEFAULT_SYNC_PATTERN;
+            format->sync_mask = DEFAULT_SYNC_MASK;
+            format->compiled = true;
+        }
+        return format;
+    }
+
+    if (!format->compiled || (dev->attributes[0x0E] & ATTR_TABLE_MODIFIED)) {
+        compile(dev, format);
+    }
+    return format;
+}
+
+void ansi_sector_format_invalidate(AnsiDev* dev) {
+    g_sector_formats[dev->id].compiled = false;
+}
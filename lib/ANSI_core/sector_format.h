@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+
+#include "disk_types.h"
+
+struct AnsiDev;
+
+// Sector framing compiled from the encoding #1 attributes (0x30-0x37) and
+// the bytes per sector (0x13-0x15).  The read data engine shifts out the
+// header, the sector's data and the trailer back to back, so the framing is
+// built once per attribute table rather than for every sector read.
+//
+// An attribute table that is all zeros (the default) compiles to no framing,
+// just the data.
+
+// a count byte's worth of pattern, plus the sync byte
+#define SECTOR_FORMAT_MAX_HEADER (255 + 1)
+// postamble and gap
+#define SECTOR_FORMAT_MAX_TRAILER (255 + 255)
+
+struct AnsiSectorFormat {
+    bool compiled;
+    // bytes of data from the sector, at most the device's sector_bytes
+    uint16_t data_bytes;
+    uint16_t header_bytes;
+    uint16_t trailer_bytes;
+    uint8_t header[SECTOR_FORMAT_MAX_HEADER];  // preamble, sync
+    uint8_t trailer[SECTOR_FORMAT_MAX_TRAILER]; // postamble, gap
+    // What the write data capture hunts for ahead of the data: the last
+    // preamble byte and the sync byte, msb first, in the bits of sync_mask.
+    // Without a compiled header the host's own preamble is taken to be
+    // zeros and its sync byte to start with a 1 bit.
+    uint16_t sync_pattern;
+    uint16_t sync_mask;
+};
+
+// The device's sector format, compiled again first if the host has loaded
+// attributes since (attribute 0x0E's ATTR_TABLE_MODIFIED bit) or the device
+// was reset.
+const AnsiSectorFormat* ansi_sector_format(AnsiDev* dev);
+
+// forget the compiled format, the attributes went back to their defaults
+void ansi_sector_format_invalidate(AnsiDev* dev);
@@ -0,0 +1,46 @@
+#include "trace.h"
+
+PLATFORM_BULK_RAM AnsiTraceEvent g_ansi_trace_events[ANSI_TRACE_EVENTS];
+volatile bool g_ansi_trace_enabled;
+uint32_t g_ansi_trace_head;
+// head value at which recording stops, 0 if not triggered
+uint32_t g_ansi_trace_stop_at;
+int g_ansi_trace_trigger_command = -1;
+// last pin sample recorded (bit 15 is never set in a sample, so a restarted
+// trace always begins with the current pins)
+uint16_t g_ansi_trace_pins = 0xffff;
+
+void ansi_trace_trigger() {
+    if (g_ansi_trace_stop_at || !g_ansi_trace_enabled) {
+        return;
+    }
+
+    ansi_trace(ANSI_TRACE_TRIGGER, 0, 0);
+    g_ansi_trace_stop_at = g_ansi_trace_head + ANSI_TRACE_POST_TRIGGER_EVENTS;
+}
+
+void ansi_trace_start(int trigger_command) {
+    noInterrupts();
+    g_ansi_trace_head = 0;
+    g_ansi_trace_stop_at = 0;
+    g_ansi_trace_trigger_command = trigger_command;
+    g_ansi_trace_pins = 0xffff;
+    g_ansi_trace_enabled = true;
+    interrupts();
+}
+
+void ansi_trace_stop() { g_ansi_trace_enabled = false; }
+
+bool ansi_trace_capture_ready() {
+    return g_ansi_trace_stop_at && !g_ansi_trace_enabled;
+}
+
+uint32_t ansi_trace_count() {
+    return g_ansi_trace_head < ANSI_TRACE_EVENTS ? g_ansi_trace_head
+                                                 : ANSI_TRACE_EVENTS;
+}
+
+const AnsiTraceEvent& ansi_trace_event(uint32_t index) {
+    uint32_t first = g_ansi_trace_head - ansi_trace_count();
+    return g_ansi_trace_events[(first + index) & (ANSI_TRACE_EVENTS - 1)];
+}
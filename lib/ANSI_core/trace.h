@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+
+#include "TANSI_platform.h"
+
+// Binary protocol trace.  Events are recorded into a fixed ring with the
+// cycle counter as timestamp, at a few cycles per event, so tracing can stay
+// on without changing the bus timing it observes.  The ring is exported as a
+// VCD file by the firmware (src/TANSI_vcd.cpp).
+//
+// Recording is not locked: every event comes either from the state machine
+// (ISR or ansi_poll()) or from code that runs with interrupts disabled, so
+// writers never preempt each other.
+
+enum AnsiTraceType : uint8_t {
+    ANSI_TRACE_PINS,      // data = AnsiOutPins.raw (raw pin levels)
+    ANSI_TRACE_STATE,     // data = the device's new AnsiDevState
+    ANSI_TRACE_COMMAND,   // data = command byte
+    ANSI_TRACE_PARAM_OUT, // data = parameter byte from the host
+    ANSI_TRACE_PARAM_IN,  // data = parameter byte to the host
+    ANSI_TRACE_ATTENTION, // data = attention condition of every device
+    ANSI_TRACE_TRIGGER,   // data = unused
+};
+
+struct AnsiTraceEvent {
+    uint32_t cycles;
+    uint8_t type;
+    uint8_t dev;
+    uint16_t data;
+};
+
+// must be a power of two
+#define ANSI_TRACE_EVENTS 4096
+
+// once triggered, this many more events are recorded before the ring stops,
+// so the capture is centered on the trigger.
+#define ANSI_TRACE_POST_TRIGGER_EVENTS (ANSI_TRACE_EVENTS / 2)
+
+extern AnsiTraceEvent g_ansi_trace_events[ANSI_TRACE_EVENTS];
+extern volatile bool g_ansi_trace_enabled;
+extern uint32_t g_ansi_trace_head;
+extern uint32_t g_ansi_trace_stop_at;
+extern int g_ansi_trace_trigger_command;
+extern uint16_t g_ansi_trace_pins;
+
+static inline void ansi_trace(AnsiTraceType type, uint8_t dev, uint16_t data) {
+    if (!g_ansi_trace_enabled) {
+        return;
+    }
+
+    AnsiTraceEvent& e =
+        g_ansi_trace_events[g_ansi_trace_head++ & (ANSI_TRACE_EVENTS - 1)];
+    e.cycles = platform_cycle_count();
+    e.type = type;
+    e.dev = dev;
+    e.data = data;
+
+    if (g_ansi_trace_head == g_ansi_trace_stop_at) {
+        g_ansi_trace_enabled = false;
+    }
+}
+
+// the pins are sampled far more often than they change, so only changes are
+// recorded.
+static inline void ansi_trace_pins(uint16_t raw) {
+    if (raw != g_ansi_trace_pins) {
+        g_ansi_trace_pins = raw;
+        ansi_trace(ANSI_TRACE_PINS, 0, raw);
+    }
+}
+
+void ansi_trace_trigger();
+
+static inline void ansi_trace_command(uint8_t dev, uint8_t cmd) {
+    ansi_trace(ANSI_TRACE_COMMAND, dev, cmd);
+    if (cmd == g_ansi_trace_trigger_command) {
+        ansi_trace_trigger();
+    }
+}
+
+// Clear the ring and start recording.  trigger_command is the command byte
+// that triggers the capture, or -1 to record until ansi_trace_stop().
+void ansi_trace_start(int trigger_command);
+void ansi_trace_stop();
+
+// true once a triggered capture has recorded its post-trigger events
+bool ansi_trace_capture_ready();
+
+// Events currently in the ring, oldest first.  Only valid while stopped.
+uint32_t ansi_trace_count();
+const AnsiTraceEvent& ansi_trace_event(uint32_t index);
@@ -0,0 +1,52 @@
+// GPIO definitions for the native (Linux) build.  The pin numbers are the
+// Teensy 4.1 ones, they only index the simulated pin levels here.
+
+#pragma once
+
+#include <cstdint>
+
+// ANSI control bus
+#define ANSI_CB0 0
+#define ANSI_CB2 1
+#define ANSI_CB4 2
+#define ANSI_CB6 3
+#define ANSI_CB1 4
+#define ANSI_CB3 5
+#define ANSI_CB5 6
+#define ANSI_CB7 7
+
+// unidirectional single ended source = host
+#define ANSI_SELECT_OUT_ATTN_IN_STROBE 27
+#define ANSI_COMMAND_REQUEST 28
+#define ANSI_PARAMETER_REQUEST 29
+#define ANSI_BUS_DIRECTION_OUT 30
+#define ANSI_READ_GATE 31
+#define ANSI_WRITE_GATE 32
+
+// unidirectional single ended source = device
+#define ANSI_BUS_ACKNOWLEDGE 33
+#define ANSI_INDEX 34
+#define ANSI_SECTOR_MARK 35
+#define ANSI_ATTENTION 36
+#define ANSI_BUSY 37
+
+#define ANSI_PORT_ENABLE 41
+
+// the NRZ lines are modelled as byte streams, see TANSI_sim.h
+#define ANSI_READ_DATA 14
+#define ANSI_READ_REF_CLOCK 15
+#define ANSI_WRITE_CLOCK 16
+#define ANSI_WRITE_DATA 17
+
+#define PLATFORM_SIM_PIN_COUNT 42
+
+// Levels of the device driven pins, 1 = high (inactive).
+extern volatile uint8_t g_platform_sim_pins[PLATFORM_SIM_PIN_COUNT];
+
+#define LED_ON()
+#define LED_OFF()
+
+#define SET_BOOL(pinName, value)                                               \
+    (g_platform_sim_pins[ANSI_##pinName] = (value) ? 0 : 1)
+#define SET_ACTIVE(pinName) g_platform_sim_pins[ANSI_##pinName] = 0;
+#define SET_INACTIVE(pinName) g_platform_sim_pins[ANSI_##pinName] = 1
@@ -0,0 +1,318 @@
+#include "TANSI_log.h"
+#include "TANSI_platform.h"
+#include "TANSI_sim.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <poll.h>
+#include <thread>
+#include <unistd.h>
+
+const char* g_platform_name = PLATFORM_NAME;
+
+volatile uint8_t g_platform_sim_pins[PLATFORM_SIM_PIN_COUNT];
+
+// Host driven pins in the order of the bits of platform_sample_ansi_pins(),
+// which is also the order of the AnsiOutPins bitfields in ansi.h.
+static const uint8_t g_sample_pins[] = {
+    ANSI_CB0,
+    ANSI_CB1,
+    ANSI_CB2,
+    ANSI_CB3,
+    ANSI_CB4,
+    ANSI_CB5,
+    ANSI_CB6,
+    ANSI_CB7,
+    ANSI_SELECT_OUT_ATTN_IN_STROBE,
+    ANSI_COMMAND_REQUEST,
+    ANSI_PARAMETER_REQUEST,
+    ANSI_BUS_DIRECTION_OUT,
+    ANSI_PORT_ENABLE,
+    ANSI_READ_GATE,
+    ANSI_WRITE_GATE,
+};
+
+#define SAMPLE_PIN_COUNT (sizeof(g_sample_pins) / sizeof(g_sample_pins[0]))
+#define SAMPLE_PINS_MASK ((1u << SAMPLE_PIN_COUNT) - 1)
+#define SAMPLE_CONTROL_BUS_MASK 0xff
+
+static std::atomic<uint16_t> g_host_pins{SAMPLE_PINS_MASK};
+static std::atomic<bool> g_device_drives_control_bus;
+static std::atomic<uint8_t> g_control_bus_byte;
+
+// Interrupts.  Whoever runs an "interrupt" or disables them holds the lock;
+// inside an interrupt noInterrupts() and interrupts() do nothing, since
+// neither of ours can preempt the other.
+static std::mutex g_interrupt_lock;
+static thread_local bool t_interrupts_disabled;
+static thread_local bool t_in_interrupt;
+
+static void run_interrupt(void (*isr)()) {
+    bool was_disabled = t_interrupts_disabled;
+    if (!was_disabled) {
+        g_interrupt_lock.lock();
+    }
+    t_in_interrupt = true;
+    isr();
+    t_in_interrupt = false;
+    if (!was_disabled) {
+        g_interrupt_lock.unlock();
+    }
+}
+
+void noInterrupts() {
+    if (!t_in_interrupt && !t_interrupts_disabled) {
+        g_interrupt_lock.lock();
+        t_interrupts_disabled = true;
+    }
+}
+
+void interrupts() {
+    if (!t_in_interrupt && t_interrupts_disabled) {
+        t_interrupts_disabled = false;
+        g_interrupt_lock.unlock();
+    }
+}
+
+uint32_t platform_disable_interrupts() {
+    uint32_t disabled = t_in_interrupt || t_interrupts_disabled;
+    noInterrupts();
+    return disabled;
+}
+
+void platform_restore_interrupts(uint32_t state) {
+    if (!state) {
+        interrupts();
+    }
+}
+
+static const auto g_start_time = std::chrono::steady_clock::now();
+
+uint32_t micros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - g_start_time)
+        .count();
+}
+
+uint32_t millis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now() - g_start_time)
+        .count();
+}
+
+void platform_init() {
+    for (uint32_t pin = 0; pin < PLATFORM_SIM_PIN_COUNT; pin++) {
+        g_platform_sim_pins[pin] = 1;
+    }
+    platform_set_control_bus_direction(CONTROL_BUS_OUT);
+}
+
+void platform_late_init() {
+    logmsg("Platform: ", g_platform_name);
+    logmsg("FW Version: ", g_log_firmwareversion);
+}
+
+void platform_post_sd_card_init() {}
+
+void platform_disable_led(void) {}
+
+void platform_log(const char* s) { fputs(s, stdout); }
+
+int platform_console_getc() {
+    struct pollfd fd = {STDIN_FILENO, POLLIN, 0};
+    unsigned char c;
+    if (poll(&fd, 1, 0) == 1 && read(STDIN_FILENO, &c, 1) == 1) {
+        return c;
+    }
+    return -1;
+}
+
+void platform_poll() { fflush(stdout); }
+
+void platform_set_sd_wait_hook(void (*)()) {}
+
+void platform_emergency_log_save() { fflush(stdout); }
+
+void* platform_alloc_bulk(size_t size) { return malloc(size); }
+
+void platform_free_bulk(void* buffer) { free(buffer); }
+
+size_t platform_external_ram_size() { return 0; }
+
+uint8_t platform_sim_read_pin(uint8_t pin) {
+    uint16_t pins = platform_sim_sample_pins();
+    for (uint32_t i = 0; i < SAMPLE_PIN_COUNT; i++) {
+        if (g_sample_pins[i] == pin) {
+            return (pins >> i) & 1;
+        }
+    }
+    return pin < PLATFORM_SIM_PIN_COUNT ? g_platform_sim_pins[pin] : 1;
+}
+
+uint16_t platform_sim_sample_pins() {
+    uint16_t pins = g_host_pins;
+    if (g_device_drives_control_bus) {
+        // the bus is active low
+        pins = (pins & ~SAMPLE_CONTROL_BUS_MASK) |
+               (uint8_t)~g_control_bus_byte.load();
+    }
+    return pins;
+}
+
+// Control bus
+
+static void (*g_control_bus_isr)();
+
+void platform_set_control_bus_direction(ControlBusDirection direction) {
+    g_device_drives_control_bus = direction == CONTROL_BUS_IN;
+}
+
+void platform_write_control_bus_byte(uint8_t v) { g_control_bus_byte = v; }
+
+void platform_attach_control_bus_interrupt(void (*isr)()) {
+    g_control_bus_isr = isr;
+}
+
+void platform_detach_control_bus_interrupt() { g_control_bus_isr = nullptr; }
+
+void platform_sim_set_host_pins(uint16_t pins) {
+    pins &= SAMPLE_PINS_MASK;
+    if (g_host_pins.exchange(pins) == pins) {
+        return;
+    }
+
+    void (*isr)() = g_control_bus_isr;
+    if (isr) {
+        run_interrupt(isr);
+    }
+}
+
+uint16_t platform_sim_host_pins() { return g_host_pins; }
+
+bool platform_sim_device_drives_control_bus() {
+    return g_device_drives_control_bus;
+}
+
+uint8_t platform_sim_control_bus_byte() { return g_control_bus_byte; }
+
+// Rotation timer.  Every start gets a thread of its own, which exits once a
+// later start or a stop has bumped the generation.  Nothing waits for it,
+// since the timer is stopped and restarted from the interrupts themselves.
+
+static std::atomic<uint32_t> g_rotation_generation;
+
+static void rotation_thread(uint32_t generation, float period_us,
+                            void (*isr)()) {
+    auto period = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::duration<float, std::micro>(period_us));
+    auto next = std::chrono::steady_clock::now();
+    while (true) {
+        next += period;
+        std::this_thread::sleep_until(next);
+
+        std::lock_guard<std::mutex> lock(g_interrupt_lock);
+        if (g_rotation_generation != generation) {
+            return;
+        }
+        t_in_interrupt = true;
+        isr();
+        t_in_interrupt = false;
+    }
+}
+
+void platform_start_rotation_timer(float period_us, void (*isr)()) {
+    uint32_t generation = ++g_rotation_generation;
+    std::thread(rotation_thread, generation, period_us, isr).detach();
+}
+
+void platform_stop_rotation_timer() { ++g_rotation_generation; }
+
+// Read data engine
+
+#define READ_DATA_FIFO_SIZE 65536 // power of two
+
+static uint8_t g_read_fifo[READ_DATA_FIFO_SIZE];
+static std::atomic<uint32_t> g_read_fifo_head; // next byte the host takes
+static std::atomic<uint32_t> g_read_fifo_tail; // next free byte
+static uint32_t g_read_bit_rate;
+
+void platform_read_data_start(uint32_t bit_rate) { g_read_bit_rate = bit_rate; }
+
+void platform_read_data_stop() {
+    g_read_bit_rate = 0;
+    platform_read_data_flush();
+}
+
+bool platform_read_data_queue(const uint8_t* data, uint32_t len) {
+    if (!g_read_bit_rate) {
+        return true;
+    }
+    uint32_t tail = g_read_fifo_tail;
+    if (len > READ_DATA_FIFO_SIZE - (tail - g_read_fifo_head)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        g_read_fifo[(tail + i) & (READ_DATA_FIFO_SIZE - 1)] = data[i];
+    }
+    g_read_fifo_tail = tail + len;
+    return true;
+}
+
+int platform_read_data_pending() { return 0; }
+
+void platform_read_data_flush() { g_read_fifo_head = g_read_fifo_tail.load(); }
+
+uint32_t platform_read_data_underruns() { return 0; }
+
+uint32_t platform_sim_read_data_available() {
+    return g_read_fifo_tail - g_read_fifo_head;
+}
+
+uint32_t platform_sim_read_data(uint8_t* data, uint32_t len) {
+    uint32_t head = g_read_fifo_head;
+    uint32_t available = g_read_fifo_tail - head;
+    if (len > available) {
+        len = available;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        data[i] = g_read_fifo[(head + i) & (READ_DATA_FIFO_SIZE - 1)];
+    }
+    g_read_fifo_head = head + len;
+    return len;
+}
+
+// Write data capture
+
+static uint8_t* g_write_buffer;
+static uint32_t g_write_len;
+static std::atomic<uint32_t> g_write_captured;
+
+void platform_write_data_start(uint8_t* buffer, uint32_t len, uint16_t,
+                               uint16_t) {
+    g_write_buffer = buffer;
+    g_write_len = len;
+    g_write_captured = 0;
+}
+
+void platform_write_data_stop() { g_write_buffer = nullptr; }
+
+uint32_t platform_write_data_captured() { return g_write_captured; }
+
+uint32_t platform_write_data_overruns() { return 0; }
+
+void platform_sim_write_data(const uint8_t* data, uint32_t len) {
+    noInterrupts();
+    if (g_write_buffer) {
+        uint32_t captured = g_write_captured;
+        if (len > g_write_len - captured) {
+            len = g_write_len - captured;
+        }
+        memcpy(g_write_buffer + captured, data, len);
+        g_write_captured = captured + len;
+    }
+    interrupts();
+}
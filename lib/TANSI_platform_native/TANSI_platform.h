@@ -0,0 +1,116 @@
+// Platform API for the native (Linux) build, the same one the Teensy 4.1
+// library provides.  ANSI_core is compiled against whichever platform
+// library the PlatformIO environment links, so on the device the calls still
+// inline to the register accesses and this one only costs anything on a
+// workstation.
+//
+// The pins are simulated: the device's outputs are kept in
+// g_platform_sim_pins, and a host model drives the other side through
+// TANSI_sim.h.  Interrupts are modelled with a lock, so the control bus
+// "interrupt" (run by the thread that moves the host pins) and the rotation
+// timer thread never overlap each other or a noInterrupts() section.
+
+#pragma once
+
+#include "TANSI_gpio.h"
+#include <cstddef>
+#include <cstdint>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern const char* g_platform_name;
+
+#define PLATFORM_NAME "TANSI v0.1 (native)"
+
+// Arduino core functions ANSI_core relies on
+uint32_t millis();
+uint32_t micros();
+void noInterrupts();
+void interrupts();
+
+// Nesting noInterrupts()/interrupts(), see the Teensy platform
+uint32_t platform_disable_interrupts();
+void platform_restore_interrupts(uint32_t state);
+
+void platform_init();
+void platform_late_init();
+void platform_post_sd_card_init();
+void platform_disable_led(void);
+
+// Debug logging functions, to stdout
+void platform_log(const char* s);
+
+// Next character typed on stdin, or -1 if there is none.
+int platform_console_getc();
+
+void platform_poll();
+
+// Nothing here waits on an SD card, the hook is never called.
+void platform_set_sd_wait_hook(void (*hook)());
+void platform_emergency_log_save();
+
+// level of a device or host driven pin
+uint8_t platform_sim_read_pin(uint8_t pin);
+#define platform_read_pin(pin) platform_sim_read_pin(pin)
+
+#define PLATFORM_BULK_RAM
+
+void* platform_alloc_bulk(size_t size);
+void platform_free_bulk(void* buffer);
+size_t platform_external_ram_size();
+#define platform_in_external_ram(p) false
+
+// The monotonic clock in nanoseconds stands in for the cycle counter.
+static inline uint32_t platform_cycle_count() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+#define platform_cycles_per_us() 1000
+#define platform_cycles_to_ns(cycles) ((uint32_t)(cycles))
+
+void platform_attach_control_bus_interrupt(void (*isr)());
+void platform_detach_control_bus_interrupt();
+
+enum ControlBusDirection { CONTROL_BUS_IN, CONTROL_BUS_OUT };
+void platform_set_control_bus_direction(ControlBusDirection direction);
+void platform_write_control_bus_byte(uint8_t v);
+
+// Runs isr every period_us from a thread of its own.
+void platform_start_rotation_timer(float period_us, void (*isr)());
+void platform_stop_rotation_timer();
+
+// The read data engine shifts queued buffers out instantly, into a FIFO the
+// host model drains with platform_sim_read_data(), so nothing is ever
+// pending and it never underruns.
+void platform_read_data_start(uint32_t bit_rate);
+void platform_read_data_stop();
+bool platform_read_data_queue(const uint8_t* data, uint32_t len);
+int platform_read_data_pending();
+void platform_read_data_flush();
+uint32_t platform_read_data_underruns();
+
+// The write data capture stores what the host model sends with
+// platform_sim_write_data(), which starts after the sync byte, so there is
+// no sync pattern to hunt for.
+void platform_write_data_start(uint8_t* buffer, uint32_t len,
+                               uint16_t sync_pattern, uint16_t sync_mask);
+void platform_write_data_stop();
+uint32_t platform_write_data_captured();
+uint32_t platform_write_data_overruns();
+
+#ifdef __cplusplus
+}
+#endif
+
+// The host driven pins in the bit order of the AnsiOutPins bitfields in
+// ansi.h.  While the device drives the control bus, CB0-CB7 read back what it
+// put there.
+uint16_t platform_sim_sample_pins();
+
+static inline uint16_t platform_sample_ansi_pins() {
+    return platform_sim_sample_pins();
+}
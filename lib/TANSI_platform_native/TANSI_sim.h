@@ -0,0 +1,36 @@
+// The host side of the simulated ANSI port, for programs that drive ANSI_core
+// natively.  Pin levels are raw: 1 = high = inactive.
+
+#pragma once
+
+#include "TANSI_platform.h"
+#include <cstdint>
+
+// Set every host driven pin at once, in the bit order of
+// platform_sample_ansi_pins().  If any of them changed and the control bus
+// interrupt is attached, it runs before this returns, like it would on an
+// edge.
+void platform_sim_set_host_pins(uint16_t pins);
+uint16_t platform_sim_host_pins();
+
+// Level of any pin, device or host driven, is platform_read_pin().
+
+// Whether the device has turned the control bus around, and the byte it is
+// putting on it (1 bits are driven active.)
+bool platform_sim_device_drives_control_bus();
+uint8_t platform_sim_control_bus_byte();
+
+// Take up to len bytes of read data the device has shifted out, returns how
+// many there were.
+uint32_t platform_sim_read_data(uint8_t* data, uint32_t len);
+// bytes waiting in the read data FIFO
+uint32_t platform_sim_read_data_available();
+
+// Send the bytes that follow the preamble and sync byte of a write.
+void platform_sim_write_data(const uint8_t* data, uint32_t len);
+
+// Back the storage hooks of device `id` with an image file, laid out like the
+// firmware's: every sector of the device's geometry back to back, in
+// cylinder, head, sector order.
+bool platform_sim_storage_open(uint8_t id, const char* path);
+void platform_sim_storage_close(uint8_t id);
@@ -0,0 +1,95 @@
+// File backed ANSI_core storage hooks for the native build.  Every access
+// goes straight to the image with pread()/pwrite(), so cylinders are always
+// staged and writes are flushed as soon as they are committed.
+
+#include "TANSI_log.h"
+#include "TANSI_sim.h"
+#include "ansi.h"
+#include "crc.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+struct SimImage {
+    int fd = -1;
+    uint16_t cylinder;
+    uint8_t head;
+    uint8_t sector;
+    uint8_t crc[ANSI_CRC_BYTES];
+    uint8_t data[HARD_DISK_SECTOR_SIZE + ANSI_CRC_BYTES];
+};
+
+static SimImage g_sim_images[ANSI_MAX_DEVICES];
+
+static off_t sector_offset(uint8_t id, uint16_t cylinder, uint8_t head,
+                           uint8_t sector) {
+    const AnsiDev* dev = &gAnsiDevs[id];
+    uint32_t lba =
+        ((uint32_t)cylinder * dev->disk_type->heads + head) * dev->sectors +
+        sector;
+    return (off_t)lba * dev->sector_bytes;
+}
+
+bool platform_sim_storage_open(uint8_t id, const char* path) {
+    platform_sim_storage_close(id);
+    g_sim_images[id].fd = open(path, O_RDWR);
+    if (g_sim_images[id].fd < 0) {
+        logmsg("ANSI", id, ": can't open image ", path);
+        return false;
+    }
+    return true;
+}
+
+void platform_sim_storage_close(uint8_t id) {
+    if (g_sim_images[id].fd >= 0) {
+        close(g_sim_images[id].fd);
+        g_sim_images[id].fd = -1;
+    }
+}
+
+bool ansi_storage_stage_cylinder(uint8_t, uint16_t) { return true; }
+
+bool ansi_storage_cylinder_staged(uint8_t, uint16_t) { return true; }
+
+const uint8_t* ansi_storage_sector_data(uint8_t id, uint16_t cylinder,
+                                        uint8_t head, uint8_t sector,
+                                        const uint8_t** crc) {
+    SimImage& img = g_sim_images[id];
+    uint16_t bytes = gAnsiDevs[id].sector_bytes;
+    off_t offset = sector_offset(id, cylinder, head, sector);
+    if (img.fd < 0 || pread(img.fd, img.data, bytes, offset) != bytes) {
+        return nullptr;
+    }
+    ansi_crc16_store(ansi_crc16(ANSI_CRC_INIT, img.data, bytes), img.crc);
+    *crc = img.crc;
+    return img.data;
+}
+
+uint8_t* ansi_storage_write_buffer(uint8_t id, uint16_t cylinder, uint8_t head,
+                                   uint8_t sector) {
+    SimImage& img = g_sim_images[id];
+    if (img.fd < 0) {
+        return nullptr;
+    }
+    img.cylinder = cylinder;
+    img.head = head;
+    img.sector = sector;
+    return img.data;
+}
+
+void ansi_storage_commit_write(uint8_t id) {
+    SimImage& img = g_sim_images[id];
+    uint16_t bytes = gAnsiDevs[id].sector_bytes;
+    if (pwrite(img.fd, img.data, bytes,
+               sector_offset(id, img.cylinder, img.head, img.sector)) !=
+        bytes) {
+        logmsg("ANSI", id, " write of cylinder ", (int)img.cylinder, " head ",
+               img.head, " sector ", img.sector, " failed");
+    }
+}
+
+void ansi_storage_flush(uint8_t) {}
+
+bool ansi_storage_flushed(uint8_t) { return true; }
+
+void ansi_storage_geometry_changed(uint8_t) {}
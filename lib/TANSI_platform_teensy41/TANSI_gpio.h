@@ -46,4 +46,6 @@
 #define SET_ACTIVE(pinName) digitalWriteFast(ANSI_##pinName, LOW);
 #define SET_INACTIVE(pinName) digitalWriteFast(ANSI_##pinName, HIGH)
 
-#define SD_CONFIG BUILTIN_SDCARD
\ No newline at end of file
+// DMA rather than FIFO SDIO: SdFat yields while DMA transfers run, and the
+// bus is served from the yield (see platform_set_sd_wait_hook())
+#define SD_CONFIG SdioConfig(DMA_SDIO)
\ No newline at end of file
@@ -0,0 +1,431 @@
+// NRZ data engines on FlexIO3.
+//
+// READ_DATA and READ_REF_CLOCK (pins 14 and 15) are FlexIO3 pins 2 and 3.
+// One timer generates the reference clock continuously and a chain of
+// shifters clocked by it serializes the queued buffers onto READ_DATA, msb
+// first, changing on the falling edge so the data is stable when the host
+// samples it on the rising edge.  With nothing queued the shifters send
+// zeros, like the gap on a real track.
+//
+// FlexIO3 is the one FlexIO block on the RT1062 without DMA requests, so the
+// shifters are chained into a single 128 bit shift register instead, and a
+// shifter status interrupt refills all four buffers at once.  At 7.5Mbps
+// that is an interrupt every 17us, which is only a few percent of the CPU.
+//
+// WRITE_DATA and WRITE_CLOCK (pins 17 and 16) are FlexIO3 pins 6 and 7.  A
+// second timer counts the host's WRITE_CLOCK edges, and another chain of
+// four shifters samples WRITE_DATA on its rising edges.  Every 128 bits the
+// interrupt moves the chain's contents into the capture buffer, aligned on
+// the sync byte that follows the preamble.
+
+#include "TANSI_platform.h"
+
+// FlexIO3 pin numbers of the ANSI data lines
+#define FLEXIO_PIN_READ_DATA 2
+#define FLEXIO_PIN_READ_REF_CLOCK 3
+static_assert(ANSI_READ_DATA == 14 && ANSI_READ_REF_CLOCK == 15,
+              "the read data engine needs READ_DATA/READ_REF_CLOCK on "
+              "FlexIO3 pins 2/3");
+
+#define FLEXIO_PIN_WRITE_DATA 6
+#define FLEXIO_PIN_WRITE_CLOCK 7
+static_assert(ANSI_WRITE_DATA == 17 && ANSI_WRITE_CLOCK == 16,
+              "the write data engine needs WRITE_DATA/WRITE_CLOCK on "
+              "FlexIO3 pins 6/7");
+
+// pad mux setting routing pins 14-17 to FlexIO3
+#define FLEXIO3_PAD_MUX 9
+
+// FlexIO2 and FlexIO3 share a clock root, run it at 480MHz (PLL3) / 4
+#define FLEXIO_CLOCK_HZ 120000000
+
+#define READ_TIMER 0
+#define READ_SHIFTER_FIRST 0
+#define READ_SHIFTERS 4
+#define READ_SHIFTER_MASK (((1 << READ_SHIFTERS) - 1) << READ_SHIFTER_FIRST)
+// bits shifted out between two refills
+#define READ_CHAIN_BITS (READ_SHIFTERS * 32)
+
+#define WRITE_TIMER 1
+#define WRITE_SHIFTER_FIRST 4
+#define WRITE_SHIFTERS 4
+#define WRITE_SHIFTER_MASK                                                     \
+    (((1 << WRITE_SHIFTERS) - 1) << WRITE_SHIFTER_FIRST)
+#define WRITE_CHAIN_BITS (WRITE_SHIFTERS * 32)
+
+// flexio shifter and timer modes
+#define SMOD_RECEIVE 1
+#define SMOD_TRANSMIT 2
+#define TIMOD_DUAL_8BIT_BAUD 1
+#define TIMOD_16BIT 3
+#define TIMDEC_PIN_BOTH_EDGES 2
+#define PINCFG_OUTPUT 3
+
+// buffers waiting to be shifted out.  Filled by the ANSI core (main loop or
+// control bus interrupt), drained by the FlexIO3 interrupt.
+struct ReadDataBuffer {
+    const uint8_t* data;
+    uint32_t len;
+};
+
+#define READ_DATA_QUEUE_SIZE 4
+static ReadDataBuffer g_read_queue[READ_DATA_QUEUE_SIZE];
+static volatile uint8_t g_read_queue_head; // next buffer to shift out
+static volatile uint8_t g_read_queue_tail; // next free slot
+static uint32_t g_read_offset;             // into the head buffer
+// set by platform_read_data_flush() to the tail at the time, for the
+// interrupt to skip ahead to (only the interrupt moves the head.)
+static volatile int8_t g_read_flush_to = -1;
+
+static uint32_t g_read_bit_rate;
+static volatile uint32_t g_read_underruns;
+
+// capture state, only touched by the interrupt while capturing
+static uint8_t* g_write_buffer;
+static uint32_t g_write_len;
+static volatile uint32_t g_write_captured;
+static bool g_write_synced;
+static uint16_t g_write_sync_pattern;
+static uint16_t g_write_sync_mask;
+// bits received but not yet stored, the lowest g_write_bit_count count
+static uint64_t g_write_bits;
+static int g_write_bit_count;
+
+static bool g_write_active;
+static volatile uint32_t g_write_overruns;
+
+static void flexio3_init_clock() {
+    static bool initialized;
+    if (initialized) {
+        return;
+    }
+    initialized = true;
+
+    CCM_CCGR7 &= ~CCM_CCGR7_FLEXIO3(CCM_CCGR_ON);
+    CCM_CSCMR2 = (CCM_CSCMR2 & ~CCM_CSCMR2_FLEXIO2_CLK_SEL_MASK) |
+                 CCM_CSCMR2_FLEXIO2_CLK_SEL(3);
+    CCM_CS1CDR = (CCM_CS1CDR & ~(CCM_CS1CDR_FLEXIO2_CLK_PRED_MASK |
+                                 CCM_CS1CDR_FLEXIO2_CLK_PODF_MASK)) |
+                 CCM_CS1CDR_FLEXIO2_CLK_PRED(1) |
+                 CCM_CS1CDR_FLEXIO2_CLK_PODF(1);
+    CCM_CCGR7 |= CCM_CCGR7_FLEXIO3(CCM_CCGR_ON);
+}
+
+// next 32 bits of read data, msb first
+static inline uint32_t read_data_next_word() {
+    uint8_t head = g_read_queue_head;
+    if (head == g_read_queue_tail) {
+        return 0;
+    }
+
+    const ReadDataBuffer& buf = g_read_queue[head];
+    uint32_t word;
+    if (buf.len - g_read_offset >= 4) {
+        memcpy(&word, buf.data + g_read_offset, 4);
+        word = __builtin_bswap32(word);
+        g_read_offset += 4;
+    } else {
+        // pad the tail of an odd sized buffer with zeros
+        word = 0;
+        for (int i = 0; i < 4; i++) {
+            word <<= 8;
+            if (g_read_offset < buf.len) {
+                word |= buf.data[g_read_offset++];
+            }
+        }
+    }
+
+    if (g_read_offset >= buf.len) {
+        g_read_offset = 0;
+        g_read_queue_head = (head + 1) % READ_DATA_QUEUE_SIZE;
+    }
+    return word;
+}
+
+static void read_data_isr() {
+    IMXRT_FLEXIO_t& flexio = IMXRT_FLEXIO3_S;
+
+    if (flexio.SHIFTERR & READ_SHIFTER_MASK) {
+        // the chain reloaded before it was refilled and repeated the
+        // previous 128 bits
+        flexio.SHIFTERR = READ_SHIFTER_MASK;
+        g_read_underruns++;
+    }
+
+    if (!(flexio.SHIFTSTAT & (1 << READ_SHIFTER_FIRST))) {
+        return;
+    }
+
+    int8_t flush_to = g_read_flush_to;
+    if (flush_to >= 0) {
+        g_read_flush_to = -1;
+        g_read_queue_head = flush_to;
+        g_read_offset = 0;
+    }
+
+    // the bits of shifter n + 1 follow those of shifter n out of the chain.
+    // The bit swapped buffer register turns the shifters' lsb first order
+    // into msb first.
+    for (int i = 0; i < READ_SHIFTERS; i++) {
+        flexio.SHIFTBUFBIS[READ_SHIFTER_FIRST + i] = read_data_next_word();
+    }
+}
+
+// Store the next 32 bits of write data, received msb first.  Until the
+// preamble's last byte and the sync byte have gone by, every bit position is
+// checked for them (the host's bytes needn't line up with our words), and
+// the sector data starts right after the sync byte.
+static inline void write_data_capture(uint32_t word) {
+    g_write_bits = (g_write_bits << 32) | word;
+    if (g_write_synced) {
+        g_write_bit_count += 32;
+    } else {
+        // windows ending in this word, the earliest first
+        for (int end = 31; end >= 0; end--) {
+            if (((g_write_bits >> end) & g_write_sync_mask) ==
+                g_write_sync_pattern) {
+                g_write_synced = true;
+                g_write_bit_count = end;
+                break;
+            }
+        }
+        if (!g_write_synced) {
+            return;
+        }
+    }
+
+    uint32_t captured = g_write_captured;
+    while (g_write_bit_count >= 8 && captured < g_write_len) {
+        g_write_bit_count -= 8;
+        g_write_buffer[captured++] = g_write_bits >> g_write_bit_count;
+    }
+    g_write_captured = captured;
+}
+
+static void write_data_isr() {
+    IMXRT_FLEXIO_t& flexio = IMXRT_FLEXIO3_S;
+
+    if (flexio.SHIFTERR & WRITE_SHIFTER_MASK) {
+        // the chain filled up again before it was emptied, 128 bits are lost
+        flexio.SHIFTERR = WRITE_SHIFTER_MASK;
+        g_write_overruns++;
+    }
+
+    if (!(flexio.SHIFTSTAT & (1 << WRITE_SHIFTER_FIRST))) {
+        return;
+    }
+
+    // WRITE_DATA shifts into the last shifter of the chain, so the first
+    // shifter holds the earliest bits, lsb first.
+    for (int i = 0; i < WRITE_SHIFTERS; i++) {
+        write_data_capture(flexio.SHIFTBUFBIS[WRITE_SHIFTER_FIRST + i]);
+    }
+}
+
+static void flexio3_isr() {
+    if (g_read_bit_rate) {
+        read_data_isr();
+    }
+    if (g_write_active) {
+        write_data_isr();
+    }
+}
+
+// FlexIO3 and its interrupt run while either engine does
+static void flexio3_update() {
+    IMXRT_FLEXIO_t& flexio = IMXRT_FLEXIO3_S;
+
+    if (g_read_bit_rate || g_write_active) {
+        attachInterruptVector(IRQ_FLEXIO3, flexio3_isr);
+        // below the control bus interrupt, which starts and stops the
+        // engines
+        NVIC_SET_PRIORITY(IRQ_FLEXIO3, 16);
+        NVIC_ENABLE_IRQ(IRQ_FLEXIO3);
+        flexio.CTRL = FLEXIO_CTRL_FLEXEN;
+    } else {
+        NVIC_DISABLE_IRQ(IRQ_FLEXIO3);
+        flexio.CTRL = 0;
+    }
+}
+
+void platform_read_data_start(uint32_t bit_rate) {
+    if (bit_rate == g_read_bit_rate) {
+        return;
+    }
+    platform_read_data_stop();
+    if (bit_rate == 0) {
+        return;
+    }
+
+    flexio3_init_clock();
+    IMXRT_FLEXIO_t& flexio = IMXRT_FLEXIO3_S;
+
+    // half a bit cell in FlexIO clocks, rounded
+    uint32_t half_bit = (FLEXIO_CLOCK_HZ + bit_rate) / (2 * bit_rate);
+    if (half_bit < 1) {
+        half_bit = 1;
+    } else if (half_bit > 256) {
+        half_bit = 256;
+    }
+
+    // always enabled and never disabled, so READ_REF_CLOCK runs for as long
+    // as the engine does.  The upper half of the compare value counts the
+    // clock edges of one refill, after which the shifters reload.
+    flexio.TIMCMP[READ_TIMER] =
+        ((READ_CHAIN_BITS * 2 - 1) << 8) | (half_bit - 1);
+    flexio.TIMCFG[READ_TIMER] = FLEXIO_TIMCFG_TIMOUT(0) |
+                                FLEXIO_TIMCFG_TIMDEC(0) |
+                                FLEXIO_TIMCFG_TIMENA(0) |
+                                FLEXIO_TIMCFG_TIMDIS(0);
+    flexio.TIMCTL[READ_TIMER] =
+        FLEXIO_TIMCTL_PINCFG(PINCFG_OUTPUT) |
+        FLEXIO_TIMCTL_PINSEL(FLEXIO_PIN_READ_REF_CLOCK) |
+        FLEXIO_TIMCTL_TIMOD(TIMOD_DUAL_8BIT_BAUD);
+
+    for (int i = 0; i < READ_SHIFTERS; i++) {
+        int shifter = READ_SHIFTER_FIRST + i;
+        bool last = i == READ_SHIFTERS - 1;
+
+        // every shifter but the last shifts in the output of the next one
+        flexio.SHIFTCFG[shifter] = last ? 0 : FLEXIO_SHIFTCFG_INSRC;
+        flexio.SHIFTBUF[shifter] = 0;
+        flexio.SHIFTCTL[shifter] =
+            FLEXIO_SHIFTCTL_TIMSEL(READ_TIMER) | FLEXIO_SHIFTCTL_TIMPOL |
+            (i == 0 ? FLEXIO_SHIFTCTL_PINCFG(PINCFG_OUTPUT) |
+                          FLEXIO_SHIFTCTL_PINSEL(FLEXIO_PIN_READ_DATA)
+                    : 0) |
+            FLEXIO_SHIFTCTL_SMOD(SMOD_TRANSMIT);
+    }
+
+    flexio.SHIFTSIEN |= 1 << READ_SHIFTER_FIRST;
+
+    // hand the pads over from GPIO, keeping their open drain pad settings
+    CORE_PIN14_CONFIG = FLEXIO3_PAD_MUX;
+    CORE_PIN15_CONFIG = FLEXIO3_PAD_MUX;
+
+    g_read_bit_rate = bit_rate;
+    flexio3_update();
+}
+
+void platform_read_data_stop() {
+    if (g_read_bit_rate == 0) {
+        return;
+    }
+
+    IMXRT_FLEXIO_t& flexio = IMXRT_FLEXIO3_S;
+    flexio.SHIFTSIEN &= ~(1 << READ_SHIFTER_FIRST);
+    flexio.TIMCTL[READ_TIMER] = 0;
+    for (int i = 0; i < READ_SHIFTERS; i++) {
+        flexio.SHIFTCTL[READ_SHIFTER_FIRST + i] = 0;
+    }
+    g_read_bit_rate = 0;
+    flexio3_update();
+
+    // back to (released) open drain GPIO outputs
+    pinMode(ANSI_READ_DATA, OUTPUT_OPENDRAIN);
+    pinMode(ANSI_READ_REF_CLOCK, OUTPUT_OPENDRAIN);
+    digitalWriteFast(ANSI_READ_DATA, HIGH);
+    digitalWriteFast(ANSI_READ_REF_CLOCK, HIGH);
+
+    g_read_flush_to = -1;
+    g_read_queue_head = g_read_queue_tail;
+    g_read_offset = 0;
+}
+
+bool platform_read_data_queue(const uint8_t* data, uint32_t len) {
+    uint8_t tail = g_read_queue_tail;
+    uint8_t next = (tail + 1) % READ_DATA_QUEUE_SIZE;
+    if (next == g_read_queue_head) {
+        return false;
+    }
+
+    g_read_queue[tail].data = data;
+    g_read_queue[tail].len = len;
+    g_read_queue_tail = next;
+    return true;
+}
+
+int platform_read_data_pending() {
+    int8_t flush_to = g_read_flush_to;
+    uint8_t head = flush_to >= 0 ? flush_to : g_read_queue_head;
+    return (g_read_queue_tail - head + READ_DATA_QUEUE_SIZE) %
+           READ_DATA_QUEUE_SIZE;
+}
+
+void platform_read_data_flush() {
+    // this may preempt the FlexIO3 interrupt halfway through a buffer, so
+    // leave moving the head to it.
+    g_read_flush_to = g_read_queue_tail;
+}
+
+uint32_t platform_read_data_underruns() { return g_read_underruns; }
+
+void platform_write_data_start(uint8_t* buffer, uint32_t len,
+                               uint16_t sync_pattern, uint16_t sync_mask) {
+    platform_write_data_stop();
+
+    flexio3_init_clock();
+    IMXRT_FLEXIO_t& flexio = IMXRT_FLEXIO3_S;
+
+    g_write_buffer = buffer;
+    g_write_len = len;
+    g_write_captured = 0;
+    g_write_synced = false;
+    g_write_sync_pattern = sync_pattern & sync_mask;
+    g_write_sync_mask = sync_mask;
+    // the bits before the gate count as preamble zeros
+    g_write_bits = 0;
+    g_write_bit_count = 0;
+
+    // counts both edges of WRITE_CLOCK, which also clocks the shifters.
+    // The chain is stored every time the counter expires.
+    flexio.TIMCMP[WRITE_TIMER] = WRITE_CHAIN_BITS * 2 - 1;
+    flexio.TIMCFG[WRITE_TIMER] =
+        FLEXIO_TIMCFG_TIMDEC(TIMDEC_PIN_BOTH_EDGES) |
+        FLEXIO_TIMCFG_TIMENA(0) | FLEXIO_TIMCFG_TIMDIS(0);
+    flexio.TIMCTL[WRITE_TIMER] = FLEXIO_TIMCTL_PINSEL(FLEXIO_PIN_WRITE_CLOCK) |
+                                 FLEXIO_TIMCTL_TIMOD(TIMOD_16BIT);
+
+    for (int i = 0; i < WRITE_SHIFTERS; i++) {
+        int shifter = WRITE_SHIFTER_FIRST + i;
+        bool last = i == WRITE_SHIFTERS - 1;
+
+        // the last shifter samples the pin, the others shift in the output
+        // of the next one
+        flexio.SHIFTCFG[shifter] = last ? 0 : FLEXIO_SHIFTCFG_INSRC;
+        flexio.SHIFTCTL[shifter] =
+            FLEXIO_SHIFTCTL_TIMSEL(WRITE_TIMER) |
+            (last ? FLEXIO_SHIFTCTL_PINSEL(FLEXIO_PIN_WRITE_DATA) : 0) |
+            FLEXIO_SHIFTCTL_SMOD(SMOD_RECEIVE);
+    }
+    flexio.SHIFTERR = WRITE_SHIFTER_MASK;
+    flexio.SHIFTSIEN |= 1 << WRITE_SHIFTER_FIRST;
+
+    CORE_PIN16_CONFIG = FLEXIO3_PAD_MUX;
+    CORE_PIN17_CONFIG = FLEXIO3_PAD_MUX;
+
+    g_write_active = true;
+    flexio3_update();
+}
+
+void platform_write_data_stop() {
+    if (!g_write_active) {
+        return;
+    }
+
+    IMXRT_FLEXIO_t& flexio = IMXRT_FLEXIO3_S;
+    flexio.SHIFTSIEN &= ~(1 << WRITE_SHIFTER_FIRST);
+    flexio.TIMCTL[WRITE_TIMER] = 0;
+    for (int i = 0; i < WRITE_SHIFTERS; i++) {
+        flexio.SHIFTCTL[WRITE_SHIFTER_FIRST + i] = 0;
+    }
+    g_write_active = false;
+    flexio3_update();
+
+    pinMode(ANSI_WRITE_CLOCK, INPUT);
+    pinMode(ANSI_WRITE_DATA, INPUT);
+}
+
+uint32_t platform_write_data_captured() { return g_write_captured; }
+
+uint32_t platform_write_data_overruns() { return g_write_overruns; }
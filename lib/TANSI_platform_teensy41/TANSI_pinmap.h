@@ -0,0 +1,264 @@
+// Compile time map of the ANSI pins in TANSI_gpio.h onto the i.MX RT fast GPIO
+// banks (GPIO6-GPIO9), so that groups of pins can be sampled or driven with a
+// single register access per bank instead of one digitalReadFast /
+// digitalWriteFast per pin.
+//
+// Everything here is derived from the pin numbers in TANSI_gpio.h, so changing
+// the pin assignment there is all that's needed.
+
+#pragma once
+
+#include "TANSI_gpio.h"
+#include <Arduino.h>
+#include <cstdint>
+
+namespace tansi_pinmap {
+
+enum Bank : uint8_t {
+    BANK_GPIO6 = 0,
+    BANK_GPIO7,
+    BANK_GPIO8,
+    BANK_GPIO9,
+    BANK_COUNT
+};
+
+struct PinLocation {
+    uint8_t bank;
+    uint8_t bit;
+};
+
+// Teensy 4.1 pins 0-41 (the fast GPIO aliases the core switches every pin to
+// at startup.)
+constexpr PinLocation g_pin_locations[] = {
+    {BANK_GPIO6, 3}, {BANK_GPIO6, 2}, {BANK_GPIO9, 4}, {BANK_GPIO9, 5},
+    {BANK_GPIO9, 6}, {BANK_GPIO9, 8}, {BANK_GPIO7, 10}, {BANK_GPIO7, 17},
+    {BANK_GPIO7, 16}, {BANK_GPIO7, 11}, {BANK_GPIO7, 0}, {BANK_GPIO7, 2},
+    {BANK_GPIO7, 1}, {BANK_GPIO7, 3}, {BANK_GPIO6, 18}, {BANK_GPIO6, 19},
+    {BANK_GPIO6, 23}, {BANK_GPIO6, 22}, {BANK_GPIO6, 17}, {BANK_GPIO6, 16},
+    {BANK_GPIO6, 26}, {BANK_GPIO6, 27}, {BANK_GPIO6, 24}, {BANK_GPIO6, 25},
+    {BANK_GPIO6, 12}, {BANK_GPIO6, 13}, {BANK_GPIO6, 30}, {BANK_GPIO6, 31},
+    {BANK_GPIO8, 18}, {BANK_GPIO9, 31}, {BANK_GPIO8, 23}, {BANK_GPIO8, 22},
+    {BANK_GPIO7, 12}, {BANK_GPIO9, 7}, {BANK_GPIO7, 29}, {BANK_GPIO7, 28},
+    {BANK_GPIO7, 18}, {BANK_GPIO7, 19}, {BANK_GPIO6, 28}, {BANK_GPIO6, 29},
+    {BANK_GPIO6, 20}, {BANK_GPIO6, 21},
+};
+
+constexpr int g_pin_count =
+    sizeof(g_pin_locations) / sizeof(g_pin_locations[0]);
+
+constexpr PinLocation pin_location(uint8_t pin) {
+    return pin < g_pin_count ? g_pin_locations[pin]
+                             : PinLocation{BANK_COUNT, 0};
+}
+
+// Host driven pins in the order of the bits returned by
+// platform_sample_ansi_pins(), which is also the order of the AnsiOutPins
+// bitfields in ansi.h.
+constexpr uint8_t g_sample_pins[] = {
+    ANSI_CB0,
+    ANSI_CB1,
+    ANSI_CB2,
+    ANSI_CB3,
+    ANSI_CB4,
+    ANSI_CB5,
+    ANSI_CB6,
+    ANSI_CB7,
+    ANSI_SELECT_OUT_ATTN_IN_STROBE,
+    ANSI_COMMAND_REQUEST,
+    ANSI_PARAMETER_REQUEST,
+    ANSI_BUS_DIRECTION_OUT,
+    ANSI_PORT_ENABLE,
+    ANSI_READ_GATE,
+    ANSI_WRITE_GATE,
+};
+
+constexpr int g_sample_pin_count =
+    sizeof(g_sample_pins) / sizeof(g_sample_pins[0]);
+
+constexpr bool sample_pins_valid() {
+    for (uint8_t pin : g_sample_pins) {
+        if (pin_location(pin).bank == BANK_COUNT) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(sample_pins_valid(),
+              "ANSI pin in TANSI_gpio.h is not on a fast GPIO bank");
+
+// mask of the bits of a bank that carry sampled pins
+constexpr uint32_t sample_bank_mask(int bank) {
+    uint32_t mask = 0;
+    for (uint8_t pin : g_sample_pins) {
+        if (pin_location(pin).bank == bank) {
+            mask |= 1u << pin_location(pin).bit;
+        }
+    }
+    return mask;
+}
+
+// The pad status registers are split into byte lanes, and each lane that
+// carries at least one sampled pin gets a 256 entry table that turns the lane
+// value straight into its contribution to the sample word.
+struct SampleLane {
+    uint8_t bank;
+    uint8_t shift;
+};
+
+constexpr int count_sample_lanes() {
+    int count = 0;
+    for (int bank = 0; bank < BANK_COUNT; bank++) {
+        for (int lane = 0; lane < 4; lane++) {
+            if ((sample_bank_mask(bank) >> (lane * 8)) & 0xff) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+constexpr int g_sample_lane_count = count_sample_lanes();
+
+struct SampleTables {
+    SampleLane lanes[g_sample_lane_count];
+    uint16_t values[g_sample_lane_count][256];
+};
+
+constexpr SampleTables build_sample_tables() {
+    SampleTables t{};
+    int n = 0;
+    for (int bank = 0; bank < BANK_COUNT; bank++) {
+        for (int lane = 0; lane < 4; lane++) {
+            if (((sample_bank_mask(bank) >> (lane * 8)) & 0xff) == 0) {
+                continue;
+            }
+            t.lanes[n] = {(uint8_t)bank, (uint8_t)(lane * 8)};
+            for (int value = 0; value < 256; value++) {
+                uint32_t word = (uint32_t)value << (lane * 8);
+                uint16_t sample = 0;
+                for (int i = 0; i < g_sample_pin_count; i++) {
+                    PinLocation loc = pin_location(g_sample_pins[i]);
+                    if (loc.bank == bank && (word & (1u << loc.bit))) {
+                        sample |= 1u << i;
+                    }
+                }
+                t.values[n][value] = sample;
+            }
+            n++;
+        }
+    }
+    return t;
+}
+
+constexpr SampleTables g_sample_tables = build_sample_tables();
+
+// Sample every host driven pin.  Each bank's pad status register is read
+// once, back to back, so the result is a coherent snapshot rather than 15
+// reads spread out over time.  Bits hold the raw pin levels.
+static inline uint16_t sample_pins() {
+    const uint32_t psr[BANK_COUNT] = {
+        sample_bank_mask(BANK_GPIO6) ? GPIO6_PSR : 0,
+        sample_bank_mask(BANK_GPIO7) ? GPIO7_PSR : 0,
+        sample_bank_mask(BANK_GPIO8) ? GPIO8_PSR : 0,
+        sample_bank_mask(BANK_GPIO9) ? GPIO9_PSR : 0,
+    };
+
+    uint16_t sample = 0;
+    for (int i = 0; i < g_sample_lane_count; i++) {
+        const SampleLane& lane = g_sample_tables.lanes[i];
+        sample |=
+            g_sample_tables.values[i][(psr[lane.bank] >> lane.shift) & 0xff];
+    }
+    return sample;
+}
+
+// Control bus pins, bit n of a control bus byte is g_control_bus_pins[n].
+constexpr uint8_t g_control_bus_pins[] = {
+    ANSI_CB0, ANSI_CB1, ANSI_CB2, ANSI_CB3,
+    ANSI_CB4, ANSI_CB5, ANSI_CB6, ANSI_CB7,
+};
+
+constexpr bool control_bus_pins_valid() {
+    for (uint8_t pin : g_control_bus_pins) {
+        if (pin_location(pin).bank == BANK_COUNT) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(control_bus_pins_valid(),
+              "ANSI CB pin in TANSI_gpio.h is not on a fast GPIO bank");
+
+// mask of the bits of a bank that carry control bus pins
+constexpr uint32_t control_bus_bank_mask(int bank) {
+    uint32_t mask = 0;
+    for (uint8_t pin : g_control_bus_pins) {
+        if (pin_location(pin).bank == bank) {
+            mask |= 1u << pin_location(pin).bit;
+        }
+    }
+    return mask;
+}
+
+// For every control bus byte, the bits of each bank that have to be driven
+// low (the bus is active low.)  The remaining bits of
+// control_bus_bank_mask() are driven high.
+struct ControlBusTables {
+    uint32_t low[BANK_COUNT][256];
+};
+
+constexpr ControlBusTables build_control_bus_tables() {
+    ControlBusTables t{};
+    for (int value = 0; value < 256; value++) {
+        for (int i = 0; i < 8; i++) {
+            if (value & (1 << i)) {
+                PinLocation loc = pin_location(g_control_bus_pins[i]);
+                t.low[loc.bank][value] |= 1u << loc.bit;
+            }
+        }
+    }
+    return t;
+}
+
+constexpr ControlBusTables g_control_bus_tables = build_control_bus_tables();
+
+// Put a byte on the control bus with one DR_CLEAR/DR_SET pair per bank, so
+// the bits of a bank change together instead of one at a time.
+static inline void write_control_bus(uint8_t v) {
+#define WRITE_BANK(n)                                                          \
+    if (control_bus_bank_mask(BANK_GPIO##n)) {                                 \
+        uint32_t low = g_control_bus_tables.low[BANK_GPIO##n][v];              \
+        GPIO##n##_DR_CLEAR = low;                                              \
+        GPIO##n##_DR_SET = control_bus_bank_mask(BANK_GPIO##n) & ~low;         \
+    }
+
+    WRITE_BANK(6);
+    WRITE_BANK(7);
+    WRITE_BANK(8);
+    WRITE_BANK(9);
+
+#undef WRITE_BANK
+}
+
+// Switch the control bus pins between inputs and outputs with a single GDIR
+// update per bank.  The pads were set up for GPIO by pinMode() already, so
+// the direction register is all that differs between the two.
+static inline void set_control_bus_output(bool output) {
+#define SET_BANK_DIRECTION(n)                                                  \
+    if (control_bus_bank_mask(BANK_GPIO##n)) {                                 \
+        if (output) {                                                          \
+            GPIO##n##_GDIR |= control_bus_bank_mask(BANK_GPIO##n);             \
+        } else {                                                               \
+            GPIO##n##_GDIR &= ~control_bus_bank_mask(BANK_GPIO##n);            \
+        }                                                                      \
+    }
+
+    SET_BANK_DIRECTION(6);
+    SET_BANK_DIRECTION(7);
+    SET_BANK_DIRECTION(8);
+    SET_BANK_DIRECTION(9);
+
+#undef SET_BANK_DIRECTION
+}
+
+} // namespace tansi_pinmap
@@ -11,6 +11,12 @@ const char* g_platform_name = PLATFORM_NAME;
 void platform_init() {
     SD.begin(BUILTIN_SDCARD);
 
+    // set the control bus pads up as GPIO once, after this only the
+    // direction register is touched.
+    for (uint8_t pin : tansi_pinmap::g_control_bus_pins) {
+        pinMode(pin, INPUT);
+    }
+
     // we start out with reading from the control bus
     //
     // TODO(toshok) maybe this call should be made at the ansi layer so we don't
@@ -49,31 +55,98 @@ void platform_disable_led(void) {}
 
 void platform_log(const char* s) { Serial.print(s); }
 
+int platform_console_getc() { return Serial.available() ? Serial.read() : -1; }
+
 void platform_emergency_log_save() {}
 
+void* platform_alloc_bulk(size_t size) {
+    if (external_psram_size) {
+        void* buffer = extmem_malloc(size);
+        if (buffer) {
+            return buffer;
+        }
+    }
+    return malloc(size);
+}
+
+// extmem_free() hands anything that isn't in the PSRAM to free()
+void platform_free_bulk(void* buffer) { extmem_free(buffer); }
+
+size_t platform_external_ram_size() {
+    return (size_t)external_psram_size * 1024 * 1024;
+}
+
 // Poll function that is called every few milliseconds.
 // Can be left empty or used for platform-specific processing.
 void platform_poll() {}
 
+static void (*g_sd_wait_hook)();
+
+void platform_set_sd_wait_hook(void (*hook)()) { g_sd_wait_hook = hook; }
+
+// Replaces the core's weak yield(), which only runs serialEvent() and the
+// EventResponder, neither of which we use.  delay() and the USB serial also
+// yield, hence the guard (ansi_poll() has its own against being called from
+// the main loop's ansi_poll()), and never from an interrupt handler.
+void yield() {
+    static bool in_hook;
+    bool in_handler = SCB_ICSR & 0x1ff; // VECTACTIVE
+    if (g_sd_wait_hook && !in_hook && !in_handler) {
+        in_hook = true;
+        g_sd_wait_hook();
+        in_hook = false;
+    }
+}
+
+// CONTROL_BUS_IN/OUT, or -1 before the pins have been set up
+static int g_control_bus_direction = -1;
+
 void platform_set_control_bus_direction(ControlBusDirection direction) {
+    if (direction == g_control_bus_direction) {
+        return;
+    }
+    g_control_bus_direction = direction;
+
     const bool output_from_drive = direction == CONTROL_BUS_IN;
-    pinMode(ANSI_CB0, output_from_drive ? OUTPUT : INPUT);
-    pinMode(ANSI_CB1, output_from_drive ? OUTPUT : INPUT);
-    pinMode(ANSI_CB2, output_from_drive ? OUTPUT : INPUT);
-    pinMode(ANSI_CB3, output_from_drive ? OUTPUT : INPUT);
-    pinMode(ANSI_CB4, output_from_drive ? OUTPUT : INPUT);
-    pinMode(ANSI_CB5, output_from_drive ? OUTPUT : INPUT);
-    pinMode(ANSI_CB6, output_from_drive ? OUTPUT : INPUT);
-    pinMode(ANSI_CB7, output_from_drive ? OUTPUT : INPUT);
+    tansi_pinmap::set_control_bus_output(output_from_drive);
 }
 
 void platform_write_control_bus_byte(uint8_t v) {
-    digitalWriteFast(ANSI_CB0, v & 0x01 ? LOW : HIGH);
-    digitalWriteFast(ANSI_CB1, v & 0x02 ? LOW : HIGH);
-    digitalWriteFast(ANSI_CB2, v & 0x04 ? LOW : HIGH);
-    digitalWriteFast(ANSI_CB3, v & 0x08 ? LOW : HIGH);
-    digitalWriteFast(ANSI_CB4, v & 0x10 ? LOW : HIGH);
-    digitalWriteFast(ANSI_CB5, v & 0x20 ? LOW : HIGH);
-    digitalWriteFast(ANSI_CB6, v & 0x40 ? LOW : HIGH);
-    digitalWriteFast(ANSI_CB7, v & 0x80 ? LOW : HIGH);
-}
\ No newline at end of file
+    tansi_pinmap::write_control_bus(v);
+}
+
+// host driven lines that can move the ANSI state machine
+static const uint8_t g_control_bus_interrupt_pins[] = {
+    ANSI_SELECT_OUT_ATTN_IN_STROBE,
+    ANSI_COMMAND_REQUEST,
+    ANSI_PARAMETER_REQUEST,
+    ANSI_BUS_DIRECTION_OUT,
+    ANSI_PORT_ENABLE,
+    ANSI_READ_GATE,
+    ANSI_WRITE_GATE,
+};
+
+static IntervalTimer g_rotation_timer;
+
+void platform_start_rotation_timer(float period_us, void (*isr)()) {
+    g_rotation_timer.begin(isr, period_us);
+    g_rotation_timer.priority(0);
+}
+
+void platform_stop_rotation_timer() { g_rotation_timer.end(); }
+
+void platform_attach_control_bus_interrupt(void (*isr)()) {
+    for (uint8_t pin : g_control_bus_interrupt_pins) {
+        attachInterrupt(pin, isr, CHANGE);
+    }
+
+    // all the fast GPIO banks share one interrupt vector.  Nothing else we do
+    // is as latency sensitive as the bus handshake.
+    NVIC_SET_PRIORITY(IRQ_GPIO6789, 0);
+}
+
+void platform_detach_control_bus_interrupt() {
+    for (uint8_t pin : g_control_bus_interrupt_pins) {
+        detachInterrupt(pin);
+    }
+}
@@ -27,22 +27,121 @@ void platform_disable_led(void);
 // Debug logging functions
 void platform_log(const char* s);
 
+// Next character typed on the serial console, or -1 if there is none.
+int platform_console_getc();
+
 // Poll function that is called every few milliseconds.
 // Can be left empty or used for platform-specific processing.
 void platform_poll();
 
+// Have hook called while the SD card is busy with a transfer, so the bus can
+// be served in the meantime.  SdFat yields from its DMA waits (see
+// SD_CONFIG), and the hook is called from yield(), never recursively.
+void platform_set_sd_wait_hook(void (*hook)());
+
 // Reinitialize SD card connection and save log from interrupt context.
 // This can be used in crash handlers.
 void platform_emergency_log_save();
 
 #define platform_read_pin(pin) digitalReadFast(pin)
 
+// Large buffers (traces, statistics) that don't need the tightly coupled RAM
+// go in the OCRAM, leaving DTCM for the stack and the hot state.
+#define PLATFORM_BULK_RAM DMAMEM
+
+// Large, long lived buffers (the cylinder cache) come from the external PSRAM
+// when the board has it fitted, and from the OCRAM heap otherwise.  nullptr
+// if neither has room.
+void* platform_alloc_bulk(size_t size);
+void platform_free_bulk(void* buffer);
+// bytes of external PSRAM fitted, 0 if none
+size_t platform_external_ram_size();
+#define platform_in_external_ram(p)                                            \
+    ((uintptr_t)(p) >= 0x70000000 && (uintptr_t)(p) < 0x80000000)
+
+// Free running CPU cycle counter (DWT_CYCCNT, enabled by the Teensy startup
+// code), for timing the bus handshakes.
+#define platform_cycle_count() ARM_DWT_CYCCNT
+#define platform_cycles_per_us() (F_CPU_ACTUAL / 1000000)
+#define platform_cycles_to_ns(cycles)                                          \
+    ((uint32_t)(((uint64_t)(cycles) * 1000) / platform_cycles_per_us()))
+
+// Disable interrupts and return whether they were already, for code that may
+// itself run with them off (from an interrupt or a noInterrupts() section).
+// Nests, unlike noInterrupts()/interrupts().
+static inline uint32_t platform_disable_interrupts() {
+    uint32_t primask;
+    __asm__ volatile("mrs %0, primask" : "=r"(primask));
+    __disable_irq();
+    return primask;
+}
+static inline void platform_restore_interrupts(uint32_t primask) {
+    if (!primask) {
+        __enable_irq();
+    }
+}
+
+// Call isr on every edge of the host driven control lines (select out/attn in
+// strobe, command and parameter request, bus direction, port enable and the
+// read/write gates.)  The interrupt runs at the highest priority so the
+// response time on the bus doesn't depend on whatever else is going on.
+void platform_attach_control_bus_interrupt(void (*isr)());
+void platform_detach_control_bus_interrupt();
+
 // "in" and "out" here are from the perspective of the host (to match the rest
 // of the ansi spec/terminology.)
 enum ControlBusDirection { CONTROL_BUS_IN, CONTROL_BUS_OUT };
 void platform_set_control_bus_direction(ControlBusDirection direction);
 void platform_write_control_bus_byte(uint8_t v);
 
+// Call isr every period_us from a PIT channel, at the same (highest) priority
+// as the control bus interrupt, so neither preempts the other.  Drives the
+// INDEX and SECTOR_MARK pulses, see rotation.h for what that does to them.
+void platform_start_rotation_timer(float period_us, void (*isr)());
+void platform_stop_rotation_timer();
+
+// NRZ read data engine.  While started, READ_REF_CLOCK runs at bit_rate and
+// the queued buffers are shifted out on READ_DATA back to back, msb first,
+// with zeros whenever the queue is empty.  Starting it again with the same
+// rate does nothing, and a rate of 0 stops it.
+void platform_read_data_start(uint32_t bit_rate);
+void platform_read_data_stop();
+
+// Queue len bytes to be shifted out after those already queued.  The buffer
+// has to stay valid until it is no longer counted by
+// platform_read_data_pending().  Returns false if the queue is full.
+bool platform_read_data_queue(const uint8_t* data, uint32_t len);
+// number of queued buffers that haven't been completely shifted out
+int platform_read_data_pending();
+// drop everything queued, the engine goes back to sending zeros
+void platform_read_data_flush();
+// times the shifters ran dry because the refill interrupt was late
+uint32_t platform_read_data_underruns();
+
+// NRZ write data capture.  Samples WRITE_DATA on the rising edges of the
+// host's WRITE_CLOCK, skips the preamble up to the first 16 bits that match
+// sync_pattern in the bits of sync_mask (the end of the preamble and the
+// sync byte, see AnsiSectorFormat), and stores the following len bytes into
+// buffer.  Anything after that is ignored until the capture is stopped.
+void platform_write_data_start(uint8_t* buffer, uint32_t len,
+                               uint16_t sync_pattern, uint16_t sync_mask);
+void platform_write_data_stop();
+// bytes stored so far, len once the capture is complete
+uint32_t platform_write_data_captured();
+// times the shifters filled up again before the interrupt emptied them
+uint32_t platform_write_data_overruns();
+
 #ifdef __cplusplus
 }
-#endif
\ No newline at end of file
+#endif
+
+#ifdef __cplusplus
+#include "TANSI_pinmap.h"
+
+// Sample every host driven ANSI pin in one go.  Bit order is that of
+// tansi_pinmap::g_sample_pins (CB0-CB7 followed by the control lines), and
+// bits hold the raw pin levels.
+static inline uint16_t platform_sample_ansi_pins() {
+    return tansi_pinmap::sample_pins();
+}
+#endif
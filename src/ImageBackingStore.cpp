@@ -31,8 +31,8 @@
 #include <strings.h>
 
 ImageBackingStore::ImageBackingStore() {
-#if notyet
     m_israw = false;
+#if notyet
     m_isrom = false;
     m_isreadonly_attr = false;
 #endif
@@ -43,43 +43,51 @@ ImageBackingStore::ImageBackingStore() {
 ImageBackingStore::ImageBackingStore(const char* filename,
                                      uint32_t scsi_block_size)
     : ImageBackingStore() {
-#if notyet
     if (strncasecmp(filename, "RAW:", 4) == 0) {
         char *endptr, *endptr2;
         m_bgnsector = strtoul(filename + 4, &endptr, 0);
+        // don't read past the end of "RAW:10"
+        if (*endptr != ':') {
+            logmsg("Invalid format for raw filename: ", filename);
+            return;
+        }
         m_endsector = strtoul(endptr + 1, &endptr2, 0);
 
-        if (*endptr != ':' || *endptr2 != '\0') {
+        if (*endptr2 != '\0' || m_endsector < m_bgnsector) {
             logmsg("Invalid format for raw filename: ", filename);
             return;
         }
 
+        // there is no file to fall back to, so every access has to be whole
+        // SD sectors
         if ((scsi_block_size % SD_SECTOR_SIZE) != 0) {
-            logmsg("SCSI block size ", (int)scsi_block_size,
+            logmsg("Block size ", (int)scsi_block_size,
                    " is not supported for RAW partitions (must be divisible by "
-                   "512 "
-                   "bytes)");
+                   "512 bytes)");
             return;
         }
 
         m_israw = true;
         m_blockdev = SD.sdfs.card();
+        m_cursector = m_bgnsector;
 
-        uint32_t sectorCount = SD.card()->sectorCount();
+        uint32_t sectorCount = m_blockdev->sectorCount();
         if (m_endsector >= sectorCount) {
             logmsg("---- Limiting RAW image mapping to SD card sector count: ",
                    (int)sectorCount);
             m_endsector = sectorCount - 1;
         }
-    } else if (strncasecmp(filename, "ROM:", 4) == 0) {
+    }
+#if notyet
+    else if (strncasecmp(filename, "ROM:", 4) == 0) {
         if (!romDriveCheckPresent(&m_romhdr)) {
             m_romhdr.imagesize = 0;
         } else {
             m_isrom = true;
         }
-    } else
+    }
 #endif
-    {
+    else {
 #if notyet
         m_isreadonly_attr = !!(FAT_ATTRIB_READ_ONLY & SD.attrib(filename));
         if (m_isreadonly_attr) {
@@ -93,18 +101,17 @@ ImageBackingStore::ImageBackingStore(const char* filename,
 
         uint32_t sectorcount = m_fsfile.size() / SD_SECTOR_SIZE;
         uint32_t begin = 0, end = 0;
-        if (m_fsfile.contiguousRange(&begin, &end) &&
+        if (sectorcount > 0 && m_fsfile.contiguousRange(&begin, &end) &&
             end >= begin + sectorcount &&
             (scsi_block_size % SD_SECTOR_SIZE) == 0) {
             // Convert to raw mapping, this avoids some unnecessary
             // access overhead in SdFat library.
             // If non-aligned offsets are later requested, it automatically
             // falls back to SdFat access mode.
-#if notyet
             m_israw = true;
-#endif
             m_blockdev = SD.sdfs.card();
             m_bgnsector = begin;
+            m_cursector = begin;
 
 #if notyet
             if (end != begin + sectorcount) {
@@ -129,14 +136,14 @@ ImageBackingStore::ImageBackingStore(const char* filename,
 }
 
 bool ImageBackingStore::isOpen() {
+    if (m_israw && !m_fsfile.isOpen()) {
+        return m_blockdev != nullptr;
+    }
 #if notyet
-    if (m_israw)
-        return (m_blockdev != NULL);
-    else if (m_isrom)
+    if (m_isrom)
         return (m_romhdr.imagesize > 0);
-    else
 #endif
-        return m_fsfile.isOpen();
+    return m_fsfile.isOpen();
 }
 
 bool ImageBackingStore::isWritable() {
@@ -149,102 +156,119 @@ bool ImageBackingStore::isWritable() {
 
 #if notyet
 bool ImageBackingStore::isRom() { return m_isrom; }
+#endif
 
 bool ImageBackingStore::isRaw() { return m_israw; }
-#endif
+
+bool ImageBackingStore::rawAccess(size_t count) {
+    return count % SD_SECTOR_SIZE == 0 &&
+           count / SD_SECTOR_SIZE <= m_endsector + 1 - m_cursector;
+}
+
+bool ImageBackingStore::fallBackToFile() {
+    if (!m_fsfile.isOpen()) {
+        logmsg("---- Unaligned or out of range access to RAW image");
+        return false;
+    }
+
+    dbgmsg("---- Unaligned access to image, falling back to SdFat access "
+           "mode");
+    m_israw = false;
+    // pick up where the raw access left off.  SdFat hasn't touched the file
+    // data since it was opened, so its cache has nothing stale in it.
+    return m_fsfile.seek((uint64_t)(m_cursector - m_bgnsector) *
+                         SD_SECTOR_SIZE);
+}
 
 bool ImageBackingStore::close() {
+    m_israw = false;
+    m_blockdev = nullptr;
 #if notyet
-    if (m_israw) {
-        m_blockdev = nullptr;
-        return true;
-    } else if (m_isrom) {
+    if (m_isrom) {
         m_romhdr.imagesize = 0;
         return true;
-    } else {
-#endif
-        return m_fsfile.close();
-#if notyet
     }
 #endif
+    if (!m_fsfile.isOpen()) {
+        return true;
+    }
+    return m_fsfile.close();
 }
 
 uint64_t ImageBackingStore::size() {
-#if notyet
-    if (m_israw && m_blockdev) {
+    if (m_israw && !m_fsfile.isOpen()) {
         return (uint64_t)(m_endsector - m_bgnsector + 1) * SD_SECTOR_SIZE;
-    } else if (m_isrom) {
-        return m_romhdr.imagesize;
-    } else {
-#endif
-        return m_fsfile.size();
+    }
 #if notyet
+    if (m_isrom) {
+        return m_romhdr.imagesize;
     }
 #endif
+    return m_fsfile.size();
 }
 
 bool ImageBackingStore::contiguousRange(uint32_t* bgnSector,
                                         uint32_t* endSector) {
-#if notyet
-    if (m_israw && m_blockdev) {
+    if (m_israw) {
         *bgnSector = m_bgnsector;
         *endSector = m_endsector;
         return true;
-    } else if (m_isrom) {
+    }
+#if notyet
+    if (m_isrom) {
         *bgnSector = 0;
         *endSector = 0;
         return true;
-    } else {
-#endif
-        return m_fsfile.contiguousRange(bgnSector, endSector);
-#if notyet
     }
 #endif
+    return m_fsfile.contiguousRange(bgnSector, endSector);
 }
 
 bool ImageBackingStore::seek(uint64_t pos) {
-#if notyet
     uint32_t sectornum = pos / SD_SECTOR_SIZE;
 
-    if (m_israw && (uint64_t)sectornum * SD_SECTOR_SIZE != pos) {
-        dbgmsg("---- Unaligned access to image, falling back to SdFat access "
-               "mode");
-        m_israw = false;
+    // the tail of a file that doesn't end on a sector boundary isn't mapped
+    if (m_israw && ((uint64_t)sectornum * SD_SECTOR_SIZE != pos ||
+                    sectornum > m_endsector - m_bgnsector)) {
+        if (!fallBackToFile()) {
+            return false;
+        }
     }
 
     if (m_israw) {
         m_cursector = m_bgnsector + sectornum;
-        return (m_cursector <= m_endsector);
-    } else if (m_isrom) {
+        return true;
+    }
+#if notyet
+    if (m_isrom) {
         uint32_t sectornum = pos / SD_SECTOR_SIZE;
         assert((uint64_t)sectornum * SD_SECTOR_SIZE == pos);
         m_cursector = sectornum;
         return m_cursector * SD_SECTOR_SIZE < m_romhdr.imagesize;
-    } else {
-#endif
-        return m_fsfile.seek(pos);
-#if notyet
     }
 #endif
+    return m_fsfile.seek(pos);
 }
 
 ssize_t ImageBackingStore::read(void* buf, size_t count) {
-#if notyet
     uint32_t sectorcount = count / SD_SECTOR_SIZE;
-    if (m_israw && (uint64_t)sectorcount * SD_SECTOR_SIZE != count) {
-        dbgmsg("---- Unaligned access to image, falling back to SdFat access "
-               "mode");
-        m_israw = false;
+    if (m_israw && !rawAccess(count)) {
+        if (!fallBackToFile()) {
+            return -1;
+        }
     }
 
-    if (m_israw && m_blockdev) {
+    if (m_israw) {
+        // one multi-sector transfer for the whole request
         if (m_blockdev->readSectors(m_cursector, (uint8_t*)buf, sectorcount)) {
             m_cursector += sectorcount;
             return count;
         } else {
             return -1;
         }
-    } else if (m_isrom) {
+    }
+#if notyet
+    if (m_isrom) {
         uint32_t sectorcount = count / SD_SECTOR_SIZE;
         assert((uint64_t)sectorcount * SD_SECTOR_SIZE == count);
         uint32_t start = m_cursector * SD_SECTOR_SIZE;
@@ -254,24 +278,20 @@ ssize_t ImageBackingStore::read(void* buf, size_t count) {
         } else {
             return -1;
         }
-    } else {
-#endif
-        return m_fsfile.read(buf, count);
-#if notyet
     }
 #endif
+    return m_fsfile.read(buf, count);
 }
 
 ssize_t ImageBackingStore::write(const void* buf, size_t count) {
-#if notyet
     uint32_t sectorcount = count / SD_SECTOR_SIZE;
-    if (m_israw && (uint64_t)sectorcount * SD_SECTOR_SIZE != count) {
-        dbgmsg("---- Unaligned access to image, falling back to SdFat access "
-               "mode");
-        m_israw = false;
+    if (m_israw && !rawAccess(count)) {
+        if (!fallBackToFile()) {
+            return 0;
+        }
     }
 
-    if (m_israw && m_blockdev) {
+    if (m_israw) {
         if (m_blockdev->writeSectors(m_cursector, (const uint8_t*)buf,
                                      sectorcount)) {
             m_cursector += sectorcount;
@@ -279,38 +299,29 @@ ssize_t ImageBackingStore::write(const void* buf, size_t count) {
         } else {
             return 0;
         }
-    } else if (m_isrom) {
+    }
+#if notyet
+    if (m_isrom) {
         logmsg("ERROR: attempted to write to ROM drive");
         return 0;
     } else if (m_isreadonly_attr) {
         logmsg("ERROR: attempted to write to a read only image");
         return 0;
-    } else {
-#endif
-        return m_fsfile.write(buf, count);
-#if notyet
     }
 #endif
+    return m_fsfile.write(buf, count);
 }
 
 void ImageBackingStore::flush() {
-#if notyet
-    if (!m_israw && !m_isrom && !m_isreadonly_attr) {
-#endif
+    // raw writes go straight to the card
+    if (!m_israw) {
         m_fsfile.flush();
-#if notyet
     }
-#endif
 }
 
 uint64_t ImageBackingStore::position() {
-#if notyet
-    if (!m_israw && !m_isrom) {
-#endif
-        return m_fsfile.curPosition();
-#if notyet
-    } else {
-        return 0;
+    if (m_israw) {
+        return (uint64_t)(m_cursector - m_bgnsector) * SD_SECTOR_SIZE;
     }
-#endif
+    return m_fsfile.curPosition();
 }
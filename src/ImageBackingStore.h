@@ -41,7 +41,10 @@
 // through either FAT filesystem or as a raw sector range.
 //
 // Raw access is activated by using filename like "RAW:0:12345"
-// where the numbers are the first and last sector.
+// where the numbers are the first and last sector.  Image files that are
+// contiguous on the card are accessed the same way, a whole number of SD
+// sectors per readSectors()/writeSectors() call, until an unaligned access
+// switches them back to SdFat for good.
 //
 // If the platform supports a ROM drive, it is activated by using
 // filename "ROM:".
@@ -65,10 +68,10 @@ class ImageBackingStore {
 #if notyet
     // Is this internal ROM drive in microcontroller flash?
     bool isRom();
+#endif
 
     // Is this backed by raw passthrough
     bool isRaw();
-#endif
 
     // Close the image so that .isOpen() will return false.
     bool close();
@@ -95,12 +98,21 @@ class ImageBackingStore {
     void flush();
 
     // Gets current position for following read/write operations
-    // Result is only valid for regular files, not raw or flash access
+    // Result is only valid for regular files and raw access, not flash
     uint64_t position();
 
   protected:
-#if notyet
+    // Whether count bytes from the current position are whole SD sectors
+    // within the raw mapping.
+    bool rawAccess(size_t count);
+
+    // Stop using the raw mapping of a file after an access that isn't whole
+    // SD sectors, and continue through SdFat at the same position.  False for
+    // a RAW: partition, which has no file to fall back to.
+    bool fallBackToFile();
+
     bool m_israw;
+#if notyet
     bool m_isrom;
     bool m_isreadonly_attr;
     romdrive_hdr_t m_romhdr;
@@ -12,6 +12,9 @@
 // #include "TANSI_log_trace.h"
 #include "TANSI_disk.h"
 #include "TANSI_settings.h"
+#include "TANSI_vcd.h"
+#include "latency.h"
+#include "trace.h"
 // #include "TANSI_msc.h"
 
 extern minIni inifile;
@@ -167,6 +170,7 @@ bool findHDDImages() {
                    " is already in use!");
             continue;
         }
+        idsSeen |= 1 << id;
 
         g_ansi_settings.initDevice(id);
 
@@ -181,7 +185,72 @@ bool findHDDImages() {
         id, fullname,
         1056 /*XXX hardcoded apollo size.  should come from device settings*/);
         if (imageReady) {
+            // without a preset the drive is emulated as the first (largest)
+            // known disk type.
+            const AnsiDiskType* disk_type =
+                ansi_find_disk_type(g_ansi_settings.getDevicePresetName(id));
+            if (!disk_type) {
+                disk_type = &g_disk_types[0];
+            }
+
+            // An image is laid out with its geometry, so it can't be used
+            // with another one.  Checked before the device answers the bus.
+            image_config_t& img = ansiDiskGetImageConfig(id);
+            ansi_device_settings_t* cfg = g_ansi_settings.getDevice(id);
+            uint16_t sectors = cfg->sectorsPerTrack;
+            uint16_t sector_bytes = cfg->bytesPerSector;
+            if (img.padded) {
+                // the header of a .pimg is the only say on where its tracks
+                // are, converting it to another layout is up to tansi_pimg
+                if (img.pimg.heads != disk_type->heads ||
+                    img.pimg.cylinders != disk_type->cylinders) {
+                    logmsg("---- Error: image has ", (int)img.pimg.heads,
+                           " heads and ", (int)img.pimg.cylinders,
+                           " cylinders, a ", disk_type->name, " has ",
+                           (int)disk_type->heads, " and ",
+                           (int)disk_type->cylinders);
+                    img.file.close();
+                    continue;
+                }
+                if ((sectors && sectors != img.pimg.sectors) ||
+                    (sector_bytes && sector_bytes != img.pimg.sector_bytes)) {
+                    logmsg("---- Ignoring SectorsPerTrack and BytesPerSector,"
+                           " the image header has ",
+                           (int)img.pimg.sectors, " sectors of ",
+                           (int)img.pimg.sector_bytes, " bytes");
+                }
+                sectors = img.pimg.sectors;
+                sector_bytes = img.pimg.sector_bytes;
+            } else if (sectors || sector_bytes) {
+                // a flat image the host has reformatted keeps its geometry
+                // in the ini
+                if (!sectors) {
+                    sectors = disk_type->sectors;
+                }
+                if (!sector_bytes) {
+                    sector_bytes = HARD_DISK_SECTOR_SIZE;
+                }
+            }
+
+            AnsiDev probe = {};
+            probe.disk_type = disk_type;
+            if ((sectors || sector_bytes) &&
+                !ansi_geometry_valid(&probe, sectors, sector_bytes)) {
+                logmsg("---- Error: ", (int)sectors, " sectors of ",
+                       (int)sector_bytes, " bytes don't fit a ",
+                       disk_type->name, " track");
+                img.file.close();
+                continue;
+            }
+
             foundImage = true;
+            logmsg("---- Emulating ", disk_type->name, " at ANSI ID ", id);
+            ansi_configure_device(id, disk_type);
+            if (sectors || sector_bytes) {
+                ansi_set_geometry(&gAnsiDevs[id], sectors, sector_bytes);
+                logmsg("---- Formatted with ", (int)sectors, " sectors of ",
+                       (int)sector_bytes, " bytes");
+            }
         } else {
             logmsg("---- Failed to load image");
         }
@@ -219,7 +288,7 @@ static bool mountSDCard() {
     // notyet ansiDiskCloseSDCardImages();
 
     // Check for the common case, FAT filesystem as first partition
-    if (SD.begin(SD_CONFIG)) {
+    if (SD.sdfs.begin(SD_CONFIG)) {
         reload_ini_cache(CONFIGFILE);
         return true;
     }
@@ -229,8 +298,29 @@ static bool mountSDCard() {
 
 static void reinitANSI() {
     g_log_debug = inifile.getbool("ANSI", "Debug", false);
+    g_ansi_turbo_seek = inifile.getbool("ANSI", "TurboSeek", false);
+    g_ansi_sector_crc = inifile.getbool("ANSI", "SectorCRC", false);
+    if (inifile.getbool("ANSI", "Trace", false)) {
+        // TraceTrigger is a command byte, the capture stops half a ring
+        // after the first time it's seen.
+        ansi_trace_start(inifile.getl("ANSI", "TraceTrigger", -1));
+    } else {
+        ansi_trace_stop();
+    }
+    // the interrupt can only log through the deferred ring (see
+    // g_log_in_interrupt), and the main loop has to be draining it before
+    // the interrupt is attached.  tansi_setup() flushes what setup logs.
+    bool interrupt_driven = inifile.getbool("ANSI", "InterruptDriven", false);
+    g_log_deferred = inifile.getbool("ANSI", "DeferredLog", true);
+    if (interrupt_driven && !g_log_deferred) {
+        logmsg("DeferredLog=0 ignored, InterruptDriven needs it");
+        g_log_deferred = true;
+    }
+    ansi_set_interrupt_driven(interrupt_driven);
 
     ansiDiskResetImages();
+    ansiDiskInitCache(inifile.getl("ANSI", "CacheSizeKB", 0));
+    ansi_reset_devices();
     {
         readConfig();
         findHDDImages();
@@ -327,9 +417,47 @@ extern "C" void tansi_setup(void) {
     platform_post_sd_card_init();
 
     logmsg("Setup complete.");
+    // from here on the main loop drains the deferred log
+    log_flush_deferred();
+
+    // the bus is served while the SD card is busy, now that the devices
+    // are set up
+    platform_set_sd_wait_hook(ansi_poll);
+}
+
+// single key commands on the serial console
+static void poll_console() {
+    switch (platform_console_getc()) {
+    case 't':
+        // dump the protocol trace
+        if (g_sdcard_present) {
+            tansi_write_trace_vcd();
+        }
+        break;
+    case 'l':
+        // dump the bus latency histograms
+        ansi_latency_dump();
+        break;
+    case 'r':
+        ansi_latency_reset();
+        logmsg("ANSI latency histograms reset");
+        break;
+    case 'c':
+        ansiDiskLogCacheStats();
+        break;
+    }
 }
 
 extern "C" void tansi_main_loop(void) {
     platform_poll();
     ansi_poll();
+    poll_console();
+
+    if (ansi_trace_capture_ready() && g_sdcard_present) {
+        tansi_write_trace_vcd();
+    }
+
+    ansiDiskPoll();
+    log_flush_deferred();
+    save_logfile();
 }
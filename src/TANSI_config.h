@@ -14,6 +14,8 @@
 #define CONFIGFILE "tansi.ini"
 #define LOGFILE "tansilog.txt"
 #define CRASHFILE "tansierr.txt"
+// protocol trace dumps, numbered from 000
+#define TRACEFILE "tansitrace%03d.vcd"
 
 // Prefix for command file to create new image (case-insensitive)
 #define CREATEFILE "create"
@@ -40,7 +42,7 @@
 #define NUM_ANSIID 8 // Maximum number of supported ANSI-IDs (The minimum is 0)
 #define READ_PARITY_CHECK 0 // Perform read parity check (unverified)
 
-// Use prefetch buffer in read requests
+// Default read-ahead of the cylinder cache, see [ANSIn] PrefetchBytes
 #ifndef PREFETCH_BUFFER_SIZE
 #define PREFETCH_BUFFER_SIZE 8192
 #endif
@@ -29,8 +29,14 @@
 #include "TANSI_disk.h"
 #include "ImageBackingStore.h"
 #include "TANSI_config.h"
+#include "TANSI_io.h"
 #include "TANSI_log.h"
+#include "TANSI_platform.h"
+#include "TANSI_readahead.h"
 #include "TANSI_settings.h"
+#include "ansi.h"
+#include "crc.h"
+#include "rotation.h"
 // #include "QuirksCheck.h"
 #include <SdFat.h>
 #include <assert.h>
@@ -188,10 +194,54 @@ static void ansiDiskSetImageConfig(uint8_t target_idx) {
 #endif
 }
 
+// Whole SD sectors around what is read or written of a .pimg image, so the
+// access stays aligned: its header, or a sector the cylinder cache doesn't
+// hold (which straddles at most four SD sectors).
+static uint8_t g_pimg_bounce[4 * SD_SECTOR_SIZE] PLATFORM_BULK_RAM;
+
+static bool has_extension(const char* name, const char* extension) {
+    const char* dot = strrchr(name, '.');
+    return dot && !strcasecmp(dot, extension);
+}
+
+static bool pimg_read_header(image_config_t& img) {
+    if (!img.file.seek(0) ||
+        img.file.read(g_pimg_bounce, PIMG_HEADER_BYTES) != PIMG_HEADER_BYTES) {
+        logmsg("---- Error: can't read the .pimg header");
+        return false;
+    }
+    memcpy(&img.pimg, g_pimg_bounce, sizeof(img.pimg));
+    if (!pimg_header_valid(&img.pimg)) {
+        logmsg("---- Error: not a valid .pimg header");
+        return false;
+    }
+    if (img.file.size() < pimg_image_bytes(&img.pimg)) {
+        logmsg("---- Error: image is ", (uint32_t)img.file.size(),
+               " bytes, its header needs ",
+               (uint32_t)pimg_image_bytes(&img.pimg));
+        return false;
+    }
+    return true;
+}
+
+static bool pimg_write_header(image_config_t& img) {
+    memset(g_pimg_bounce, 0, PIMG_HEADER_BYTES);
+    noInterrupts();
+    memcpy(g_pimg_bounce, &img.pimg, sizeof(img.pimg));
+    interrupts();
+    return img.file.seek(0) &&
+           img.file.write(g_pimg_bounce, PIMG_HEADER_BYTES) ==
+               PIMG_HEADER_BYTES;
+}
+
 bool ansiDiskOpenHDDImage(int ansi_id, const char* filename, int blocksize) {
     image_config_t& img = g_DiskImages[ansi_id];
     ansiDiskSetImageConfig(ansi_id);
-    img.file = ImageBackingStore(filename, blocksize);
+    // everything of a padded image is read and written in whole SD sectors
+    img.padded = has_extension(filename, ".pimg");
+    img.pimgHeaderDirty = false;
+    img.file =
+        ImageBackingStore(filename, img.padded ? SD_SECTOR_SIZE : blocksize);
 
     if (img.file.isOpen()) {
 #if notyet
@@ -219,12 +269,24 @@ bool ansiDiskOpenHDDImage(int ansi_id, const char* filename, int blocksize) {
                    " is not contiguous. This will increase read latency.");
         }
 
+        if (img.padded) {
+            if (!pimg_read_header(img)) {
+                img.file.close();
+                return false;
+            }
+            logmsg("---- Padded image of ", (int)img.pimg.cylinders,
+                   " cylinders, ", (int)img.pimg.heads, " heads, ",
+                   (int)img.pimg.sectors, " sectors of ",
+                   (int)img.pimg.sector_bytes, " bytes");
+        }
+
         logmsg("---- Configuring as disk drive");
 
 #if notyet
         quirksCheck(&img);
 #endif
 
+        img.prefetchbytes = g_ansi_settings.getDevice(ansi_id)->prefetchBytes;
         if (img.prefetchbytes > 0) {
             logmsg("---- Read prefetch enabled: ", (int)img.prefetchbytes,
                    " bytes");
@@ -260,21 +322,925 @@ static void checkDiskGeometryDivisible(image_config_t& img) {
 }
 #endif
 
-bool ansiDiskFilenameValid(const char* name) {
-    // Check file extension.  only `.img` is permissible.
-    const char* extension = strrchr(name, '.');
-    if (!extension) {
-        return false;
+// The image holds the sectors in cylinder, head, sector order, laid out with
+// the device's current geometry (see ansi_set_geometry()).  A flat image is
+// nothing but the sectors, a .pimg starts every track on an SD sector.
+static uint32_t sector_lba(uint8_t ansi_id, uint16_t cylinder, uint8_t head,
+                           uint8_t sector) {
+    const AnsiDev* dev = &gAnsiDevs[ansi_id];
+    return ((uint32_t)cylinder * dev->disk_type->heads + head) * dev->sectors +
+           sector;
+}
+
+static uint32_t track_bytes(const AnsiDev* dev) {
+    return (uint32_t)dev->sectors * dev->sector_bytes;
+}
+
+// the space a track takes up in the image
+static uint32_t image_track_bytes(uint8_t ansi_id) {
+    const AnsiDev* dev = &gAnsiDevs[ansi_id];
+    return g_DiskImages[ansi_id].padded
+               ? pimg_track_bytes(dev->sectors, dev->sector_bytes)
+               : track_bytes(dev);
+}
+
+static uint64_t image_offset(uint8_t ansi_id, uint16_t cylinder, uint8_t head,
+                             uint8_t sector) {
+    const AnsiDev* dev = &gAnsiDevs[ansi_id];
+    const image_config_t& img = g_DiskImages[ansi_id];
+    uint32_t track = (uint32_t)cylinder * dev->disk_type->heads + head;
+    return (img.padded ? img.pimg.data_offset : 0) +
+           (uint64_t)track * image_track_bytes(ansi_id) +
+           (uint32_t)sector * dev->sector_bytes;
+}
+
+// Sectors written by the host.  The ANSI core captures into the slot at the
+// tail (from the control bus interrupt in interrupt-driven mode).  Sectors of
+// cached tracks are then copied into the cylinder cache and the slot is
+// reused; the others stay in the ring and ansiDiskPoll() writes them out from
+// the head, so a slow SD card write doesn't hold up the host either way.
+struct PendingSectorWrite {
+    uint8_t ansi_id;
+    uint16_t cylinder;
+    uint8_t head;
+    uint8_t sector;
+    // the data, followed by its CRC when the host sends one
+    uint8_t data[HARD_DISK_SECTOR_SIZE + ANSI_CRC_BYTES];
+};
+
+#define WRITE_RING_SECTORS 8
+static PendingSectorWrite g_write_ring[WRITE_RING_SECTORS] PLATFORM_BULK_RAM;
+static volatile uint8_t g_write_ring_head; // next to write to the image
+static volatile uint8_t g_write_ring_tail; // being filled by the host
+
+// Whole cylinder cache.  Seeks stage their target cylinder, ansiDiskPoll()
+// loads it from the image a track at a time, and the host's reads are then
+// served from RAM, including after head switches.
+//
+// The cache is write-back: sectors the host writes to a cached track only
+// go to RAM and are marked dirty.  ansiDiskPoll() writes runs of consecutive
+// dirty sectors to the image while the bus is idle (see ansi_bus_idle()), or
+// straight away for a device that has to be flushed.  A dirty cylinder is
+// never replaced.
+//
+// The cache holds as many cylinders as [ANSI] CacheSizeKB allows, in the
+// external PSRAM when the board has it, and the least recently used one is
+// replaced.  Every slot is big enough for the largest cylinder of
+// g_disk_types however it is formatted, followed by the CRCs of its sectors.
+// Its tracks are padded to whole SD sectors, like those of a .pimg image, so
+// one of them loads with a single read.
+#define CYLINDER_CACHE_HEADS 5
+#define CYLINDER_CACHE_TRACK_BYTES pimg_track_bytes(12, HARD_DISK_SECTOR_SIZE)
+#define CYLINDER_CACHE_BYTES (CYLINDER_CACHE_HEADS * CYLINDER_CACHE_TRACK_BYTES)
+#define CYLINDER_CACHE_SLOT_BYTES                                              \
+    (CYLINDER_CACHE_BYTES +                                                    \
+     CYLINDER_CACHE_HEADS * ANSI_MAX_SECTORS_PER_TRACK * ANSI_CRC_BYTES)
+// without PSRAM, two cylinders is as much as the OCRAM can spare
+#define CYLINDER_CACHE_DEFAULT_OCRAM_KB 128
+#define CYLINDER_CACHE_MIN_SLOTS 2
+// buckets of the (device, cylinder) -> slot hash, a power of two
+#define CYLINDER_CACHE_HASH_SIZE 512
+static_assert(ANSI_MAX_SECTORS_PER_TRACK <= 32,
+              "the dirty bitmap has a bit per sector of a track");
+
+struct CylinderCacheSlot {
+    int8_t ansi_id; // -1 if unused
+    uint16_t cylinder;
+    // tracks (heads) loaded so far, the cylinder is staged when this reaches
+    // the number of heads
+    volatile uint8_t heads_loaded;
+    // tracks whose loads have been queued (see TANSI_io.h)
+    uint8_t heads_queued;
+    // reads and writes of the slot still queued, it keeps its cylinder (or
+    // stays unused) until they are done
+    volatile uint8_t reads_queued;
+    volatile uint8_t writes_queued;
+    // bit sector of dirty[head] is set if that sector has been written by
+    // the host but not yet to the image.
+    volatile uint32_t dirty[CYLINDER_CACHE_HEADS];
+    // LRU list, most recently used first
+    int16_t lru_prev;
+    int16_t lru_next;
+    // next slot in the same hash bucket
+    int16_t hash_next;
+};
+
+static CylinderCacheSlot* g_cylinder_cache;
+static uint8_t* g_cylinder_cache_data;
+static int g_cylinder_cache_slots;
+static int16_t g_cylinder_cache_hash[CYLINDER_CACHE_HASH_SIZE];
+static int16_t g_cylinder_cache_lru_head;
+static int16_t g_cylinder_cache_lru_tail;
+
+static struct {
+    uint32_t hits;        // staged cylinders that were already cached
+    uint32_t misses;      // staged cylinders that had to be loaded
+    uint32_t evictions;   // cached cylinders replaced by another
+    uint32_t read_misses; // host reads of a track that wasn't loaded
+    uint32_t flushes;     // runs of dirty sectors written to the image
+    uint32_t prefetches;  // cylinders staged by the read-ahead
+} g_cylinder_cache_stats;
+
+// bit n is set if device n has to be flushed regardless of the bus
+static volatile uint8_t g_flush_requested;
+// bit n is set if image n has been written since it was last synced
+static uint8_t g_images_unsynced;
+// how long reading a track from the image takes, a guess until measured
+static uint32_t g_track_load_us = 2000;
+
+static int cylinder_cache_bucket(uint8_t ansi_id, uint16_t cylinder) {
+    return ((cylinder << 3) | ansi_id) & (CYLINDER_CACHE_HASH_SIZE - 1);
+}
+
+static int cylinder_cache_find(uint8_t ansi_id, uint16_t cylinder) {
+    int slot = g_cylinder_cache_hash[cylinder_cache_bucket(ansi_id, cylinder)];
+    while (slot >= 0) {
+        if (g_cylinder_cache[slot].ansi_id == ansi_id &&
+            g_cylinder_cache[slot].cylinder == cylinder) {
+            return slot;
+        }
+        slot = g_cylinder_cache[slot].hash_next;
+    }
+    return -1;
+}
+
+static void cylinder_cache_hash_remove(int slot) {
+    CylinderCacheSlot& entry = g_cylinder_cache[slot];
+    int16_t* link = &g_cylinder_cache_hash[cylinder_cache_bucket(
+        entry.ansi_id, entry.cylinder)];
+    while (*link != slot) {
+        link = &g_cylinder_cache[*link].hash_next;
+    }
+    *link = entry.hash_next;
+}
+
+static void cylinder_cache_hash_insert(int slot) {
+    CylinderCacheSlot& entry = g_cylinder_cache[slot];
+    int16_t& bucket = g_cylinder_cache_hash[cylinder_cache_bucket(
+        entry.ansi_id, entry.cylinder)];
+    entry.hash_next = bucket;
+    bucket = slot;
+}
+
+// move a slot to the front of the LRU list
+static void cylinder_cache_touch(int slot) {
+    if (slot == g_cylinder_cache_lru_head) {
+        return;
+    }
+
+    CylinderCacheSlot& entry = g_cylinder_cache[slot];
+    g_cylinder_cache[entry.lru_prev].lru_next = entry.lru_next;
+    if (entry.lru_next >= 0) {
+        g_cylinder_cache[entry.lru_next].lru_prev = entry.lru_prev;
+    } else {
+        g_cylinder_cache_lru_tail = entry.lru_prev;
+    }
+
+    entry.lru_prev = -1;
+    entry.lru_next = g_cylinder_cache_lru_head;
+    g_cylinder_cache[g_cylinder_cache_lru_head].lru_prev = slot;
+    g_cylinder_cache_lru_head = slot;
+}
+
+// move a slot to the end of the LRU list, where the unused ones are
+static void cylinder_cache_retire(int slot) {
+    if (slot == g_cylinder_cache_lru_tail) {
+        return;
+    }
+
+    CylinderCacheSlot& entry = g_cylinder_cache[slot];
+    g_cylinder_cache[entry.lru_next].lru_prev = entry.lru_prev;
+    if (entry.lru_prev >= 0) {
+        g_cylinder_cache[entry.lru_prev].lru_next = entry.lru_next;
+    } else {
+        g_cylinder_cache_lru_head = entry.lru_next;
+    }
+
+    entry.lru_next = -1;
+    entry.lru_prev = g_cylinder_cache_lru_tail;
+    g_cylinder_cache[g_cylinder_cache_lru_tail].lru_next = slot;
+    g_cylinder_cache_lru_tail = slot;
+}
+
+static uint32_t cylinder_cache_track_bytes(const AnsiDev* dev) {
+    return pimg_track_bytes(dev->sectors, dev->sector_bytes);
+}
+
+static uint8_t* cylinder_cache_sector(int slot, const AnsiDev* dev,
+                                      uint8_t head, uint8_t sector) {
+    return g_cylinder_cache_data + (uint32_t)slot * CYLINDER_CACHE_SLOT_BYTES +
+           head * cylinder_cache_track_bytes(dev) +
+           sector * dev->sector_bytes;
+}
+
+// the CRC of a cached sector, kept so reads don't have to work it out
+static uint8_t* cylinder_cache_crc(int slot, uint8_t head, uint8_t sector) {
+    return g_cylinder_cache_data + (uint32_t)slot * CYLINDER_CACHE_SLOT_BYTES +
+           CYLINDER_CACHE_BYTES +
+           (head * ANSI_MAX_SECTORS_PER_TRACK + sector) * ANSI_CRC_BYTES;
+}
+
+static void cylinder_cache_update_crc(int slot, const AnsiDev* dev,
+                                      uint8_t head, uint8_t sector) {
+    ansi_crc16_store(ansi_crc16(ANSI_CRC_INIT,
+                                cylinder_cache_sector(slot, dev, head, sector),
+                                dev->sector_bytes),
+                     cylinder_cache_crc(slot, head, sector));
+}
+
+static bool cylinder_cache_dirty(const CylinderCacheSlot& entry) {
+    for (int head = 0; head < CYLINDER_CACHE_HEADS; head++) {
+        if (entry.dirty[head]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// whether the slot has to keep its cylinder
+static bool cylinder_cache_busy(const CylinderCacheSlot& entry) {
+    return entry.reads_queued || entry.writes_queued ||
+           cylinder_cache_dirty(entry);
+}
+
+// the callbacks of a slot's queued reads and writes get the slot and track
+static void* cylinder_cache_io_context(int slot, uint8_t head) {
+    return (void*)(intptr_t)((slot << 8) | head);
+}
+
+// forget every cached cylinder
+static void cylinder_cache_clear() {
+    for (int i = 0; i < CYLINDER_CACHE_HASH_SIZE; i++) {
+        g_cylinder_cache_hash[i] = -1;
+    }
+    for (int i = 0; i < g_cylinder_cache_slots; i++) {
+        CylinderCacheSlot& entry = g_cylinder_cache[i];
+        entry.ansi_id = -1;
+        entry.heads_loaded = 0;
+        entry.heads_queued = 0;
+        entry.reads_queued = 0;
+        entry.writes_queued = 0;
+        memset((void*)entry.dirty, 0, sizeof(entry.dirty));
+        entry.lru_prev = i - 1;
+        entry.lru_next = i + 1 < g_cylinder_cache_slots ? i + 1 : -1;
+        entry.hash_next = -1;
+    }
+    g_cylinder_cache_lru_head = 0;
+    g_cylinder_cache_lru_tail = g_cylinder_cache_slots - 1;
+    memset(&g_cylinder_cache_stats, 0, sizeof(g_cylinder_cache_stats));
+}
+
+void ansiDiskInitCache(uint32_t size_kb) {
+    // nothing the host wrote gets lost with the old cache
+    ansiDiskFlushCache();
+
+    if (size_kb == 0) {
+        size_t external = platform_external_ram_size();
+        // leave a little of the PSRAM for anything else that wants it
+        size_kb = external ? external / 1024 - external / 1024 / 16
+                           : CYLINDER_CACHE_DEFAULT_OCRAM_KB;
     }
 
-    if (strcasecmp(extension, ".img")) {
-        // invalid extension
+    int slots = (uint64_t)size_kb * 1024 / CYLINDER_CACHE_SLOT_BYTES;
+    if (slots < CYLINDER_CACHE_MIN_SLOTS) {
+        slots = CYLINDER_CACHE_MIN_SLOTS;
+    } else if (slots > INT16_MAX) {
+        slots = INT16_MAX;
+    }
+
+    noInterrupts();
+    int old_slots = g_cylinder_cache_slots;
+    g_cylinder_cache_slots = 0;
+    interrupts();
+
+    if (slots != old_slots) {
+        platform_free_bulk(g_cylinder_cache_data);
+        free(g_cylinder_cache);
+        g_cylinder_cache_data = nullptr;
+        g_cylinder_cache = nullptr;
+
+        // settle for less if the memory isn't there
+        for (; slots >= CYLINDER_CACHE_MIN_SLOTS; slots /= 2) {
+            g_cylinder_cache_data = (uint8_t*)platform_alloc_bulk(
+                (size_t)slots * CYLINDER_CACHE_SLOT_BYTES);
+            if (g_cylinder_cache_data) {
+                break;
+            }
+        }
+        if (g_cylinder_cache_data) {
+            g_cylinder_cache = (CylinderCacheSlot*)malloc(
+                slots * sizeof(CylinderCacheSlot));
+        }
+        if (!g_cylinder_cache) {
+            logmsg("ERROR: no memory for the cylinder cache");
+            platform_free_bulk(g_cylinder_cache_data);
+            g_cylinder_cache_data = nullptr;
+            return;
+        }
+    }
+
+    noInterrupts();
+    g_cylinder_cache_slots = slots;
+    cylinder_cache_clear();
+    interrupts();
+
+    logmsg("Cylinder cache: ", slots, " cylinders, ",
+           (int)((uint64_t)slots * CYLINDER_CACHE_SLOT_BYTES / 1024),
+           "KB in ",
+           platform_in_external_ram(g_cylinder_cache_data) ? "PSRAM"
+                                                           : "OCRAM");
+}
+
+void ansiDiskLogCacheStats() {
+    logmsg("Cylinder cache: ", g_cylinder_cache_stats.hits, " hits, ",
+           g_cylinder_cache_stats.misses, " misses, ",
+           g_cylinder_cache_stats.evictions, " evictions, ",
+           g_cylinder_cache_stats.read_misses, " read misses, ",
+           g_cylinder_cache_stats.flushes, " flushes, ",
+           g_cylinder_cache_stats.prefetches, " prefetches");
+    logmsg("Track load takes ", g_track_load_us, "us on average");
+}
+
+// Start loading a cylinder of the image into the cache in the background
+// (from ansiDiskPoll()).  A prefetch only takes a free slot or one of the
+// same device, so read-ahead on one drive never pushes out the cylinder
+// another drive is reading.
+static bool cylinder_cache_start_read(int ansi_id, uint16_t cylinder,
+                                      bool prefetch) {
+    // the bus interrupt stages cylinders too, and the LRU list and hash
+    // must not change under it (or it under the main loop)
+    uint32_t irq = platform_disable_interrupts();
+    int slot = cylinder_cache_find(ansi_id, cylinder);
+    if (slot >= 0) {
+        g_cylinder_cache_stats.hits++;
+    } else {
+        // the least recently used cylinder that has been flushed
+        slot = g_cylinder_cache_lru_tail;
+        while (slot >= 0 &&
+               (cylinder_cache_busy(g_cylinder_cache[slot]) ||
+                (prefetch && g_cylinder_cache[slot].ansi_id >= 0 &&
+                 g_cylinder_cache[slot].ansi_id != ansi_id))) {
+            slot = g_cylinder_cache[slot].lru_prev;
+        }
+        if (slot < 0) {
+            platform_restore_interrupts(irq);
+            return false;
+        }
+        g_cylinder_cache_stats.misses++;
+
+        CylinderCacheSlot& entry = g_cylinder_cache[slot];
+        if (entry.ansi_id >= 0) {
+            g_cylinder_cache_stats.evictions++;
+            cylinder_cache_hash_remove(slot);
+        }
+        entry.ansi_id = ansi_id;
+        entry.cylinder = cylinder;
+        entry.heads_loaded = 0;
+        entry.heads_queued = 0;
+        cylinder_cache_hash_insert(slot);
+    }
+    cylinder_cache_touch(slot);
+    platform_restore_interrupts(irq);
+    return true;
+}
+
+bool ansiDiskStartRead(int ansi_id, uint16_t cylinder) {
+    return cylinder_cache_start_read(ansi_id, cylinder, false);
+}
+
+static void cylinder_cache_written(void* context, bool ok, uint32_t) {
+    CylinderCacheSlot& entry = g_cylinder_cache[(intptr_t)context >> 8];
+    if (!ok) {
+        logmsg("ANSI", (uint8_t)entry.ansi_id, " write of cylinder ",
+               (int)entry.cylinder, " head ", (int)((intptr_t)context & 0xff),
+               " failed");
+    }
+    g_images_unsynced |= 1 << entry.ansi_id;
+    noInterrupts();
+    entry.writes_queued--;
+    interrupts();
+}
+
+// Queue writes of the runs of consecutive dirty sectors of a cached cylinder.
+// Returns false if the queue filled up first.
+static bool cylinder_cache_queue_flush(int slot) {
+    CylinderCacheSlot& entry = g_cylinder_cache[slot];
+
+    for (int head = 0; head < CYLINDER_CACHE_HEADS; head++) {
+        while (true) {
+            if (ansiIoPending(ANSI_IO_OPS) == ANSI_IO_QUEUE_REQUESTS) {
+                return false;
+            }
+
+            // a dirty slot keeps its cylinder, and the host rewriting a
+            // sector before it has been written out marks it dirty again.
+            noInterrupts();
+            uint32_t dirty = entry.dirty[head];
+            if (!dirty) {
+                interrupts();
+                break;
+            }
+            int8_t ansi_id = entry.ansi_id;
+            uint16_t cylinder = entry.cylinder;
+            int first = __builtin_ctz(dirty);
+            uint32_t clean = ~(dirty >> first);
+            int count = clean ? __builtin_ctz(clean) : 32 - first;
+            uint32_t run = (count == 32 ? ~0u : (1u << count) - 1) << first;
+            entry.dirty[head] = dirty & ~run;
+            entry.writes_queued++;
+            interrupts();
+
+            const AnsiDev* dev = &gAnsiDevs[ansi_id];
+            image_config_t& img = g_DiskImages[ansi_id];
+            uint32_t begin = first * dev->sector_bytes;
+            uint32_t end = (first + count) * dev->sector_bytes;
+            if (img.padded) {
+                // out to SD sector boundaries, the clean sectors (and
+                // padding) at either end come along from the cache
+                begin &= ~(uint32_t)(SD_SECTOR_SIZE - 1);
+                end = (end + SD_SECTOR_SIZE - 1) &
+                      ~(uint32_t)(SD_SECTOR_SIZE - 1);
+            }
+            uint8_t* track = cylinder_cache_sector(slot, dev, head, 0);
+            ansiIoSubmit(&img.file, ANSI_IO_WRITE,
+                         image_offset(ansi_id, cylinder, head, 0) + begin,
+                         track + begin, end - begin, cylinder_cache_written,
+                         cylinder_cache_io_context(slot, head));
+            g_cylinder_cache_stats.flushes++;
+        }
+    }
+    return true;
+}
+
+// Queue writes of the dirty cylinders of the devices in mask, the least
+// recently used first, or only of the first of them if `one`.  Returns false
+// if nothing was queued.
+static bool cylinder_cache_queue_flushes(uint8_t mask, bool one) {
+    if (!g_cylinder_cache_slots) {
         return false;
     }
 
+    // a dirty slot stays put, but the bus interrupt reorders the LRU list
+    // around it; the list is followed with interrupts off
+    int queued = ansiIoPending(ANSI_IO_WRITE);
+    noInterrupts();
+    int slot = g_cylinder_cache_lru_tail;
+    interrupts();
+    while (slot >= 0) {
+        CylinderCacheSlot& entry = g_cylinder_cache[slot];
+        if (cylinder_cache_dirty(entry) && (mask & (1 << entry.ansi_id))) {
+            if (!cylinder_cache_queue_flush(slot) || one) {
+                break;
+            }
+        }
+        noInterrupts();
+        slot = entry.lru_prev;
+        interrupts();
+    }
+    return ansiIoPending(ANSI_IO_WRITE) > queued;
+}
+
+// whether everything the host wrote to the cached cylinders of the devices
+// in mask has been written to their images
+static bool cylinder_cache_flushed(uint8_t mask) {
+    for (int slot = 0; slot < g_cylinder_cache_slots; slot++) {
+        const CylinderCacheSlot& entry = g_cylinder_cache[slot];
+        if (entry.ansi_id >= 0 && (mask & (1 << entry.ansi_id)) &&
+            (entry.writes_queued || cylinder_cache_dirty(entry))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Queue a sync of each image written since the last one.  Returns false if
+// the queue filled up first, the rest are left for the next call.
+static bool sync_images() {
+    for (uint8_t mask = g_images_unsynced; mask; mask &= mask - 1) {
+        int i = __builtin_ctz(mask);
+        if (g_DiskImages[i].file.isOpen() &&
+            !ansiIoSubmit(&g_DiskImages[i].file, ANSI_IO_SYNC, 0, nullptr, 0,
+                          nullptr, nullptr)) {
+            return false;
+        }
+        g_images_unsynced &= ~(1 << i);
+    }
     return true;
 }
 
+void ansiDiskFlushCache() {
+    // a queue full at a time
+    do {
+        ansiIoDrain();
+    } while (cylinder_cache_queue_flushes(0xff, false));
+    if (!sync_images()) {
+        ansiIoDrain();
+        sync_images();
+    }
+    ansiIoDrain();
+}
+
+static void cylinder_cache_loaded(void* context, bool ok, uint32_t elapsed) {
+    int slot = (intptr_t)context >> 8;
+    uint8_t head = (intptr_t)context & 0xff;
+    CylinderCacheSlot& entry = g_cylinder_cache[slot];
+    int8_t ansi_id = entry.ansi_id;
+    uint16_t cylinder = entry.cylinder;
+
+    if (ansi_id >= 0 && entry.heads_loaded == head) {
+        const AnsiDev* dev = &gAnsiDevs[ansi_id];
+        uint8_t* track = cylinder_cache_sector(slot, dev, head, 0);
+        if (!ok) {
+            logmsg("ANSI", (uint8_t)ansi_id, " read of cylinder ",
+                   (int)cylinder, " head ", head, " failed");
+            memset(track, 0, image_track_bytes(ansi_id));
+        }
+        // moving average over the last 8 or so loads
+        g_track_load_us = g_track_load_us - g_track_load_us / 8 + elapsed / 8;
+
+        for (uint8_t sector = 0; sector < dev->sectors; sector++) {
+            cylinder_cache_update_crc(slot, dev, head, sector);
+        }
+    }
+
+    noInterrupts();
+    // the device's cylinders may have been dropped in the meantime
+    if (ansi_id >= 0 && entry.ansi_id == ansi_id &&
+        entry.heads_loaded == head) {
+        const AnsiDev* dev = &gAnsiDevs[ansi_id];
+        // sectors written since are newer than what was just read
+        for (uint8_t i = g_write_ring_head; i != g_write_ring_tail;
+             i = (i + 1) % WRITE_RING_SECTORS) {
+            PendingSectorWrite& pending = g_write_ring[i];
+            if (pending.ansi_id == ansi_id && pending.cylinder == cylinder &&
+                pending.head == head) {
+                memcpy(cylinder_cache_sector(slot, dev, head, pending.sector),
+                       pending.data, dev->sector_bytes);
+                cylinder_cache_update_crc(slot, dev, head, pending.sector);
+            }
+        }
+        entry.heads_loaded = head + 1;
+    }
+    entry.reads_queued--;
+    interrupts();
+}
+
+// Queue loads of the tracks of the most recently staged cylinder that aren't
+// loaded yet, once the last cylinder's are done.  A cylinder of a .pimg image
+// then loads as a single read.  Returns false if there was nothing to load.
+static bool cylinder_cache_queue_loads() {
+    if (!g_cylinder_cache_slots || ansiIoPending(ANSI_IO_READ)) {
+        return false;
+    }
+
+    for (int slot = g_cylinder_cache_lru_head; slot >= 0;) {
+        CylinderCacheSlot& entry = g_cylinder_cache[slot];
+
+        noInterrupts();
+        int8_t ansi_id = entry.ansi_id;
+        uint16_t cylinder = entry.cylinder;
+        uint8_t head = entry.heads_queued;
+        uint8_t heads = ansi_id >= 0 ? gAnsiDevs[ansi_id].disk_type->heads : 0;
+        int next = entry.lru_next;
+        bool room =
+            ansiIoPending(ANSI_IO_OPS) + heads - head <= ANSI_IO_QUEUE_REQUESTS;
+        if (ansi_id >= 0 && head < heads && room) {
+            // the slot keeps its cylinder until they are done
+            entry.heads_queued = heads;
+            entry.reads_queued += heads - head;
+        }
+        interrupts();
+
+        if (ansi_id < 0) {
+            // unused slots are all at the end
+            break;
+        }
+        if (head >= heads) {
+            slot = next;
+            continue;
+        }
+        if (!room) {
+            return false;
+        }
+
+        const AnsiDev* dev = &gAnsiDevs[ansi_id];
+        image_config_t& img = g_DiskImages[ansi_id];
+        for (; head < heads; head++) {
+            // with the padding of a .pimg track, which flushes write back
+            ansiIoSubmit(&img.file, ANSI_IO_READ,
+                         image_offset(ansi_id, cylinder, head, 0),
+                         cylinder_cache_sector(slot, dev, head, 0),
+                         image_track_bytes(ansi_id), cylinder_cache_loaded,
+                         cylinder_cache_io_context(slot, head));
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool cylinder_cache_usable(uint8_t ansi_id) {
+    const AnsiDev* dev = &gAnsiDevs[ansi_id];
+    return g_cylinder_cache_slots && g_DiskImages[ansi_id].file.isOpen() &&
+           dev->disk_type && dev->disk_type->heads <= CYLINDER_CACHE_HEADS &&
+           dev->disk_type->heads * cylinder_cache_track_bytes(dev) <=
+               CYLINDER_CACHE_BYTES;
+}
+
+// Read-ahead, see TANSI_readahead.h.  The lead is [ANSIn] PrefetchBytes.
+//
+// written from the control bus interrupt in interrupt-driven mode
+static ReadAheadState g_readahead[NUM_ANSIID];
+
+// note a sector read by the host
+static void readahead_observe(uint8_t ansi_id, uint16_t cylinder,
+                              uint8_t head, uint8_t sector) {
+    readahead_observe(g_readahead[ansi_id], gAnsiDevs[ansi_id].disk_type,
+                      cylinder, head, sector);
+}
+
+// Stage the cylinder after the one a sequential reader is on once it is
+// within the lead of it.  Returns true if one was staged.
+static bool readahead_poll(uint8_t ansi_id) {
+    image_config_t& img = g_DiskImages[ansi_id];
+    if (img.prefetchbytes <= 0 || !cylinder_cache_usable(ansi_id)) {
+        return false;
+    }
+
+    noInterrupts();
+    ReadAheadState ra = g_readahead[ansi_id];
+    interrupts();
+
+    const AnsiDev* dev = &gAnsiDevs[ansi_id];
+    int cylinder = readahead_next_cylinder(
+        ra, dev->disk_type, img.prefetchbytes, track_bytes(dev),
+        g_track_load_us, ansi_rotation_revolution_us());
+    if (cylinder < 0) {
+        return false;
+    }
+
+    bool staged = false;
+    noInterrupts();
+    if (cylinder_cache_find(ansi_id, cylinder) < 0 &&
+        cylinder_cache_start_read(ansi_id, cylinder, true)) {
+        // the cylinder the host is on keeps loading first, and isn't the
+        // next to be replaced
+        int current = cylinder_cache_find(ansi_id, ra.cylinder);
+        if (current >= 0) {
+            cylinder_cache_touch(current);
+        }
+        staged = true;
+    }
+    interrupts();
+
+    if (staged) {
+        g_cylinder_cache_stats.prefetches++;
+        dbgmsg("ANSI", ansi_id, " read-ahead staging cylinder ",
+               (int)cylinder);
+    }
+    return staged;
+}
+
+// Storage hooks for the ANSI core (see ansi.h)
+bool ansi_storage_stage_cylinder(uint8_t ansi_id, uint16_t cylinder) {
+    if (cylinder_cache_usable(ansi_id)) {
+        ansiDiskStartRead(ansi_id, cylinder);
+    }
+    return ansi_storage_cylinder_staged(ansi_id, cylinder);
+}
+
+bool ansi_storage_cylinder_staged(uint8_t ansi_id, uint16_t cylinder) {
+    if (!cylinder_cache_usable(ansi_id)) {
+        // nothing is ever going to be staged, don't hold up the seek
+        return true;
+    }
+
+    int slot = cylinder_cache_find(ansi_id, cylinder);
+    if (slot < 0) {
+        // staging had to wait for a dirty cylinder to be flushed
+        ansiDiskStartRead(ansi_id, cylinder);
+        return false;
+    }
+    return g_cylinder_cache[slot].heads_loaded ==
+           gAnsiDevs[ansi_id].disk_type->heads;
+}
+
+void ansi_storage_flush(uint8_t ansi_id) { g_flush_requested |= 1 << ansi_id; }
+
+bool ansi_storage_flushed(uint8_t ansi_id) {
+    if (g_flush_requested & (1 << ansi_id)) {
+        return false;
+    }
+    for (uint8_t i = g_write_ring_head; i != g_write_ring_tail;
+         i = (i + 1) % WRITE_RING_SECTORS) {
+        if (g_write_ring[i].ansi_id == ansi_id) {
+            return false;
+        }
+    }
+    return cylinder_cache_flushed(1 << ansi_id);
+}
+
+uint8_t* ansi_storage_write_buffer(uint8_t ansi_id, uint16_t cylinder,
+                                   uint8_t head, uint8_t sector) {
+    uint8_t tail = g_write_ring_tail;
+    if ((tail + 1) % WRITE_RING_SECTORS == g_write_ring_head ||
+        !g_DiskImages[ansi_id].file.isWritable()) {
+        return nullptr;
+    }
+
+    PendingSectorWrite& pending = g_write_ring[tail];
+    pending.ansi_id = ansi_id;
+    pending.cylinder = cylinder;
+    pending.head = head;
+    pending.sector = sector;
+    return pending.data;
+}
+
+void ansi_storage_commit_write(uint8_t ansi_id) {
+    PendingSectorWrite& pending = g_write_ring[g_write_ring_tail];
+
+    int slot = cylinder_cache_usable(ansi_id)
+                   ? cylinder_cache_find(ansi_id, pending.cylinder)
+                   : -1;
+    if (slot >= 0 && g_cylinder_cache[slot].heads_loaded > pending.head) {
+        const AnsiDev* dev = &gAnsiDevs[ansi_id];
+        memcpy(cylinder_cache_sector(slot, dev, pending.head, pending.sector),
+               pending.data, dev->sector_bytes);
+        cylinder_cache_update_crc(slot, dev, pending.head, pending.sector);
+        g_cylinder_cache[slot].dirty[pending.head] |= 1u << pending.sector;
+        // the ring slot is free again
+        return;
+    }
+
+    g_write_ring_tail = (g_write_ring_tail + 1) % WRITE_RING_SECTORS;
+}
+
+// Write a sector the cylinder cache doesn't hold to the image.  In a .pimg
+// that is a read-modify-write of the SD sectors around it.
+static bool image_write_sector(const PendingSectorWrite& pending) {
+    image_config_t& img = g_DiskImages[pending.ansi_id];
+    uint64_t offset = image_offset(pending.ansi_id, pending.cylinder,
+                                   pending.head, pending.sector);
+    uint16_t bytes = gAnsiDevs[pending.ansi_id].sector_bytes;
+
+    if (!img.padded) {
+        return img.file.seek(offset) &&
+               img.file.write(pending.data, bytes) == bytes;
+    }
+
+    uint64_t begin = offset & ~(uint64_t)(SD_SECTOR_SIZE - 1);
+    uint32_t length = (offset - begin + bytes + SD_SECTOR_SIZE - 1) &
+                      ~(uint32_t)(SD_SECTOR_SIZE - 1);
+    if (!img.file.seek(begin) ||
+        img.file.read(g_pimg_bounce, length) != (ssize_t)length) {
+        return false;
+    }
+    memcpy(g_pimg_bounce + (offset - begin), pending.data, bytes);
+    return img.file.seek(begin) &&
+           img.file.write(g_pimg_bounce, length) == (ssize_t)length;
+}
+
+void ansiDiskPoll() {
+    while (g_write_ring_head != g_write_ring_tail) {
+        PendingSectorWrite& pending = g_write_ring[g_write_ring_head];
+        if (!image_write_sector(pending)) {
+            logmsg("ANSI", pending.ansi_id, " write of sector ",
+                   (int)sector_lba(pending.ansi_id, pending.cylinder,
+                                   pending.head, pending.sector),
+                   " failed");
+        }
+        g_images_unsynced |= 1 << pending.ansi_id;
+        g_write_ring_head = (g_write_ring_head + 1) % WRITE_RING_SECTORS;
+    }
+
+    // the geometry of a reformatted .pimg goes in its header
+    for (int i = 0; i < NUM_ANSIID; i++) {
+        image_config_t& img = g_DiskImages[i];
+        if (img.pimgHeaderDirty) {
+            img.pimgHeaderDirty = false;
+            if (!pimg_write_header(img)) {
+                logmsg("ANSI", (uint8_t)i, " write of the image header failed");
+            }
+            g_images_unsynced |= 1 << i;
+        }
+    }
+
+    uint8_t requested = g_flush_requested;
+    if (requested) {
+        cylinder_cache_queue_flushes(requested, false);
+        if (cylinder_cache_flushed(requested)) {
+            sync_images();
+            noInterrupts();
+            g_flush_requested &= ~requested;
+            interrupts();
+        }
+    } else if (ansi_bus_idle() && !ansiIoPending(ANSI_IO_WRITE)) {
+        // a cylinder at a time, so the host doesn't wait long behind the
+        // writes if it comes back
+        if (!cylinder_cache_queue_flushes(0xff, true)) {
+            sync_images();
+        }
+    }
+
+    for (int i = 0; i < NUM_ANSIID; i++) {
+        readahead_poll(i);
+    }
+    cylinder_cache_queue_loads();
+
+    // one transfer per call, so the main loop keeps going while a cylinder
+    // loads
+    ansiIoPoll();
+}
+
+// Sectors of staged tracks come straight from the cylinder cache.  Anything
+// else is a miss, the cylinder gets staged for the host's retry.
+const uint8_t* ansi_storage_sector_data(uint8_t ansi_id, uint16_t cylinder,
+                                        uint8_t head, uint8_t sector,
+                                        const uint8_t** crc) {
+    const AnsiDev* dev = &gAnsiDevs[ansi_id];
+    if (!cylinder_cache_usable(ansi_id)) {
+        return nullptr;
+    }
+
+    readahead_observe(ansi_id, cylinder, head, sector);
+
+    uint32_t irq = platform_disable_interrupts();
+    int slot = cylinder_cache_find(ansi_id, cylinder);
+    if (slot < 0 || g_cylinder_cache[slot].heads_loaded <= head) {
+        platform_restore_interrupts(irq);
+        g_cylinder_cache_stats.read_misses++;
+        ansi_storage_stage_cylinder(ansi_id, cylinder);
+        return nullptr;
+    }
+
+    cylinder_cache_touch(slot);
+    platform_restore_interrupts(irq);
+    *crc = cylinder_cache_crc(slot, head, sector);
+    return cylinder_cache_sector(slot, dev, head, sector);
+}
+
+// Drop everything cached for a device whose geometry changed.  The core has
+// waited for ansi_storage_flushed() first.
+void ansi_storage_geometry_changed(uint8_t ansi_id) {
+    uint32_t irq = platform_disable_interrupts();
+    for (int slot = 0; slot < g_cylinder_cache_slots; slot++) {
+        CylinderCacheSlot& entry = g_cylinder_cache[slot];
+        if (entry.ansi_id == ansi_id) {
+            cylinder_cache_hash_remove(slot);
+            entry.ansi_id = -1;
+            entry.heads_loaded = 0;
+            entry.heads_queued = 0;
+            memset((void*)entry.dirty, 0, sizeof(entry.dirty));
+            cylinder_cache_retire(slot);
+        }
+    }
+    g_readahead[ansi_id].run = 0;
+
+    // the header is written from ansiDiskPoll(), not with interrupts off
+    image_config_t& img = g_DiskImages[ansi_id];
+    const AnsiDev* dev = &gAnsiDevs[ansi_id];
+    bool header_changed =
+        img.padded && (img.pimg.sectors != dev->sectors ||
+                       img.pimg.sector_bytes != dev->sector_bytes);
+    if (header_changed) {
+        img.pimg.sectors = dev->sectors;
+        img.pimg.sector_bytes = dev->sector_bytes;
+        img.pimg.track_bytes =
+            pimg_track_bytes(dev->sectors, dev->sector_bytes);
+        img.pimgHeaderDirty = true;
+    }
+    platform_restore_interrupts(irq);
+
+    // a flat image only has the ini to keep its geometry
+    ansi_device_settings_t* cfg = g_ansi_settings.getDevice(ansi_id);
+    uint16_t ini_sectors =
+        cfg->sectorsPerTrack ? cfg->sectorsPerTrack : dev->disk_type->sectors;
+    uint16_t ini_sector_bytes =
+        cfg->bytesPerSector ? cfg->bytesPerSector : HARD_DISK_SECTOR_SIZE;
+    // a larger track moves everything after the first one further out
+    uint64_t needed = (img.padded ? img.pimg.data_offset : 0) +
+                      (uint64_t)dev->disk_type->cylinders *
+                          dev->disk_type->heads * image_track_bytes(ansi_id);
+    if (img.file.isOpen() && img.file.size() < needed) {
+        logmsg("---- WARNING: image is ", (uint32_t)img.file.size(),
+               " bytes, ", (int)dev->sectors, " sectors of ",
+               (int)dev->sector_bytes, " bytes need ", (uint32_t)needed,
+               ", tracks past its end will fail");
+    }
+
+    if (header_changed) {
+        logmsg("---- Geometry saved in the image header");
+    } else if (!img.padded && (dev->sectors != ini_sectors ||
+                               dev->sector_bytes != ini_sector_bytes)) {
+        logmsg("---- Set SectorsPerTrack and BytesPerSector in [ANSI",
+               ansi_id, "] to keep the geometry");
+    }
+}
+
+bool ansiDiskFilenameValid(const char* name) {
+    // Check file extension.  only `.img` and `.pimg` are permissible.
+    return has_extension(name, ".img") || has_extension(name, ".pimg");
+}
+
 // Load values for target configuration from given section if they exist.
 // Otherwise keep current settings.
 static void ansiDiskSetConfig(int ansi_id) {
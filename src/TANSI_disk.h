@@ -31,6 +31,7 @@
 
 #include "ImageBackingStore.h"
 #include "TANSI_config.h"
+#include "TANSI_pimg.h"
 #include <cstdint>
 
 // Extended configuration stored alongside the normal SCSI2SD target information
@@ -41,9 +42,16 @@ struct image_config_t //: public S2S_TargetCfg
     ImageBackingStore file;
 
     int ansi_id;
-    // Maximum amount of bytes to prefetch
+    // How far ahead of a sequential reader to stage tracks, in bytes
     int prefetchbytes;
 
+    // A .pimg image, laid out as its header says (see TANSI_pimg.h).  The
+    // header is rewritten by ansiDiskPoll() once the host has reformatted
+    // the device.
+    bool padded;
+    PimgHeader pimg;
+    volatile bool pimgHeaderDirty;
+
     // Warning about geometry settings
 
     bool geometrywarningprinted;
@@ -67,8 +75,8 @@ bool ansiDiskOpenHDDImage(int ansi_id, const char* filename, int blocksize);
 void ansiDiskLoadConfig(int ansi_id);
 
 // Checks if a filename extension is appropriate for further processing as a
-// disk image. The current implementation does not check the the filename prefix
-// for validity.
+// disk image (.img, or .pimg for the padded layout). The current
+// implementation does not check the the filename prefix for validity.
 bool ansiDiskFilenameValid(const char* name);
 
 // Returns true if there is at least one image active
@@ -77,10 +85,23 @@ bool ansiDiskCheckAnyImagesConfigured();
 // Get pointer to extended image configuration based on target idx
 image_config_t& ansiDiskGetImageConfig(int ansi_id);
 
-// Start data transfer from disk image to SCSI bus
-// Can be called by device type specific command implementations (such as READ
-// CD)
-void ansiDiskStartRead(uint32_t lba, uint32_t blocks);
+// Load staged cylinders and write what the host has written to the images.
+// Called from the main loop.
+void ansiDiskPoll();
+
+// (Re)size the cylinder cache to size_kb, or to most of the PSRAM (two
+// cylinders of OCRAM without it) if 0, and empty it.
+void ansiDiskInitCache(uint32_t size_kb);
+// log the cylinder cache hit/miss/eviction counters
+void ansiDiskLogCacheStats();
+
+// Write everything the host has written to the images now.
+void ansiDiskFlushCache();
+
+// Start loading a cylinder of the image into the cylinder cache.  The data
+// is read in the background by ansiDiskPoll().  Returns false if every
+// cached cylinder still has to be flushed; try again later.
+bool ansiDiskStartRead(int ansi_id, uint16_t cylinder);
 
 // Start data transfer from SCSI bus to disk image
 void ansiDiskStartWrite(uint32_t lba, uint32_t blocks);
@@ -0,0 +1,171 @@
+#include "TANSI_io.h"
+#include "TANSI_config.h"
+#include "TANSI_log.h"
+#include "TANSI_platform.h"
+
+struct IoRequest {
+    ImageBackingStore* file; // nullptr if the entry is free
+    AnsiIoOp op;
+    uint32_t seq; // queueing order
+    uint64_t offset;
+    uint8_t* buf;
+    uint32_t len;
+    AnsiIoCallback done;
+    void* context;
+};
+
+static IoRequest g_io_queue[ANSI_IO_QUEUE_REQUESTS];
+static uint32_t g_io_seq;
+static int g_io_pending[ANSI_IO_OPS + 1];
+// where the last write ended, the elevator carries on from there
+static ImageBackingStore* g_io_write_file;
+static uint64_t g_io_write_end;
+
+bool ansiIoSubmit(ImageBackingStore* file, AnsiIoOp op, uint64_t offset,
+                  uint8_t* buf, uint32_t len, AnsiIoCallback done,
+                  void* context) {
+    for (IoRequest& req : g_io_queue) {
+        if (!req.file) {
+            req = {file, op, g_io_seq++, offset, buf, len, done, context};
+            g_io_pending[op]++;
+            g_io_pending[ANSI_IO_OPS]++;
+            return true;
+        }
+    }
+    return false;
+}
+
+int ansiIoPending(uint8_t op) { return g_io_pending[op]; }
+
+// a sync has to wait for the writes of its image queued before it
+static bool sync_ready(const IoRequest& sync) {
+    for (const IoRequest& req : g_io_queue) {
+        if (req.file == sync.file && req.op == ANSI_IO_WRITE &&
+            (int32_t)(req.seq - sync.seq) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the request to start the next transfer with, or -1
+static int io_pick() {
+    int oldest_read = -1, sync = -1, next_write = -1, first_write = -1;
+    for (int i = 0; i < ANSI_IO_QUEUE_REQUESTS; i++) {
+        const IoRequest& req = g_io_queue[i];
+        if (!req.file) {
+            continue;
+        }
+        switch (req.op) {
+        case ANSI_IO_READ:
+            if (oldest_read < 0 ||
+                (int32_t)(req.seq - g_io_queue[oldest_read].seq) < 0) {
+                oldest_read = i;
+            }
+            break;
+        case ANSI_IO_SYNC:
+            if (sync < 0 && sync_ready(req)) {
+                sync = i;
+            }
+            break;
+        case ANSI_IO_WRITE:
+            // the lowest offset of the image at or past the last write, or
+            // the lowest of them all once the sweep is over
+            if (req.file == g_io_write_file && req.offset >= g_io_write_end &&
+                (next_write < 0 ||
+                 req.offset < g_io_queue[next_write].offset)) {
+                next_write = i;
+            }
+            if (first_write < 0 ||
+                req.offset < g_io_queue[first_write].offset) {
+                first_write = i;
+            }
+            break;
+        }
+    }
+    if (oldest_read >= 0) {
+        return oldest_read;
+    }
+    if (sync >= 0) {
+        return sync;
+    }
+    return next_write >= 0 ? next_write : first_write;
+}
+
+// the request carrying on from the end of this one, or -1
+static int io_follower(const IoRequest& req) {
+    for (int i = 0; i < ANSI_IO_QUEUE_REQUESTS; i++) {
+        const IoRequest& next = g_io_queue[i];
+        if (next.file == req.file && next.op == req.op &&
+            next.offset == req.offset + req.len &&
+            next.buf == req.buf + req.len) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool ansiIoPoll() {
+    int first = io_pick();
+    if (first < 0) {
+        return false;
+    }
+
+    IoRequest& req = g_io_queue[first];
+    int merged[ANSI_IO_QUEUE_REQUESTS];
+    int count = 1;
+    uint32_t len = req.len;
+    merged[0] = first;
+    if (req.op != ANSI_IO_SYNC) {
+        IoRequest span = req;
+        int next;
+        while ((next = io_follower(span)) >= 0) {
+            merged[count++] = next;
+            span.len += g_io_queue[next].len;
+        }
+        len = span.len;
+    }
+
+    uint32_t start = micros();
+    bool ok;
+    switch (req.op) {
+    case ANSI_IO_READ:
+        ok = req.file->seek(req.offset) &&
+             req.file->read(req.buf, len) == (ssize_t)len;
+        break;
+    case ANSI_IO_WRITE:
+        ok = req.file->seek(req.offset) &&
+             req.file->write(req.buf, len) == (ssize_t)len;
+        g_io_write_file = req.file;
+        g_io_write_end = req.offset + len;
+        break;
+    default:
+        req.file->flush();
+        ok = true;
+        break;
+    }
+    uint32_t elapsed = micros() - start;
+
+    // free the entries first, the callbacks may queue more
+    IoRequest done[ANSI_IO_QUEUE_REQUESTS];
+    for (int i = 0; i < count; i++) {
+        IoRequest& entry = g_io_queue[merged[i]];
+        done[i] = entry;
+        g_io_pending[entry.op]--;
+        g_io_pending[ANSI_IO_OPS]--;
+        entry.file = nullptr;
+    }
+    for (int i = 0; i < count; i++) {
+        if (done[i].done) {
+            done[i].done(done[i].context, ok,
+                         len ? (uint64_t)elapsed * done[i].len / len
+                             : elapsed);
+        }
+    }
+    return true;
+}
+
+void ansiIoDrain() {
+    while (ansiIoPoll()) {
+    }
+}
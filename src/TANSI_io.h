@@ -0,0 +1,45 @@
+// Queue of image reads, writes and syncs.  ansiDiskPoll() queues the track
+// loads and cache flushes it wants and ansiIoPoll() works through them a
+// transfer at a time, with the SD card's DMA waits yielding to the bus state
+// machine (see platform_set_sd_wait_hook()).
+//
+// Reads go first, in the order they were queued: the host waits on staged
+// cylinders.  Writes go in ascending offset order, sweeping across the image
+// like an elevator, and a sync waits for the writes of its image queued
+// before it.  Requests of the same image and direction whose offsets and
+// buffers both follow on from each other are merged into one transfer.
+
+#pragma once
+
+#include "ImageBackingStore.h"
+#include <cstdint>
+
+enum AnsiIoOp : uint8_t {
+    ANSI_IO_READ,
+    ANSI_IO_WRITE,
+    ANSI_IO_SYNC,
+};
+
+// Called from ansiIoPoll() once a request has been done, ok is false if it
+// failed.  elapsed_us is the request's share of its transfer's time.
+typedef void (*AnsiIoCallback)(void* context, bool ok, uint32_t elapsed_us);
+
+// a cylinder's tracks, flush runs and a sync of every image
+#define ANSI_IO_QUEUE_REQUESTS 32
+
+// Queue a request of `file`, len bytes at offset to or from buf for a read or
+// write.  buf has to stay put until the callback.  Returns false if the
+// queue is full.
+bool ansiIoSubmit(ImageBackingStore* file, AnsiIoOp op, uint64_t offset,
+                  uint8_t* buf, uint32_t len, AnsiIoCallback done,
+                  void* context);
+
+// Do the next transfer.  Returns false if nothing was queued.
+bool ansiIoPoll();
+
+// requests queued of op, or of any kind for ANSI_IO_OPS
+#define ANSI_IO_OPS 3
+int ansiIoPending(uint8_t op);
+
+// Do everything queued.
+void ansiIoDrain();
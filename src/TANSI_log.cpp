@@ -139,6 +139,79 @@ void log_raw(bytearray array) {
     }
 }
 
+// Deferred log records.  Any context (main loop or ISR) can push: a slot is
+// reserved by advancing the head with a CAS, filled in, and then marked
+// ready.  Only the main loop pops, in order, stopping at a slot that is
+// reserved but not ready yet.
+struct LogRecord {
+    volatile bool ready;
+    bool debug;
+    uint32_t millis;
+    log_format_fn format;
+    log_word_t args[LOG_DEFERRED_MAX_ARGS];
+};
+
+#define LOG_DEFERRED_RECORDS 256 // power of two
+
+bool g_log_deferred = false;
+volatile bool g_log_in_interrupt = false;
+PLATFORM_BULK_RAM static LogRecord g_log_records[LOG_DEFERRED_RECORDS];
+static uint32_t g_log_record_head;
+static uint32_t g_log_record_tail;
+static volatile uint32_t g_log_records_dropped;
+
+bool log_push_deferred(bool debug, log_format_fn format,
+                       const log_word_t* args) {
+    uint32_t head = __atomic_load_n(&g_log_record_head, __ATOMIC_RELAXED);
+    do {
+        uint32_t tail = __atomic_load_n(&g_log_record_tail, __ATOMIC_ACQUIRE);
+        if (head - tail >= LOG_DEFERRED_RECORDS) {
+            g_log_records_dropped++;
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&g_log_record_head, &head, head + 1,
+                                          true, __ATOMIC_ACQ_REL,
+                                          __ATOMIC_RELAXED));
+
+    LogRecord& r = g_log_records[head & (LOG_DEFERRED_RECORDS - 1)];
+    r.debug = debug;
+    r.millis = millis();
+    r.format = format;
+    for (int i = 0; i < LOG_DEFERRED_MAX_ARGS; i++) {
+        r.args[i] = args[i];
+    }
+    __atomic_store_n(&r.ready, true, __ATOMIC_RELEASE);
+    return true;
+}
+
+void log_drop_deferred() { g_log_records_dropped++; }
+
+void log_flush_deferred() {
+    uint32_t tail = g_log_record_tail;
+    while (tail != __atomic_load_n(&g_log_record_head, __ATOMIC_ACQUIRE)) {
+        LogRecord& r = g_log_records[tail & (LOG_DEFERRED_RECORDS - 1)];
+        if (!__atomic_load_n(&r.ready, __ATOMIC_ACQUIRE)) {
+            // still being filled in by an interrupted producer
+            break;
+        }
+
+        log_raw("[", (int)r.millis, r.debug ? "ms] DBG " : "ms] ");
+        r.format(r.args);
+        log_raw("\r\n");
+
+        r.ready = false;
+        tail++;
+        __atomic_store_n(&g_log_record_tail, tail, __ATOMIC_RELEASE);
+    }
+
+    if (g_log_records_dropped) {
+        uint32_t dropped = __atomic_exchange_n(&g_log_records_dropped, 0,
+                                               __ATOMIC_RELAXED);
+        log_raw("[", (int)millis(), "ms] ", (int)dropped,
+                " deferred log messages dropped\r\n");
+    }
+}
+
 uint32_t log_get_buffer_len() { return g_logpos; }
 
 const char* log_get_buffer(uint32_t* startpos, uint32_t* available) {
@@ -24,9 +24,12 @@
 
 #pragma once
 
+// millis(), from Arduino.h on the Teensy and the native platform otherwise
+#include "TANSI_platform.h"
 #include <cstddef>
 #include <cstdint>
 #include <string>
+#include <utility>
 
 // Get total number of bytes that have been written to log
 uint32_t log_get_buffer_len();
@@ -81,8 +84,98 @@ inline void log_raw(T first, T2 second, Rest... rest) {
     log_raw(rest...);
 }
 
+// Deferred logging.  When enabled, a message whose arguments are all plain
+// values (ints, bytes, const char*) is pushed into a lock-free ring as a
+// compact record: timestamp, a pointer to the formatting function for its
+// argument types, and the raw arguments.  log_flush_deferred() formats and
+// outputs the records later from the main loop, so logging from the bus
+// state machine or its ISR costs a few dozen cycles instead of a serial
+// write.  Messages with other arguments (std::string, bytearray, char*
+// buffers, ...) are still formatted immediately.
+//
+// While deferred logging is on, const char* arguments must point at strings
+// that outlive the message (literals, names in static tables); pass a char*
+// or std::string for anything else.
+extern bool g_log_deferred;
+
+// Set while the bus state machine runs from its interrupt.  Its messages are
+// deferred whether or not deferred logging is on, and dropped (counted like
+// those of a full ring) if they can't be: a serial write there could block,
+// or yield to the main loop's work from inside the interrupt.
+extern volatile bool g_log_in_interrupt;
+
+// Format and output every pending deferred message, called from the main
+// loop.  Must not be called from interrupt context.
+void log_flush_deferred();
+
+typedef uintptr_t log_word_t;
+typedef void (*log_format_fn)(const log_word_t* args);
+
+#define LOG_DEFERRED_MAX_ARGS 8
+
+// Push a record, returns false if the ring is full (the message is dropped
+// and counted.)
+bool log_push_deferred(bool debug, log_format_fn format,
+                       const log_word_t* args);
+// count a message dropped without trying
+void log_drop_deferred();
+
+// How each argument type is stored in a deferred record.  Types without a
+// specialization can't be deferred.
+template <typename T> struct log_arg {
+    static constexpr bool deferrable = false;
+};
+
+#define LOG_DEFERRABLE_ARG(T)                                                  \
+    template <> struct log_arg<T> {                                            \
+        static constexpr bool deferrable = true;                               \
+        static log_word_t pack(T v) { return (log_word_t)v; }                  \
+        static T unpack(log_word_t w) { return (T)w; }                         \
+    };
+LOG_DEFERRABLE_ARG(const char*)
+LOG_DEFERRABLE_ARG(uint8_t)
+LOG_DEFERRABLE_ARG(uint32_t)
+LOG_DEFERRABLE_ARG(int)
+#undef LOG_DEFERRABLE_ARG
+
+template <typename... Params> struct log_deferred {
+    static constexpr bool possible =
+        sizeof...(Params) <= LOG_DEFERRED_MAX_ARGS &&
+        (log_arg<Params>::deferrable && ...);
+
+    template <size_t... I>
+    static void format(const log_word_t* args, std::index_sequence<I...>) {
+        log_raw(log_arg<Params>::unpack(args[I])...);
+    }
+
+    static void format(const log_word_t* args) {
+        format(args, std::index_sequence_for<Params...>{});
+    }
+};
+
+// Returns true if the message was taken (or dropped) by the deferred log.
+template <typename... Params>
+inline bool log_defer(bool debug, Params... params) {
+    if constexpr (log_deferred<Params...>::possible) {
+        if (g_log_deferred || g_log_in_interrupt) {
+            const log_word_t args[LOG_DEFERRED_MAX_ARGS] = {
+                log_arg<Params>::pack(params)...};
+            log_push_deferred(debug, &log_deferred<Params...>::format, args);
+            return true;
+        }
+    }
+    if (g_log_in_interrupt) {
+        log_drop_deferred();
+        return true;
+    }
+    return false;
+}
+
 // Format a complete log message
 template <typename... Params> inline void logmsg(Params... params) {
+    if (log_defer(false, params...)) {
+        return;
+    }
     log_raw("[", (int)millis(), "ms] ");
     log_raw(params...);
     log_raw("\r\n");
@@ -91,6 +184,9 @@ template <typename... Params> inline void logmsg(Params... params) {
 // Format a complete debug message
 template <typename... Params> inline void dbgmsg(Params... params) {
     if (g_log_debug) {
+        if (log_defer(true, params...)) {
+            return;
+        }
         log_raw("[", (int)millis(), "ms] DBG ");
         log_raw(params...);
         log_raw("\r\n");
@@ -0,0 +1,77 @@
+// Padded image layout (.pimg).  Apollo sectors are 1056 bytes, so in a flat
+// .img hardly any sector or track starts on an SD sector boundary, and every
+// access straddles SD sectors (and can't use the raw block device path of
+// ImageBackingStore).  A .pimg starts with this header in its first SD
+// sector, followed by the tracks in cylinder, head order, each one an extent
+// of whole SD sectors holding the track's sectors back to back.  That wastes
+// less than an SD sector per track, and loading a track is a single aligned
+// multi-sector read.
+//
+// The header is little endian (both the Teensy and the workstations running
+// the converter are) and records the geometry the image is formatted with,
+// which is kept up to date when the host reformats it.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#define PIMG_MAGIC "TANSIPIM"
+#define PIMG_VERSION 1
+// tracks as extents of whole SD sectors, the only layout so far
+#define PIMG_LAYOUT_TRACK_EXTENTS 1
+#define PIMG_ALIGN 512
+#define PIMG_HEADER_BYTES PIMG_ALIGN
+
+struct PimgHeader {
+    char magic[8];
+    uint16_t version;
+    uint16_t layout;
+    uint16_t cylinders;
+    uint16_t heads;
+    uint16_t sectors; // per track
+    uint16_t sector_bytes;
+    // size of each track's extent, sectors * sector_bytes rounded up to
+    // PIMG_ALIGN
+    uint32_t track_bytes;
+    // offset of the first track
+    uint32_t data_offset;
+};
+static_assert(sizeof(PimgHeader) == 28, "PimgHeader is an on-disk format");
+
+static constexpr uint32_t pimg_track_bytes(uint16_t sectors,
+                                           uint16_t sector_bytes) {
+    return ((uint32_t)sectors * sector_bytes + PIMG_ALIGN - 1) &
+           ~(uint32_t)(PIMG_ALIGN - 1);
+}
+
+static inline void pimg_init_header(PimgHeader* h, uint16_t cylinders,
+                                    uint16_t heads, uint16_t sectors,
+                                    uint16_t sector_bytes) {
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, PIMG_MAGIC, sizeof(h->magic));
+    h->version = PIMG_VERSION;
+    h->layout = PIMG_LAYOUT_TRACK_EXTENTS;
+    h->cylinders = cylinders;
+    h->heads = heads;
+    h->sectors = sectors;
+    h->sector_bytes = sector_bytes;
+    h->track_bytes = pimg_track_bytes(sectors, sector_bytes);
+    h->data_offset = PIMG_HEADER_BYTES;
+}
+
+static inline bool pimg_header_valid(const PimgHeader* h) {
+    return !memcmp(h->magic, PIMG_MAGIC, sizeof(h->magic)) &&
+           h->version == PIMG_VERSION &&
+           h->layout == PIMG_LAYOUT_TRACK_EXTENTS && h->cylinders &&
+           h->heads && h->sectors && h->sector_bytes &&
+           h->track_bytes == pimg_track_bytes(h->sectors, h->sector_bytes) &&
+           h->data_offset % PIMG_ALIGN == 0 &&
+           h->data_offset >= PIMG_HEADER_BYTES;
+}
+
+// bytes an image with this header needs
+static inline uint64_t pimg_image_bytes(const PimgHeader* h) {
+    return h->data_offset +
+           (uint64_t)h->cylinders * h->heads * h->track_bytes;
+}
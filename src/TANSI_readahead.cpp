@@ -0,0 +1,64 @@
+#include "TANSI_readahead.h"
+
+static void next_track(const AnsiDiskType* type, uint16_t& cylinder,
+                       uint8_t& head) {
+    if (++head == type->heads) {
+        head = 0;
+        cylinder++;
+    }
+}
+
+void readahead_observe(ReadAheadState& ra, const AnsiDiskType* type,
+                       uint16_t cylinder, uint8_t head, uint8_t sector) {
+    uint16_t next_cylinder = ra.cylinder;
+    uint8_t next_head = ra.head;
+    next_track(type, next_cylinder, next_head);
+
+    if (cylinder == ra.cylinder && head == ra.head) {
+        if (sector == ra.sector) {
+            // a retry doesn't tell us anything
+            return;
+        }
+        if (sector < ra.sector || sector - ra.sector == ra.stride) {
+            // the next sector, or the next pass over an interleaved track
+            ra.run += ra.run < 255;
+        } else {
+            ra.stride = sector - ra.sector;
+            ra.run = 1;
+        }
+    } else if (cylinder == next_cylinder && head == next_head) {
+        ra.run += ra.run < 255;
+    } else {
+        ra.run = 0;
+    }
+
+    ra.cylinder = cylinder;
+    ra.head = head;
+    ra.sector = sector;
+}
+
+int readahead_next_cylinder(const ReadAheadState& ra,
+                            const AnsiDiskType* type, uint32_t prefetch_bytes,
+                            uint32_t track_bytes, uint32_t track_load_us,
+                            uint32_t revolution_us) {
+    if (ra.run < READAHEAD_MIN_RUN || prefetch_bytes == 0 ||
+        track_bytes == 0) {
+        return -1;
+    }
+
+    uint32_t tracks = (prefetch_bytes + track_bytes - 1) / track_bytes;
+    uint32_t track_read_us = ra.stride * revolution_us;
+    if (track_read_us && track_load_us / track_read_us + 1 > tracks) {
+        tracks = track_load_us / track_read_us + 1;
+    }
+
+    uint16_t cylinder = ra.cylinder;
+    uint8_t head = ra.head;
+    for (uint32_t i = 0; i < tracks && cylinder == ra.cylinder; i++) {
+        next_track(type, cylinder, head);
+    }
+    if (cylinder == ra.cylinder || cylinder >= type->cylinders) {
+        return -1;
+    }
+    return cylinder;
+}
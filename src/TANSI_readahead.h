@@ -0,0 +1,39 @@
+// Read-ahead.  The host's reads are followed per device, and once it has
+// read a few sectors in a row at a constant interleave (carrying on over
+// head and cylinder switches), the cylinder after the one it's on is staged
+// while it is still working its way through the tracks before it.  That way
+// a sequential scan finds the next cylinder loaded instead of missing and
+// losing a revolution (or the seek) to the SD card.
+//
+// This is only the prediction, the staging is done by ansiDiskPoll().
+
+#pragma once
+
+#include "disk_types.h"
+#include <cstdint>
+
+// reads in a row before the pattern counts as sequential
+#define READAHEAD_MIN_RUN 3
+
+struct ReadAheadState {
+    uint16_t cylinder;
+    uint8_t head;
+    uint8_t sector;
+    uint8_t stride; // sectors between consecutive reads, the interleave
+    uint8_t run;    // reads so far that followed the pattern
+};
+
+// note a sector read by the host
+void readahead_observe(ReadAheadState& ra, const AnsiDiskType* type,
+                       uint16_t cylinder, uint8_t head, uint8_t sector);
+
+// The cylinder to stage for a sequential reader, or -1 if it isn't one or
+// isn't yet within the lead of the next cylinder.
+//
+// The lead is prefetch_bytes of tracks, or more if loading a track
+// (track_load_us) takes longer than the host takes to read one: at an
+// interleave of n the host reads a track in n revolutions.
+int readahead_next_cylinder(const ReadAheadState& ra,
+                            const AnsiDiskType* type, uint32_t prefetch_bytes,
+                            uint32_t track_bytes, uint32_t track_load_us,
+                            uint32_t revolution_us);
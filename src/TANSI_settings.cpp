@@ -51,6 +51,7 @@ void TANSISettings::setDefaultDriveInfo(uint8_t ansiId,
     section[4] += ansiId;
 
     ansi_device_settings_t& cfgDev = m_dev[ansiId];
+    cfgDev.prefetchBytes = PREFETCH_BUFFER_SIZE;
 
     bool known_preset = false;
 
@@ -0,0 +1,227 @@
+#include "TANSI_vcd.h"
+#include "TANSI_config.h"
+#include "TANSI_log.h"
+#include "ansi.h"
+#include "trace.h"
+#include <SD.h>
+#include <SdFat.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+// VCD identifier codes.  The control bus is one vector, and the control lines
+// follow it in the bit order of the pin sample (bits 8-14).
+#define VCD_ID_CB "!"
+static const char* const control_ids[] = {
+    "\"", "#", "$", "%", "&", "'", "(",
+};
+static const char* const control_names[] = {
+    "select_out_attn_in_strobe",
+    "command_request",
+    "parameter_request",
+    "bus_direction_out",
+    "port_enable",
+    "read_gate",
+    "write_gate",
+};
+#define VCD_ID_COMMAND ")"
+#define VCD_ID_PARAM_OUT "*"
+#define VCD_ID_PARAM_IN "+"
+#define VCD_ID_COMMAND_DEV ","
+#define VCD_ID_ATTENTION "-"
+#define VCD_ID_TRIGGER "."
+// device states are "s0" to "s7"
+
+// Small write buffer so the file isn't written a line at a time.
+class VcdWriter {
+  public:
+    VcdWriter(FsFile& file) : m_file(file), m_len(0), m_ok(true) {}
+    ~VcdWriter() { flush(); }
+
+    void printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+    void vector(uint32_t value, int bits, const char* id) {
+        char digits[33];
+        for (int i = 0; i < bits; i++) {
+            digits[i] = (value >> (bits - 1 - i)) & 1 ? '1' : '0';
+        }
+        digits[bits] = '\0';
+        printf("b%s %s\n", digits, id);
+    }
+
+    void scalar(bool value, const char* id) {
+        printf("%c%s\n", value ? '1' : '0', id);
+    }
+
+    bool flush() {
+        if (m_len > 0 && m_file.write(m_buf, m_len) != m_len) {
+            m_ok = false;
+        }
+        m_len = 0;
+        return m_ok;
+    }
+
+  private:
+    FsFile& m_file;
+    char m_buf[512];
+    size_t m_len;
+    bool m_ok;
+};
+
+void VcdWriter::printf(const char* format, ...) {
+    if (m_len > sizeof(m_buf) - 128) {
+        flush();
+    }
+
+    va_list ap;
+    va_start(ap, format);
+    int len = vsnprintf(m_buf + m_len, sizeof(m_buf) - m_len, format, ap);
+    va_end(ap);
+
+    if (len > 0) {
+        m_len += (size_t)len < sizeof(m_buf) - m_len ? len
+                                                     : sizeof(m_buf) - m_len;
+    }
+}
+
+static void write_header(VcdWriter& vcd) {
+    vcd.printf("$version TANSI " TANSI_FW_VERSION " $end\n");
+    vcd.printf("$timescale 1ns $end\n");
+    vcd.printf("$scope module ansi $end\n");
+    // pins are raw levels, the ANSI bus is active low
+    vcd.printf("$var wire 8 " VCD_ID_CB " cb_n [7:0] $end\n");
+    for (int i = 0; i < 7; i++) {
+        vcd.printf("$var wire 1 %s %s_n $end\n", control_ids[i],
+                   control_names[i]);
+    }
+    vcd.printf("$var reg 8 " VCD_ID_COMMAND " command $end\n");
+    vcd.printf("$var reg 8 " VCD_ID_PARAM_OUT " param_out $end\n");
+    vcd.printf("$var reg 8 " VCD_ID_PARAM_IN " param_in $end\n");
+    vcd.printf("$var reg 3 " VCD_ID_COMMAND_DEV " command_dev $end\n");
+    vcd.printf("$var reg 8 " VCD_ID_ATTENTION " attention $end\n");
+    vcd.printf("$var wire 1 " VCD_ID_TRIGGER " trigger $end\n");
+    for (int i = 0; i < ANSI_MAX_DEVICES; i++) {
+        vcd.printf("$var reg 4 s%d dev%d_state $end\n", i, i);
+    }
+    vcd.printf("$upscope $end\n");
+    vcd.printf("$enddefinitions $end\n");
+
+    // nothing is known until the first event of each kind
+    vcd.printf("#0\n$dumpvars\n");
+    vcd.printf("bxxxxxxxx " VCD_ID_CB "\n");
+    for (int i = 0; i < 7; i++) {
+        vcd.printf("x%s\n", control_ids[i]);
+    }
+    vcd.printf("bxxxxxxxx " VCD_ID_COMMAND "\n");
+    vcd.printf("bxxxxxxxx " VCD_ID_PARAM_OUT "\n");
+    vcd.printf("bxxxxxxxx " VCD_ID_PARAM_IN "\n");
+    vcd.printf("bxxx " VCD_ID_COMMAND_DEV "\n");
+    vcd.printf("bxxxxxxxx " VCD_ID_ATTENTION "\n");
+    vcd.printf("0" VCD_ID_TRIGGER "\n");
+    for (int i = 0; i < ANSI_MAX_DEVICES; i++) {
+        vcd.printf("bxxxx s%d\n", i);
+    }
+    vcd.printf("$end\n");
+}
+
+// pins is the previous pin sample, or -1 before the first one
+static void write_event(VcdWriter& vcd, const AnsiTraceEvent& e, int& pins) {
+    switch (e.type) {
+    case ANSI_TRACE_PINS: {
+        uint16_t changed = pins < 0 ? 0x7fff : e.data ^ pins;
+        if (changed & 0xff) {
+            vcd.vector(e.data & 0xff, 8, VCD_ID_CB);
+        }
+        for (int i = 0; i < 7; i++) {
+            if (changed & (0x100 << i)) {
+                vcd.scalar(e.data & (0x100 << i), control_ids[i]);
+            }
+        }
+        pins = e.data;
+        break;
+    }
+    case ANSI_TRACE_STATE: {
+        char id[3] = {'s', (char)('0' + e.dev), '\0'};
+        vcd.vector(e.data, 4, id);
+        break;
+    }
+    case ANSI_TRACE_COMMAND:
+        vcd.vector(e.dev, 3, VCD_ID_COMMAND_DEV);
+        vcd.vector(e.data, 8, VCD_ID_COMMAND);
+        break;
+    case ANSI_TRACE_PARAM_OUT:
+        vcd.vector(e.data, 8, VCD_ID_PARAM_OUT);
+        break;
+    case ANSI_TRACE_PARAM_IN:
+        vcd.vector(e.data, 8, VCD_ID_PARAM_IN);
+        break;
+    case ANSI_TRACE_ATTENTION:
+        vcd.vector(e.data, 8, VCD_ID_ATTENTION);
+        break;
+    case ANSI_TRACE_TRIGGER:
+        vcd.scalar(true, VCD_ID_TRIGGER);
+        break;
+    }
+}
+
+static bool open_next_trace_file(FsFile& file, char* name, size_t size) {
+    for (int i = 0; i < 1000; i++) {
+        snprintf(name, size, TRACEFILE, i);
+        if (!SD.exists(name)) {
+            file = SD.sdfs.open(name, O_WRONLY | O_CREAT | O_TRUNC);
+            return file.isOpen();
+        }
+    }
+    return false;
+}
+
+bool tansi_write_trace_vcd() {
+    int trigger_command = g_ansi_trace_trigger_command;
+    bool recording = g_ansi_trace_enabled || ansi_trace_capture_ready();
+    ansi_trace_stop();
+
+    char name[32];
+    FsFile file;
+    if (!open_next_trace_file(file, name, sizeof(name))) {
+        logmsg("Failed to create trace file");
+        if (recording) {
+            ansi_trace_start(trigger_command);
+        }
+        return false;
+    }
+
+    uint32_t count = ansi_trace_count();
+    bool ok;
+    {
+        VcdWriter vcd(file);
+        write_header(vcd);
+
+        // Time is accumulated from cycle deltas, so the 32 bit counter
+        // wrapping (every ~7s at 600MHz) only matters for gaps longer than
+        // that between two events.  The first event is at time 0.
+        uint64_t cycles = 0;
+        uint64_t last_ns = 0;
+        int pins = -1;
+        for (uint32_t i = 0; i < count; i++) {
+            const AnsiTraceEvent& e = ansi_trace_event(i);
+            if (i > 0) {
+                cycles += e.cycles - ansi_trace_event(i - 1).cycles;
+            }
+            uint64_t ns = cycles * 1000 / platform_cycles_per_us();
+            if (ns != last_ns) {
+                vcd.printf("#%llu\n", (unsigned long long)ns);
+                last_ns = ns;
+            }
+            write_event(vcd, e, pins);
+        }
+        ok = vcd.flush();
+    }
+    file.close();
+
+    logmsg("Wrote ", (int)count, " trace events to ", name,
+           ok ? "" : " (write failed)");
+
+    if (recording) {
+        ansi_trace_start(trigger_command);
+    }
+    return ok;
+}
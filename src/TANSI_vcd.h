@@ -0,0 +1,9 @@
+// Export of the ANSI protocol trace (lib/ANSI_core/trace.h) as a VCD file,
+// which PulseView and GTKWave can open.
+
+#pragma once
+
+// Stop the trace, write it to the next free TRACEFILE on the SD card and, if
+// it was recording, start again with the same trigger.  Returns false if the
+// file couldn't be written.
+bool tansi_write_trace_vcd();
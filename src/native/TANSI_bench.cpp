@@ -0,0 +1,258 @@
+// Command and data path benchmark: drives ANSI_core through the host model
+// of TANSI_host.h with a scripted workload and reports commands/sec, bus
+// handshakes per command and sectors/sec.
+//
+//   tansi_bench [-i] [-l] [-t disk type] [-turbo] [-crc] [-rotation]
+//               [-n count] [-w workload] image
+//
+// -i runs the bus interrupt-driven, -l dumps the latency histograms of the
+// run at the end, -turbo and -crc set TurboSeek and SectorCRC, and -rotation
+// waits for each sector to come under the heads (without it a transfer takes
+// whichever sector is there, which measures the data path rather than the
+// modelled rotation).  Workloads:
+//
+//   seq          read count sectors in order, track after track
+//   random       count seeks to random cylinders, reading a sector at each
+//   write        write count sectors in order
+//   replay:file  run the commands in file, one per line:
+//                  seek <cylinder> / head <head> / read <sector|*> /
+//                  write <sector|*> / cmd <hex code> [<hex param>]
+//                a boot (or any other) trace is replayed by writing out its
+//                commands in this form.
+
+#include "TANSI_host.h"
+#include "TANSI_log.h"
+#include "TANSI_platform.h"
+#include "TANSI_sim.h"
+#include "ansi.h"
+#include "crc.h"
+#include "latency.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+struct BenchGeometry {
+    uint16_t cylinders;
+    uint8_t heads;
+    uint16_t sectors;
+    uint16_t sector_bytes;
+};
+
+static BenchGeometry g_geometry;
+static bool g_wait_for_rotation;
+static uint8_t g_sector[HARD_DISK_SECTOR_SIZE * 2];
+
+// the geometry the way a host finds it out, from the device attributes
+static bool read_geometry() {
+    uint8_t a[0x23] = {0};
+    static const uint8_t numbers[] = {0x14, 0x15, 0x17, 0x18,
+                                      0x20, 0x21, 0x22};
+    for (uint8_t n : numbers) {
+        if (!ansi_host_report_attribute(n, &a[n])) {
+            return false;
+        }
+    }
+    g_geometry.sector_bytes = (a[0x14] << 8) | a[0x15];
+    g_geometry.sectors = (a[0x17] << 8) | a[0x18];
+    g_geometry.cylinders = (a[0x20] << 8) | a[0x21];
+    g_geometry.heads = a[0x22];
+    return g_geometry.sector_bytes && g_geometry.sectors &&
+           g_geometry.cylinders && g_geometry.heads;
+}
+
+static int next_sector(uint32_t i) {
+    return g_wait_for_rotation ? (int)(i % g_geometry.sectors) : -1;
+}
+
+static uint32_t write_bytes() {
+    return g_geometry.sector_bytes + (g_ansi_sector_crc ? ANSI_CRC_BYTES : 0);
+}
+
+static bool write_sector(int sector) {
+    uint32_t len = g_geometry.sector_bytes;
+    if (g_ansi_sector_crc) {
+        ansi_crc16_store(ansi_crc16(ANSI_CRC_INIT, g_sector, len),
+                         g_sector + len);
+    }
+    return ansi_host_write_sector(sector, g_sector, write_bytes());
+}
+
+static bool read_sector(int sector) {
+    uint32_t received;
+    return ansi_host_read_sector(sector, g_sector, g_geometry.sector_bytes,
+                                 &received);
+}
+
+// go through count sectors in order, seeking and switching heads as needed
+static void run_sequential(uint32_t count, bool write) {
+    uint32_t per_cylinder = (uint32_t)g_geometry.heads * g_geometry.sectors;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t track = i / g_geometry.sectors;
+        if (i % per_cylinder == 0) {
+            ansi_host_seek((i / per_cylinder) % g_geometry.cylinders);
+        }
+        if (i % g_geometry.sectors == 0) {
+            ansi_host_select_head(track % g_geometry.heads);
+        }
+        if (write) {
+            write_sector(next_sector(i));
+        } else {
+            read_sector(next_sector(i));
+        }
+    }
+}
+
+static void run_random(uint32_t count) {
+    srand(1);
+    for (uint32_t i = 0; i < count; i++) {
+        ansi_host_seek(rand() % g_geometry.cylinders);
+        ansi_host_select_head(rand() % g_geometry.heads);
+        read_sector(g_wait_for_rotation ? rand() % g_geometry.sectors : -1);
+    }
+}
+
+static int replay_sector(const char* arg) {
+    return strcmp(arg, "*") ? atoi(arg) : -1;
+}
+
+static bool run_replay(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "can't open %s\n", path);
+        return false;
+    }
+
+    char line[128];
+    while (fgets(line, sizeof(line), f)) {
+        char op[16], arg1[16] = "", arg2[16] = "";
+        if (sscanf(line, "%15s %15s %15s", op, arg1, arg2) < 1 ||
+            op[0] == '#') {
+            continue;
+        }
+        if (!strcmp(op, "seek")) {
+            ansi_host_seek(atoi(arg1));
+        } else if (!strcmp(op, "head")) {
+            ansi_host_select_head(atoi(arg1));
+        } else if (!strcmp(op, "read")) {
+            read_sector(replay_sector(arg1));
+        } else if (!strcmp(op, "write")) {
+            write_sector(replay_sector(arg1));
+        } else if (!strcmp(op, "cmd")) {
+            uint8_t cmd = strtoul(arg1, nullptr, 16);
+            if (command_is_param_out(cmd)) {
+                ansi_host_command_out(cmd, strtoul(arg2, nullptr, 16));
+            } else {
+                uint8_t param_in;
+                ansi_host_command(cmd, &param_in);
+            }
+        } else {
+            fprintf(stderr, "%s: unknown command %s\n", path, op);
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int main(int argc, char** argv) {
+    const AnsiDiskType* disk_type = &g_disk_types[0];
+    bool interrupt_driven = false;
+    bool dump_latency = false;
+    uint32_t count = 10000;
+    const char* workload = "seq";
+    const char* image = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-i")) {
+            interrupt_driven = true;
+        } else if (!strcmp(argv[i], "-l")) {
+            dump_latency = true;
+        } else if (!strcmp(argv[i], "-turbo")) {
+            g_ansi_turbo_seek = true;
+        } else if (!strcmp(argv[i], "-crc")) {
+            g_ansi_sector_crc = true;
+        } else if (!strcmp(argv[i], "-rotation")) {
+            g_wait_for_rotation = true;
+        } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            disk_type = ansi_find_disk_type(argv[++i]);
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            count = strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+            workload = argv[++i];
+        } else {
+            image = argv[i];
+        }
+    }
+    if (!image || !disk_type) {
+        fprintf(stderr,
+                "usage: %s [-i] [-l] [-t disk type] [-turbo] [-crc] "
+                "[-rotation] [-n count] [-w seq|random|write|replay:file] "
+                "image\n",
+                argv[0]);
+        return 1;
+    }
+
+    platform_init();
+    ansi_reset_devices();
+    if (!platform_sim_storage_open(0, image)) {
+        return 1;
+    }
+    ansi_configure_device(0, disk_type);
+    ansi_set_interrupt_driven(interrupt_driven);
+
+    ansi_host_connect();
+    if (!ansi_host_select(0) || !read_geometry()) {
+        fprintf(stderr, "device 0 doesn't respond\n");
+        return 1;
+    }
+    logmsg(disk_type->name, ": ", (int)g_geometry.cylinders, " cylinders, ",
+           (int)g_geometry.heads, " heads, ", (int)g_geometry.sectors,
+           " sectors of ", (int)g_geometry.sector_bytes, " bytes");
+
+    ansi_latency_reset();
+    g_ansi_host_stats = AnsiHostStats{};
+    uint64_t start = now_us();
+
+    if (!strcmp(workload, "seq")) {
+        run_sequential(count, false);
+    } else if (!strcmp(workload, "write")) {
+        run_sequential(count, true);
+    } else if (!strcmp(workload, "random")) {
+        run_random(count);
+    } else if (!strncmp(workload, "replay:", 7)) {
+        if (!run_replay(workload + 7)) {
+            return 1;
+        }
+    } else {
+        fprintf(stderr, "unknown workload %s\n", workload);
+        return 1;
+    }
+
+    double seconds = (now_us() - start) / 1e6;
+    const AnsiHostStats& s = g_ansi_host_stats;
+    uint32_t sectors = s.sectors_read + s.sectors_written;
+    log_flush_deferred();
+    printf("workload %s (%s, %s seeks%s): %.3fs\n", workload,
+           interrupt_driven ? "interrupt-driven" : "polled",
+           g_ansi_turbo_seek ? "turbo" : "modelled",
+           g_wait_for_rotation ? ", rotation" : "", seconds);
+    printf("  commands     %10u  %12.0f/s\n", s.commands,
+           s.commands / seconds);
+    printf("  handshakes   %10u  %12.2f/command\n", s.handshakes,
+           s.commands ? (double)s.handshakes / s.commands : 0.0);
+    printf("  sectors      %10u  %12.0f/s\n", sectors, sectors / seconds);
+    printf("  errors       %10u\n", s.errors);
+
+    if (dump_latency) {
+        ansi_latency_dump();
+        log_flush_deferred();
+    }
+    fflush(stdout);
+    return s.errors != 0;
+}
@@ -0,0 +1,201 @@
+#include "TANSI_host.h"
+
+#include "TANSI_platform.h"
+#include "TANSI_sim.h"
+#include "ansi.h"
+#include "rotation.h"
+
+AnsiHostStats g_ansi_host_stats;
+
+// bits of the host line sample, see AnsiOutPins
+#define HOST_CONTROL_BUS 0x00ff
+#define HOST_SELECT_OUT_ATTN_IN_STROBE (1 << 8)
+#define HOST_COMMAND_REQUEST (1 << 9)
+#define HOST_PARAMETER_REQUEST (1 << 10)
+#define HOST_BUS_DIRECTION_OUT (1 << 11)
+#define HOST_PORT_ENABLE (1 << 12)
+#define HOST_READ_GATE (1 << 13)
+#define HOST_WRITE_GATE (1 << 14)
+#define HOST_ALL_LINES 0x7fff
+
+// raw levels, a 0 bit is an active line
+static uint16_t g_host_pins = HOST_ALL_LINES;
+
+// a state change takes at most this many polls to settle
+#define HOST_MAX_SETTLE_POLLS 16
+
+static void settle() {
+    for (int i = 0; i < HOST_MAX_SETTLE_POLLS; i++) {
+        AnsiDevState before[ANSI_MAX_DEVICES];
+        for (int id = 0; id < ANSI_MAX_DEVICES; id++) {
+            before[id] = gAnsiDevs[id].state;
+        }
+
+        ansi_poll();
+
+        bool changed = false;
+        for (int id = 0; id < ANSI_MAX_DEVICES; id++) {
+            changed |= gAnsiDevs[id].state != before[id];
+        }
+        if (!changed) {
+            return;
+        }
+    }
+}
+
+// Make the host lines `active` active and `inactive` inactive, and let the
+// devices respond.
+static void handshake(uint16_t active, uint16_t inactive) {
+    g_host_pins = (g_host_pins | inactive) & ~active;
+    platform_sim_set_host_pins(g_host_pins);
+    g_ansi_host_stats.handshakes++;
+    settle();
+}
+
+// put a byte on the control bus along with the next handshake (the bus is
+// active low)
+static void drive_control_bus(uint8_t value) {
+    g_host_pins = (g_host_pins & ~HOST_CONTROL_BUS) | (uint8_t)~value;
+}
+
+static bool device_pin_active(uint8_t pin) {
+    return platform_read_pin(pin) == 0;
+}
+
+static bool check_acknowledge() {
+    if (device_pin_active(ANSI_BUS_ACKNOWLEDGE)) {
+        return true;
+    }
+    g_ansi_host_stats.errors++;
+    return false;
+}
+
+void ansi_host_connect() {
+    g_host_pins = HOST_ALL_LINES;
+    drive_control_bus(0);
+    handshake(HOST_PORT_ENABLE | HOST_BUS_DIRECTION_OUT, 0);
+}
+
+void ansi_host_disconnect() { handshake(0, HOST_ALL_LINES); }
+
+bool ansi_host_select(uint8_t id) {
+    drive_control_bus(1 << id);
+    handshake(HOST_SELECT_OUT_ATTN_IN_STROBE, 0);
+    bool acknowledged = check_acknowledge();
+    handshake(0, HOST_SELECT_OUT_ATTN_IN_STROBE);
+    return acknowledged;
+}
+
+bool ansi_host_command(uint8_t cmd, uint8_t* param_in) {
+    g_ansi_host_stats.commands++;
+
+    drive_control_bus(cmd);
+    handshake(HOST_COMMAND_REQUEST, 0);
+    bool acknowledged = check_acknowledge();
+
+    // turn the bus around and ask for the parameter
+    handshake(0, HOST_COMMAND_REQUEST | HOST_BUS_DIRECTION_OUT);
+    handshake(HOST_PARAMETER_REQUEST, 0);
+    *param_in = platform_sim_control_bus_byte();
+    handshake(HOST_BUS_DIRECTION_OUT, HOST_PARAMETER_REQUEST);
+    return acknowledged;
+}
+
+bool ansi_host_command_out(uint8_t cmd, uint8_t param_out) {
+    g_ansi_host_stats.commands++;
+
+    drive_control_bus(cmd);
+    handshake(HOST_COMMAND_REQUEST, 0);
+    bool acknowledged = check_acknowledge();
+    handshake(0, HOST_COMMAND_REQUEST);
+
+    drive_control_bus(param_out);
+    handshake(HOST_PARAMETER_REQUEST, 0);
+    acknowledged &= check_acknowledge();
+    handshake(0, HOST_PARAMETER_REQUEST);
+    return acknowledged;
+}
+
+uint8_t ansi_host_poll_attention() {
+    handshake(HOST_SELECT_OUT_ATTN_IN_STROBE, HOST_BUS_DIRECTION_OUT);
+    uint8_t attention = platform_sim_control_bus_byte();
+    handshake(HOST_BUS_DIRECTION_OUT, HOST_SELECT_OUT_ATTN_IN_STROBE);
+    return attention;
+}
+
+bool ansi_host_wait_attention(uint32_t timeout_ms) {
+    uint32_t start = millis();
+    while (!device_pin_active(ANSI_ATTENTION)) {
+        if (millis() - start >= timeout_ms) {
+            g_ansi_host_stats.errors++;
+            return false;
+        }
+        ansi_poll();
+    }
+
+    ansi_host_poll_attention();
+    uint8_t status;
+    ansi_host_command(ANSI_CMD_CLEAR_ATTENTION, &status);
+    return true;
+}
+
+bool ansi_host_seek(uint16_t cylinder) {
+    uint8_t status;
+    if (!ansi_host_command_out(ANSI_CMD_LOAD_CYL_ADDR_HIGH, cylinder >> 8) ||
+        !ansi_host_command_out(ANSI_CMD_LOAD_CYL_ADDR_LOW, cylinder & 0xff) ||
+        !ansi_host_command(ANSI_CMD_SEEK, &status)) {
+        return false;
+    }
+    if (status & GS_ILLEGAL_PARAMETER) {
+        g_ansi_host_stats.errors++;
+        ansi_host_command(ANSI_CMD_CLEAR_FAULT, &status);
+        return false;
+    }
+    // the seek model tops out well under a second
+    return ansi_host_wait_attention(1000);
+}
+
+bool ansi_host_select_head(uint8_t head) {
+    return ansi_host_command_out(ANSI_CMD_SELECT_HEAD, head);
+}
+
+// wait for a sector to come under the heads, the way a controller counting
+// the INDEX and SECTOR_MARK pulses would know
+static void wait_for_sector(int sector) {
+    if (sector < 0) {
+        return;
+    }
+    while (ansi_rotation_sector() != sector) {
+        ansi_poll();
+    }
+}
+
+bool ansi_host_read_sector(int sector, uint8_t* data, uint32_t len,
+                           uint32_t* received) {
+    wait_for_sector(sector);
+    handshake(HOST_READ_GATE, 0);
+    *received = platform_sim_read_data_available();
+    platform_sim_read_data(data, len);
+    handshake(0, HOST_READ_GATE);
+
+    if (*received < len) {
+        g_ansi_host_stats.errors++;
+        return false;
+    }
+    g_ansi_host_stats.sectors_read++;
+    return true;
+}
+
+bool ansi_host_write_sector(int sector, const uint8_t* data, uint32_t len) {
+    wait_for_sector(sector);
+    handshake(HOST_WRITE_GATE, 0);
+    platform_sim_write_data(data, len);
+    handshake(0, HOST_WRITE_GATE);
+    g_ansi_host_stats.sectors_written++;
+    return true;
+}
+
+bool ansi_host_report_attribute(uint8_t number, uint8_t* value) {
+    return ansi_host_command_out(ANSI_CMD_LOAD_ATTRIBUTE_NUMBER, number) &&
+           ansi_host_command(ANSI_CMD_REPORT_ATTRIBUTE, value);
+}
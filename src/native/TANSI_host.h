@@ -0,0 +1,65 @@
+// Model of the host side of the ANSI X3.101 bus, driving the device state
+// machines through the simulated pins of TANSI_platform_native.
+//
+// Each handshake is a change of the host's lines, after which the model lets
+// the devices settle (calling ansi_poll() until none of them changes state,
+// or just once in interrupt-driven mode, where the edge has already been
+// handled) before it looks at their response.  BUS_ACKNOWLEDGE is checked
+// after the strobes and requests, but as the device doesn't release it yet
+// the model can't wait for it to go away.
+//
+// Sector timing comes from the rotation the devices share: a read or write
+// of a given sector first waits for it to come under the heads, the way a
+// controller counting SECTOR_MARK pulses would.
+
+#pragma once
+
+#include <cstdint>
+
+struct AnsiHostStats {
+    uint32_t commands;
+    // host line changes, including those of selections, attention polls
+    // and read/write gates
+    uint32_t handshakes;
+    uint32_t sectors_read;
+    uint32_t sectors_written;
+    // missing acknowledges, illegal parameters, short sectors, timeouts
+    uint32_t errors;
+};
+
+extern AnsiHostStats g_ansi_host_stats;
+
+// Enable the port with every line inactive.
+void ansi_host_connect();
+void ansi_host_disconnect();
+
+// Select device `id`, false if it doesn't acknowledge.
+bool ansi_host_select(uint8_t id);
+
+// A command that returns a parameter byte (command codes 0x00-0x3f).
+bool ansi_host_command(uint8_t cmd, uint8_t* param_in);
+// A command that takes a parameter byte (command codes 0x40-0x7f).
+bool ansi_host_command_out(uint8_t cmd, uint8_t param_out);
+
+// The attention byte, one bit per device with its attention condition set.
+uint8_t ansi_host_poll_attention();
+
+// Wait up to timeout_ms for the ATTENTION line, then poll and clear the
+// attention condition of the selected device.  False if it didn't come up.
+bool ansi_host_wait_attention(uint32_t timeout_ms);
+
+// Seek the selected device and wait for it to finish.
+bool ansi_host_seek(uint16_t cylinder);
+bool ansi_host_select_head(uint8_t head);
+
+// Read or write a sector of the selected cylinder and head.  A sector of -1
+// takes whichever one is under the heads without waiting.  Reads store up to
+// len bytes of what the device sends (the whole framed sector, data field
+// included) and set *received to how many it sent; writes send len bytes
+// after the sync byte.
+bool ansi_host_read_sector(int sector, uint8_t* data, uint32_t len,
+                           uint32_t* received);
+bool ansi_host_write_sector(int sector, const uint8_t* data, uint32_t len);
+
+// Read a device attribute.
+bool ansi_host_report_attribute(uint8_t number, uint8_t* value);
@@ -0,0 +1,69 @@
+// Runs ANSI_core natively against the simulated pins of
+// lib/TANSI_platform_native, with the images given on the command line as
+// ANSI ids 0, 1, ...  Something driving the host side through TANSI_sim.h
+// can then be linked in, and the state machine profiled and debugged on a
+// workstation.
+//
+//   tansi_native [-i] [-t disk type] image...
+//
+// -i switches to the interrupt-driven bus mode, -t sets the disk type of the
+// images that follow it.  Type q to quit, l to dump the latency histograms.
+
+#include "TANSI_log.h"
+#include "TANSI_platform.h"
+#include "TANSI_sim.h"
+#include "ansi.h"
+#include "latency.h"
+
+#include <cstdio>
+#include <cstring>
+
+int main(int argc, char** argv) {
+    platform_init();
+    platform_late_init();
+
+    ansi_reset_devices();
+
+    const AnsiDiskType* disk_type = &g_disk_types[0];
+    bool interrupt_driven = false;
+    uint8_t id = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-i")) {
+            interrupt_driven = true;
+        } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            disk_type = ansi_find_disk_type(argv[++i]);
+            if (!disk_type) {
+                fprintf(stderr, "unknown disk type %s\n", argv[i]);
+                return 1;
+            }
+        } else if (id < ANSI_MAX_DEVICES) {
+            if (!platform_sim_storage_open(id, argv[i])) {
+                return 1;
+            }
+            logmsg("---- Emulating ", disk_type->name, " at ANSI ID ", id);
+            ansi_configure_device(id, disk_type);
+            id++;
+        }
+    }
+
+    if (!id) {
+        fprintf(stderr, "usage: %s [-i] [-t disk type] image...\n", argv[0]);
+        return 1;
+    }
+
+    ansi_set_interrupt_driven(interrupt_driven);
+
+    while (true) {
+        platform_poll();
+        ansi_poll();
+        log_flush_deferred();
+
+        switch (platform_console_getc()) {
+        case 'q':
+            return 0;
+        case 'l':
+            ansi_latency_dump();
+            break;
+        }
+    }
+}
@@ -0,0 +1,175 @@
+// Converts between flat .img images and the padded .pimg layout of
+// TANSI_pimg.h.
+//
+//   tansi_pimg pack [-t disk type] [-s sectors] [-b bytes] in.img out.pimg
+//   tansi_pimg unpack in.pimg out.img
+//
+// pack lays the image out as a disk of the given type (the first, largest,
+// one by default) formatted with -s sectors of -b bytes per track (the
+// type's own format by default).  An image shorter than that is padded with
+// zeros.  unpack writes the sectors back out without the padding.
+
+#include "TANSI_pimg.h"
+#include "ansi.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+
+static char g_track[pimg_track_bytes(ANSI_MAX_SECTORS_PER_TRACK,
+                                     HARD_DISK_SECTOR_SIZE)];
+
+static int usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s pack [-t disk type] [-s sectors] [-b bytes] in.img "
+            "out.pimg\n"
+            "       %s unpack in.pimg out.img\n",
+            argv0, argv0);
+    return 1;
+}
+
+static bool write_header(FILE* out, const PimgHeader* h) {
+    char header[PIMG_HEADER_BYTES] = {0};
+    memcpy(header, h, sizeof(*h));
+    return fwrite(header, sizeof(header), 1, out) == 1;
+}
+
+static int pack(FILE* in, FILE* out, const AnsiDiskType* disk_type,
+                uint16_t sectors, uint16_t sector_bytes) {
+    PimgHeader h;
+    pimg_init_header(&h, disk_type->cylinders, disk_type->heads, sectors,
+                     sector_bytes);
+    uint32_t bytes = (uint32_t)sectors * sector_bytes;
+
+    struct stat st;
+    uint64_t flat_bytes = (uint64_t)h.cylinders * h.heads * bytes;
+    if (fstat(fileno(in), &st) == 0 && (uint64_t)st.st_size > flat_bytes) {
+        fprintf(stderr, "image is %llu bytes, a %s of %u sectors of %u bytes "
+                        "only holds %llu\n",
+                (unsigned long long)st.st_size, disk_type->name, sectors,
+                sector_bytes, (unsigned long long)flat_bytes);
+        return 1;
+    }
+
+    if (!write_header(out, &h)) {
+        perror("write");
+        return 1;
+    }
+    bool short_image = false;
+    for (uint32_t track = 0; track < (uint32_t)h.cylinders * h.heads;
+         track++) {
+        memset(g_track, 0, h.track_bytes);
+        if (fread(g_track, 1, bytes, in) != bytes) {
+            short_image = true;
+        }
+        if (fwrite(g_track, h.track_bytes, 1, out) != 1) {
+            perror("write");
+            return 1;
+        }
+    }
+    if (short_image) {
+        fprintf(stderr, "image is short, padded with zeros\n");
+    }
+    return 0;
+}
+
+static int unpack(FILE* in, FILE* out) {
+    char header[PIMG_HEADER_BYTES];
+    PimgHeader h;
+    if (fread(header, sizeof(header), 1, in) != 1) {
+        fprintf(stderr, "can't read the header\n");
+        return 1;
+    }
+    memcpy(&h, header, sizeof(h));
+    if (!pimg_header_valid(&h) || h.track_bytes > sizeof(g_track)) {
+        fprintf(stderr, "not a valid .pimg header\n");
+        return 1;
+    }
+    if (fseek(in, h.data_offset, SEEK_SET)) {
+        perror("seek");
+        return 1;
+    }
+
+    uint32_t bytes = (uint32_t)h.sectors * h.sector_bytes;
+    for (uint32_t track = 0; track < (uint32_t)h.cylinders * h.heads;
+         track++) {
+        if (fread(g_track, h.track_bytes, 1, in) != 1) {
+            fprintf(stderr, "image is short at track %u\n", track);
+            return 1;
+        }
+        if (fwrite(g_track, bytes, 1, out) != 1) {
+            perror("write");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        return usage(argv[0]);
+    }
+    bool packing = !strcmp(argv[1], "pack");
+    if (!packing && strcmp(argv[1], "unpack")) {
+        return usage(argv[0]);
+    }
+
+    const AnsiDiskType* disk_type = &g_disk_types[0];
+    uint16_t sectors = 0;
+    uint16_t sector_bytes = HARD_DISK_SECTOR_SIZE;
+    int i = 2;
+    for (; packing && i + 1 < argc && argv[i][0] == '-'; i += 2) {
+        if (!strcmp(argv[i], "-t")) {
+            disk_type = ansi_find_disk_type(argv[i + 1]);
+            if (!disk_type) {
+                fprintf(stderr, "unknown disk type %s\n", argv[i + 1]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "-s")) {
+            sectors = atoi(argv[i + 1]);
+        } else if (!strcmp(argv[i], "-b")) {
+            sector_bytes = atoi(argv[i + 1]);
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (argc - i != 2) {
+        return usage(argv[0]);
+    }
+    if (!sectors) {
+        sectors = disk_type->sectors;
+    }
+    // the same check as the firmware makes of a reformat or the ini
+    AnsiDev dev = {};
+    dev.disk_type = disk_type;
+    if (!ansi_geometry_valid(&dev, sectors, sector_bytes)) {
+        fprintf(stderr,
+                "a %s track holds at most %d sectors of at most %d bytes, "
+                "%u bytes in all\n",
+                disk_type->name, ANSI_MAX_SECTORS_PER_TRACK,
+                HARD_DISK_SECTOR_SIZE,
+                (unsigned)disk_type->sectors * HARD_DISK_SECTOR_SIZE);
+        return 1;
+    }
+
+    FILE* in = fopen(argv[i], "rb");
+    if (!in) {
+        perror(argv[i]);
+        return 1;
+    }
+    FILE* out = fopen(argv[i + 1], "wb");
+    if (!out) {
+        perror(argv[i + 1]);
+        return 1;
+    }
+
+    int ret = packing ? pack(in, out, disk_type, sectors, sector_bytes)
+                      : unpack(in, out);
+    fclose(in);
+    if (fclose(out) && !ret) {
+        perror(argv[i + 1]);
+        ret = 1;
+    }
+    return ret;
+}
@@ -0,0 +1,11 @@
+// the SD object of the Teensy SD library, over the SdFat stub
+#pragma once
+
+#include <SdFat.h>
+
+class SDClass {
+  public:
+    SdFs sdfs;
+};
+
+inline SDClass SD;
@@ -0,0 +1,145 @@
+// Just enough of SdFat for the native unit tests to run ImageBackingStore on
+// the host.  The card is a block of memory, and files are byte ranges of it
+// that start on a sector boundary, so a file can be read and written both
+// through FsFile and as the raw sectors under it.  A file that isn't
+// contiguous doesn't tell ImageBackingStore where it is.
+//
+// The card and the files count the calls made to them, so a test can tell
+// which path an access took.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <string>
+#include <vector>
+
+typedef uint64_t fspos_t;
+
+class SdCard {
+  public:
+    std::vector<uint8_t> data;
+    uint32_t sector_reads = 0;
+    uint32_t sector_writes = 0;
+
+    uint32_t sectorCount() { return data.size() / 512; }
+
+    bool readSectors(uint32_t sector, uint8_t* dst, size_t ns) {
+        if (sector + ns > sectorCount()) {
+            return false;
+        }
+        memcpy(dst, &data[(size_t)sector * 512], ns * 512);
+        sector_reads++;
+        return true;
+    }
+
+    bool writeSectors(uint32_t sector, const uint8_t* src, size_t ns) {
+        if (sector + ns > sectorCount()) {
+            return false;
+        }
+        memcpy(&data[(size_t)sector * 512], src, ns * 512);
+        sector_writes++;
+        return true;
+    }
+};
+
+struct StubSdFile {
+    SdCard* card;
+    uint32_t first_sector;
+    uint64_t size;
+    bool contiguous;
+    uint32_t reads;
+    uint32_t writes;
+};
+
+class FsFile {
+  public:
+    bool isOpen() const { return m_file != nullptr; }
+
+    bool close() {
+        m_file = nullptr;
+        return true;
+    }
+
+    uint64_t size() { return m_file ? m_file->size : 0; }
+
+    bool contiguousRange(uint32_t* bgnSector, uint32_t* endSector) {
+        if (!m_file || !m_file->contiguous) {
+            return false;
+        }
+        *bgnSector = m_file->first_sector;
+        *endSector = m_file->first_sector + (m_file->size + 511) / 512 - 1;
+        return true;
+    }
+
+    bool seek(uint64_t pos) {
+        if (!m_file || pos > m_file->size) {
+            return false;
+        }
+        m_pos = pos;
+        return true;
+    }
+
+    int read(void* buf, size_t count) {
+        if (!m_file) {
+            return -1;
+        }
+        if (count > m_file->size - m_pos) {
+            count = m_file->size - m_pos;
+        }
+        memcpy(buf, bytes(), count);
+        m_pos += count;
+        m_file->reads++;
+        return count;
+    }
+
+    size_t write(const void* buf, size_t count) {
+        if (!m_file || count > m_file->size - m_pos) {
+            return 0;
+        }
+        memcpy(bytes(), buf, count);
+        m_pos += count;
+        m_file->writes++;
+        return count;
+    }
+
+    void flush() {}
+
+    uint64_t curPosition() { return m_pos; }
+
+    StubSdFile* m_file = nullptr;
+    uint64_t m_pos = 0;
+
+  private:
+    uint8_t* bytes() {
+        return &m_file->card->data[(size_t)m_file->first_sector * 512 + m_pos];
+    }
+};
+
+class SdFs {
+  public:
+    SdCard* card() { return &m_card; }
+
+    FsFile open(const char* name, int) {
+        FsFile file;
+        auto it = files.find(name);
+        if (it != files.end()) {
+            file.m_file = &it->second;
+        }
+        return file;
+    }
+
+    // Put a file of `size` bytes on the card at first_sector.
+    StubSdFile& addFile(const char* name, uint32_t first_sector,
+                        uint64_t size, bool contiguous) {
+        files[name] = StubSdFile{&m_card, first_sector, size, contiguous, 0, 0};
+        return files[name];
+    }
+
+    std::map<std::string, StubSdFile> files;
+
+  private:
+    SdCard m_card;
+};
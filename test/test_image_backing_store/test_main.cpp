@@ -0,0 +1,188 @@
+// ImageBackingStore's raw sector access against the memory card of
+// test/native_stubs: aligned transfers of a contiguous image go straight to
+// the card, unaligned ones fall back to the file for good, and a RAW:
+// partition stays within its range and the card.  Run with
+// pio test -e native_unit.
+
+#include "ImageBackingStore.h"
+#include <unity.h>
+
+// 64 sectors, each byte set to 7 times its offset (mod 256)
+#define CARD_SECTORS 64
+
+static SdCard* g_card;
+static StubSdFile* g_file;
+
+void setUp() {
+    SD.sdfs.files.clear();
+    g_card = SD.sdfs.card();
+    g_card->data.resize(CARD_SECTORS * SD_SECTOR_SIZE);
+    for (size_t i = 0; i < g_card->data.size(); i++) {
+        g_card->data[i] = i * 7;
+    }
+    g_card->sector_reads = g_card->sector_writes = 0;
+    // 16 sectors at sector 8, plus half a sector
+    g_file = &SD.sdfs.addFile("disk.img", 8, 16 * SD_SECTOR_SIZE + 256, true);
+}
+
+void tearDown() {}
+
+static uint8_t card_byte(uint32_t offset) { return offset * 7; }
+
+static void test_contiguous_image_is_raw() {
+    ImageBackingStore store("disk.img", SD_SECTOR_SIZE);
+    TEST_ASSERT_TRUE(store.isOpen());
+    TEST_ASSERT_TRUE(store.isRaw());
+
+    uint32_t bgn, end;
+    TEST_ASSERT_TRUE(store.contiguousRange(&bgn, &end));
+    TEST_ASSERT_EQUAL_INT(8, bgn);
+    // the half sector at the end isn't mapped
+    TEST_ASSERT_EQUAL_INT(23, end);
+}
+
+static void test_aligned_read_write_go_to_card() {
+    ImageBackingStore store("disk.img", SD_SECTOR_SIZE);
+    uint8_t buf[2 * SD_SECTOR_SIZE];
+
+    TEST_ASSERT_TRUE(store.seek(3 * SD_SECTOR_SIZE));
+    TEST_ASSERT_EQUAL_INT(sizeof(buf), store.read(buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_INT(card_byte(11 * SD_SECTOR_SIZE), buf[0]);
+    TEST_ASSERT_EQUAL_INT(card_byte(13 * SD_SECTOR_SIZE - 1),
+                          buf[sizeof(buf) - 1]);
+    TEST_ASSERT_EQUAL_INT(5 * SD_SECTOR_SIZE, store.position());
+
+    memset(buf, 0xa5, sizeof(buf));
+    TEST_ASSERT_EQUAL_INT(sizeof(buf), store.write(buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_INT(0xa5, g_card->data[13 * SD_SECTOR_SIZE]);
+    TEST_ASSERT_EQUAL_INT(0xa5, g_card->data[15 * SD_SECTOR_SIZE - 1]);
+    TEST_ASSERT_EQUAL_INT(card_byte(15 * SD_SECTOR_SIZE),
+                          g_card->data[15 * SD_SECTOR_SIZE]);
+
+    // one multi-sector transfer each, nothing through the file
+    TEST_ASSERT_EQUAL_INT(1, g_card->sector_reads);
+    TEST_ASSERT_EQUAL_INT(1, g_card->sector_writes);
+    TEST_ASSERT_EQUAL_INT(0, g_file->reads + g_file->writes);
+    TEST_ASSERT_TRUE(store.isRaw());
+}
+
+static void test_unaligned_offset_falls_back_to_file() {
+    ImageBackingStore store("disk.img", SD_SECTOR_SIZE);
+    uint8_t buf[SD_SECTOR_SIZE];
+
+    TEST_ASSERT_TRUE(store.seek(SD_SECTOR_SIZE + 100));
+    TEST_ASSERT_FALSE(store.isRaw());
+    TEST_ASSERT_EQUAL_INT(sizeof(buf), store.read(buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_INT(card_byte(9 * SD_SECTOR_SIZE + 100), buf[0]);
+    TEST_ASSERT_EQUAL_INT(1, g_file->reads);
+
+    // and stays there, aligned or not
+    TEST_ASSERT_TRUE(store.seek(0));
+    TEST_ASSERT_EQUAL_INT(sizeof(buf), store.read(buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_INT(0, g_card->sector_reads);
+    TEST_ASSERT_EQUAL_INT(2, g_file->reads);
+}
+
+static void test_unaligned_length_falls_back_at_position() {
+    ImageBackingStore store("disk.img", SD_SECTOR_SIZE);
+    uint8_t buf[300];
+
+    TEST_ASSERT_TRUE(store.seek(2 * SD_SECTOR_SIZE));
+    TEST_ASSERT_EQUAL_INT(sizeof(buf), store.read(buf, sizeof(buf)));
+    TEST_ASSERT_FALSE(store.isRaw());
+    TEST_ASSERT_EQUAL_INT(card_byte(10 * SD_SECTOR_SIZE), buf[0]);
+    TEST_ASSERT_EQUAL_INT(2 * SD_SECTOR_SIZE + sizeof(buf), store.position());
+
+    memset(buf, 0x5a, sizeof(buf));
+    TEST_ASSERT_EQUAL_INT(sizeof(buf), store.write(buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_INT(0x5a, g_card->data[10 * SD_SECTOR_SIZE + 300]);
+    TEST_ASSERT_EQUAL_INT(0, g_card->sector_reads + g_card->sector_writes);
+}
+
+static void test_unmapped_tail_falls_back_to_file() {
+    ImageBackingStore store("disk.img", SD_SECTOR_SIZE);
+    uint8_t buf[256];
+
+    TEST_ASSERT_TRUE(store.seek(16 * SD_SECTOR_SIZE));
+    TEST_ASSERT_FALSE(store.isRaw());
+    TEST_ASSERT_EQUAL_INT(sizeof(buf), store.read(buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_INT(card_byte(24 * SD_SECTOR_SIZE), buf[0]);
+}
+
+static void test_fragmented_image_uses_file() {
+    SD.sdfs.addFile("frag.img", 40, 4 * SD_SECTOR_SIZE, false);
+    ImageBackingStore store("frag.img", SD_SECTOR_SIZE);
+    uint8_t buf[SD_SECTOR_SIZE];
+
+    TEST_ASSERT_TRUE(store.isOpen());
+    TEST_ASSERT_FALSE(store.isRaw());
+    TEST_ASSERT_EQUAL_INT(sizeof(buf), store.read(buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_INT(card_byte(40 * SD_SECTOR_SIZE), buf[0]);
+    TEST_ASSERT_EQUAL_INT(0, g_card->sector_reads);
+}
+
+static void test_raw_partition_stays_in_range() {
+    ImageBackingStore store("RAW:10:19", SD_SECTOR_SIZE);
+    uint8_t buf[2 * SD_SECTOR_SIZE];
+
+    TEST_ASSERT_TRUE(store.isOpen());
+    TEST_ASSERT_EQUAL_INT(10 * SD_SECTOR_SIZE, store.size());
+
+    TEST_ASSERT_TRUE(store.seek(9 * SD_SECTOR_SIZE));
+    TEST_ASSERT_EQUAL_INT(SD_SECTOR_SIZE, store.read(buf, SD_SECTOR_SIZE));
+    TEST_ASSERT_EQUAL_INT(card_byte(19 * SD_SECTOR_SIZE), buf[0]);
+
+    // past the end of the range, and across it
+    TEST_ASSERT_FALSE(store.seek(10 * SD_SECTOR_SIZE));
+    TEST_ASSERT_TRUE(store.seek(9 * SD_SECTOR_SIZE));
+    TEST_ASSERT_EQUAL_INT(-1, store.read(buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_INT(0, store.write(buf, sizeof(buf)));
+
+    // nothing to fall back to for unaligned access
+    TEST_ASSERT_FALSE(store.seek(100));
+    TEST_ASSERT_TRUE(store.seek(0));
+    TEST_ASSERT_EQUAL_INT(-1, store.read(buf, 100));
+    TEST_ASSERT_EQUAL_INT(1, g_card->sector_reads);
+    TEST_ASSERT_EQUAL_INT(0, g_card->sector_writes);
+}
+
+static void test_raw_partition_limited_to_card() {
+    ImageBackingStore store("RAW:60:100", SD_SECTOR_SIZE);
+    uint8_t buf[SD_SECTOR_SIZE];
+
+    TEST_ASSERT_TRUE(store.isOpen());
+    TEST_ASSERT_EQUAL_INT((CARD_SECTORS - 60) * SD_SECTOR_SIZE, store.size());
+    TEST_ASSERT_FALSE(store.seek((CARD_SECTORS - 60) * SD_SECTOR_SIZE));
+    TEST_ASSERT_TRUE(store.seek((CARD_SECTORS - 61) * SD_SECTOR_SIZE));
+    TEST_ASSERT_EQUAL_INT(sizeof(buf), store.read(buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_INT(-1, store.read(buf, sizeof(buf)));
+}
+
+static void test_raw_partition_rejects_bad_ranges() {
+    ImageBackingStore reversed("RAW:20:10", SD_SECTOR_SIZE);
+    TEST_ASSERT_FALSE(reversed.isOpen());
+
+    ImageBackingStore malformed("RAW:10-19", SD_SECTOR_SIZE);
+    TEST_ASSERT_FALSE(malformed.isOpen());
+
+    ImageBackingStore no_end("RAW:10", SD_SECTOR_SIZE);
+    TEST_ASSERT_FALSE(no_end.isOpen());
+
+    // whole SD sectors only, there is no file to fall back to
+    ImageBackingStore unaligned("RAW:10:19", 1056);
+    TEST_ASSERT_FALSE(unaligned.isOpen());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_contiguous_image_is_raw);
+    RUN_TEST(test_aligned_read_write_go_to_card);
+    RUN_TEST(test_unaligned_offset_falls_back_to_file);
+    RUN_TEST(test_unaligned_length_falls_back_at_position);
+    RUN_TEST(test_unmapped_tail_falls_back_to_file);
+    RUN_TEST(test_fragmented_image_uses_file);
+    RUN_TEST(test_raw_partition_stays_in_range);
+    RUN_TEST(test_raw_partition_limited_to_card);
+    RUN_TEST(test_raw_partition_rejects_bad_ranges);
+    return UNITY_END();
+}
@@ -0,0 +1,101 @@
+// The read-ahead predictor against sequential, interleaved and random read
+// patterns, see src/TANSI_readahead.h.  Run with pio test -e native_unit.
+
+#include "TANSI_readahead.h"
+#include <unity.h>
+
+// 10 cylinders of 2 tracks of 12 sectors
+static const AnsiDiskType g_type = {"test", 0, 10, 2, 12, 3600, 0, 0, 0, 0, 0};
+
+#define TRACK_BYTES (12 * HARD_DISK_SECTOR_SIZE)
+#define REVOLUTION_US 16667
+#define TRACK_LOAD_US 2000
+
+static ReadAheadState g_ra;
+
+void setUp() { g_ra = ReadAheadState(); }
+
+void tearDown() {}
+
+static void read_track(uint16_t cylinder, uint8_t head, uint8_t stride) {
+    for (uint8_t pass = 0; pass < stride; pass++) {
+        for (uint8_t sector = pass; sector < g_type.sectors;
+             sector += stride) {
+            readahead_observe(g_ra, &g_type, cylinder, head, sector);
+        }
+    }
+}
+
+static int next_cylinder(uint32_t prefetch_bytes, uint32_t track_load_us) {
+    return readahead_next_cylinder(g_ra, &g_type, prefetch_bytes, TRACK_BYTES,
+                                   track_load_us, REVOLUTION_US);
+}
+
+static void test_sequential_stages_next_cylinder() {
+    read_track(0, 0, 1);
+    // a track of lead, and the next track is still on this cylinder
+    TEST_ASSERT_EQUAL_INT(-1, next_cylinder(TRACK_BYTES, TRACK_LOAD_US));
+
+    read_track(0, 1, 1);
+    TEST_ASSERT_EQUAL_INT(1, next_cylinder(TRACK_BYTES, TRACK_LOAD_US));
+
+    // and on over the cylinder switch
+    read_track(1, 0, 1);
+    read_track(1, 1, 1);
+    TEST_ASSERT_EQUAL_INT(2, next_cylinder(TRACK_BYTES, TRACK_LOAD_US));
+}
+
+static void test_short_run_stages_nothing() {
+    readahead_observe(g_ra, &g_type, 0, 1, 0);
+    readahead_observe(g_ra, &g_type, 0, 1, 1);
+    TEST_ASSERT_EQUAL_INT(-1, next_cylinder(TRACK_BYTES, TRACK_LOAD_US));
+}
+
+static void test_interleaved_stages_next_cylinder() {
+    read_track(0, 0, 3);
+    read_track(0, 1, 3);
+    TEST_ASSERT_EQUAL_INT(3, g_ra.stride);
+    TEST_ASSERT_EQUAL_INT(1, next_cylinder(TRACK_BYTES, TRACK_LOAD_US));
+}
+
+static void test_random_stages_nothing() {
+    static const uint8_t cylinders[] = {4, 0, 7, 2, 9, 1};
+    for (uint8_t c : cylinders) {
+        readahead_observe(g_ra, &g_type, c, c & 1, c);
+    }
+    TEST_ASSERT_EQUAL_INT(-1, next_cylinder(TRACK_BYTES, TRACK_LOAD_US));
+}
+
+static void test_slow_loads_lengthen_lead() {
+    read_track(0, 0, 1);
+    // loading a track takes longer than the host reading one, so the next
+    // cylinder is staged a track earlier than the prefetch asks for
+    TEST_ASSERT_EQUAL_INT(1, next_cylinder(TRACK_BYTES, 2 * REVOLUTION_US));
+}
+
+static void test_prefetch_bytes_set_lead() {
+    read_track(0, 0, 1);
+    TEST_ASSERT_EQUAL_INT(1, next_cylinder(2 * TRACK_BYTES, TRACK_LOAD_US));
+}
+
+static void test_disabled_or_last_cylinder_stages_nothing() {
+    read_track(0, 1, 1);
+    TEST_ASSERT_EQUAL_INT(-1, next_cylinder(0, TRACK_LOAD_US));
+
+    g_ra = ReadAheadState();
+    read_track(9, 0, 1);
+    read_track(9, 1, 1);
+    TEST_ASSERT_EQUAL_INT(-1, next_cylinder(TRACK_BYTES, TRACK_LOAD_US));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_sequential_stages_next_cylinder);
+    RUN_TEST(test_short_run_stages_nothing);
+    RUN_TEST(test_interleaved_stages_next_cylinder);
+    RUN_TEST(test_random_stages_nothing);
+    RUN_TEST(test_slow_loads_lengthen_lead);
+    RUN_TEST(test_prefetch_bytes_set_lead);
+    RUN_TEST(test_disabled_or_last_cylinder_stages_nothing);
+    return UNITY_END();
+}